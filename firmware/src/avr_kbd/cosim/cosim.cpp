@@ -0,0 +1,536 @@
+/*
+ * Keyboard chain co-simulation, host side
+ *
+ * Runs src/main.cpp and lib/PS2KeyRaw on the host against a virtual clock: the
+ * bytes of a trace file are clocked into the library's interrupt bit by bit at
+ * their times, every pin access, SPI byte, delay() and loop() pass takes its AVR
+ * time (the costs below), and the SPI frames go to a model of cpld_kbd which
+ * answers the loopback and init requests like the fpga does. The library's
+ * clock inhibit holds the next byte back on the ps/2 clock pin.
+ *
+ * The frames are written as a tb_cpld_kbd frame file on the same timeline
+ * (28 MHz clocks), so the GHDL run replays them afterwards at the times the
+ * firmware sent them and measures keystroke to KB latency end to end. This is
+ * a replay, not a lockstep run: the firmware only ever sees the model above.
+ * Frame file lines:
+ *   @ n        the next frame starts at clock n
+ *   P n        a key event finished arriving at clock n, latency counts from it
+ *   F / K      the frames and the KB values they make visible
+ * Repeated frames which change nothing on the cpld_kbd side are left out, idle
+ * stretches are cut to IDLE_MAX clocks, around a key event everything is kept.
+ *
+ * cosim [-l loop_ns] [-d decode_ns] [-i io_ns] trace.ps2 out.frm
+ *
+ * Trace file, one key event per line, '#' starts a comment:
+ *   ms  bytes...   time after the boot, the scancode bytes in hex (e.g. 250 F0 1C)
+ *
+ * Prints one line at the end, latency from the stop bit of a key event to the
+ * SS rise of the frame committing it, in 28 MHz clocks:
+ *   RESULT trace=... decode=... keys=... avr_latency_min=... avr_latency_avg=... avr_latency_max=...
+ *          ps2_inhibits=... ps2_overruns=...   (PS2KeyRaw flow control)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+#include "config.h"
+#include "matrix.h"
+#include "cosim_hal.h"
+#include "PS2KeyRaw.h"
+
+#if KBD_DECODE == KBD_DECODE_FPGA
+#error "the cpld_kbd model has no scancode decoder, build with KBD_DECODE_AVR or KBD_DECODE_ISR"
+#endif
+
+#define CLK_HZ 28000000ULL // cpld_kbd clock, the frame file time base
+#define START_CLK 100 // first frame time, the testbench starts after 10 clocks
+#define IDLE_MAX 28000 // longest idle stretch kept, 1 ms
+#define PS2_BYTE_NS 1000000ULL // 11 bits at 12.5 kHz and the gap to the next byte
+#define PS2_BIT_NS 80000ULL // 12.5 kHz ps/2 clock
+#define TAIL_NS 100000000ULL // run time after the last key event
+#define MARK_TIMEOUT_NS 20000000ULL // a key event without a KB change by then changes nothing (repeat, ctrl)
+
+volatile uint8_t SREG;
+volatile uint8_t PORTB, DDRB, PINB;
+volatile uint8_t PORTC, DDRC, PINC;
+volatile uint8_t PORTD, DDRD, PIND;
+volatile uint8_t MCUCSR; // power on flags never set, setup() takes the cold boot path
+
+// AVR time of the firmware parts, Arduino core build at 16 MHz
+static uint32_t loop_ns = 20000; // loop() without its pin and SPI accesses
+static uint32_t decode_ns = 15000; // fill_kbd_matrix() of one scancode
+static uint32_t io_ns = 3500; // digitalWrite() / digitalRead(), 0 for env:ATmega8_bare
+static const uint32_t spi_byte_ns = 400; // SPDR write and the SPIF poll around a byte
+
+static uint64_t now_ns = 0;
+static uint32_t spi_hz = 1000000;
+
+// trace bytes with their arrival times
+struct ps2_byte {
+  uint64_t t;
+  uint8_t sc;
+  bool last; // last byte of a key event
+};
+static std::vector<ps2_byte> trace;
+static size_t trace_pos = 0;
+static bool trace_armed = false;
+
+// ps/2 lines, lib/PS2KeyRaw gets its clock interrupts and reads the data pin
+static void (*ps2_isr)(void) = 0;
+static bool in_isr = false;
+static bool isr_pending = false; // a falling clock edge during the interrupt
+static uint8_t ps2_data = HIGH;
+static bool clk_low = false; // clock pin written low
+static bool clk_out = false; // and driven
+static uint64_t ps2_free_ns = 0; // the keyboard can end its next byte from then on
+static uint8_t ps2_bit_pos = 0; // next bit of trace[trace_pos], 0: not started
+static uint64_t ps2_byte_start = 0; // time of its start bit
+cosim_trace_pin cosim_trace_port;
+
+// cpld_kbd model
+static uint8_t shadow[9];
+static bool dirty[9];
+static uint8_t kb_data[5];
+static bool echo = false;
+static uint8_t echo_data = 0;
+static bool reset = false;
+
+// current frame
+static uint64_t frame_t = 0;
+static uint8_t frame_tx[2];
+static uint8_t frame_rx[2];
+static uint8_t frame_pos = 0;
+
+// frame file
+static std::vector<std::string> out;
+static bool recording = false;
+static uint64_t base_ns = 0;
+static uint64_t idle_cut = 0;
+static uint64_t last_clk = 0;
+static int last_sent[256];
+static bool rows_pending = false;
+static uint8_t kb_shown[8];
+static bool mark_open = false;
+static size_t mark_index = 0;
+static uint64_t mark_clk = 0;
+static uint64_t mark_ns = 0;
+
+static unsigned keys = 0;
+static uint64_t lat_min = UINT64_MAX;
+static uint64_t lat_max = 0;
+static uint64_t lat_sum = 0;
+
+// frame file time of t, idle stretches without a key event in flight are cut
+static uint64_t to_clk(uint64_t t)
+{
+  uint64_t c = (t - base_ns) * CLK_HZ / 1000000000ULL - idle_cut;
+  if (!mark_open && c > last_clk + IDLE_MAX) {
+    idle_cut += c - last_clk - IDLE_MAX;
+    c = last_clk + IDLE_MAX;
+  }
+  last_clk = c;
+  return c + START_CLK;
+}
+
+static std::string item(const char *fmt, unsigned a, unsigned b = 0)
+{
+  char s[32];
+  snprintf(s, sizeof(s), fmt, a, b);
+  return s;
+}
+
+// a key event has fully arrived, its latency is counted if it changes KB
+static void mark_key(uint64_t t)
+{
+  if (!recording) {
+    return;
+  }
+  if (mark_open) {
+    out[mark_index] = ""; // no visible change, e.g. a ctrl press
+  }
+  mark_ns = t;
+  mark_clk = to_clk(t);
+  out.push_back("");
+  mark_index = out.size() - 1;
+  mark_open = true;
+}
+
+// the clock line is held low by the firmware, the keyboard keeps the next bytes
+static bool clock_held()
+{
+  return clk_out && clk_low;
+}
+
+// falling edge of the ps/2 clock, an edge during the interrupt runs it after its end
+static void clock_edge()
+{
+  if (!ps2_isr) {
+    return;
+  }
+  if (in_isr) {
+    isr_pending = true;
+    return;
+  }
+  do {
+    isr_pending = false;
+    in_isr = true;
+    ps2_isr();
+    in_isr = false;
+  } while (isr_pending);
+}
+
+// data line for bit i of a byte: start, 8 data bits lsb first, odd parity, stop
+static uint8_t ps2_bit(uint8_t sc, uint8_t i)
+{
+  if (i == 0) {
+    return LOW;
+  } else if (i <= 8) {
+    return (sc >> (i - 1)) & 1;
+  } else if (i == 9) {
+    uint8_t parity = 1;
+    for (uint8_t k = 0; k < 8; k++) {
+      parity ^= (sc >> k) & 1;
+    }
+    return parity;
+  }
+  return HIGH;
+}
+
+// arrival time of a trace byte (its stop bit), later than in the trace when the keyboard was held by a clock inhibit
+static uint64_t arrival(const ps2_byte &b)
+{
+  return b.t > ps2_free_ns ? b.t : ps2_free_ns;
+}
+
+// run the clock, the ps/2 interrupt of every clock edge preempts whatever takes the time
+static void advance(uint64_t ns)
+{
+  uint64_t end = now_ns + ns;
+  if (in_isr) {
+    now_ns += ns; // nothing preempts the interrupt
+    return;
+  }
+  while (trace_armed && trace_pos < trace.size()) {
+    const ps2_byte &b = trace[trace_pos];
+    if (clock_held()) {
+      ps2_bit_pos = 0; // the keyboard waits, a byte cut before its stop bit is sent again
+      break;
+    }
+    if (ps2_bit_pos == 0) {
+      ps2_byte_start = arrival(b) - 10 * PS2_BIT_NS;
+    }
+    uint64_t t = ps2_byte_start + ps2_bit_pos * PS2_BIT_NS;
+    if (t > end) {
+      break;
+    }
+    if (t > now_ns) {
+      now_ns = t;
+    }
+    if (ps2_bit_pos == 10) {
+      ps2_free_ns = now_ns + PS2_BYTE_NS;
+      if (b.last) {
+        mark_key(now_ns); // latency counts from the stop bit
+      }
+    }
+    uint64_t before = now_ns;
+    ps2_data = ps2_bit(b.sc, ps2_bit_pos);
+    clock_edge();
+    end += now_ns - before;
+    if (++ps2_bit_pos == 11) {
+      ps2_bit_pos = 0;
+      trace_pos++;
+    }
+  }
+  now_ns = end;
+}
+
+// KB for the half row selected by A(8 + r) = 0
+static uint8_t half_row(uint8_t r)
+{
+  uint8_t v = 0x1F;
+  for (uint8_t j = 0; j < 5; j++) {
+    if (kb_data[j] & (1 << r)) {
+      v &= ~(1 << j);
+    }
+  }
+  return v;
+}
+
+// cpld_kbd side of a frame, same as its frame process
+static void cpld_frame(uint8_t cmd, uint8_t data)
+{
+  echo = (cmd == 0x0A);
+  echo_data = data;
+  if (cmd >= 1 && cmd <= 8) {
+    shadow[cmd] = data;
+    dirty[cmd] = true;
+  }
+  if (cmd == 8 || cmd == 0x0B) {
+    for (uint8_t i = 1; i <= 5; i++) {
+      if (dirty[i]) {
+        kb_data[i - 1] = shadow[i];
+      }
+    }
+    if (dirty[6]) {
+      reset = shadow[6] & 0x01;
+    }
+    memset(dirty, 0, sizeof(dirty));
+  }
+}
+
+static void frame_done()
+{
+  uint8_t cmd = frame_tx[0];
+  uint8_t data = frame_tx[1];
+  cpld_frame(cmd, data);
+  if (!recording) {
+    return;
+  }
+  if (mark_open && frame_t > mark_ns + MARK_TIMEOUT_NS) {
+    out[mark_index] = "";
+    mark_open = false;
+  }
+
+  bool row = cmd >= 1 && cmd <= 8;
+  bool commit = cmd == 8 || cmd == 0x0B;
+  // a repeated row changes nothing, a commit is needed after a changed row only
+  bool keep = mark_open || !row || last_sent[cmd] != data || (commit && rows_pending);
+  if (commit && !row) {
+    keep = mark_open || rows_pending;
+  }
+  if (!keep) {
+    return;
+  }
+
+  out.push_back(item("@ %u", (unsigned) to_clk(frame_t)));
+  out.push_back(item("F %02X %02X", cmd, data));
+  if (row) {
+    last_sent[cmd] = data;
+    rows_pending = true;
+  }
+  if (!commit) {
+    return;
+  }
+  rows_pending = false;
+
+  bool changed = false;
+  for (uint8_t r = 0; r < 8; r++) {
+    uint8_t v = half_row(r);
+    if (v != kb_shown[r]) {
+      out.push_back(item("K %02X %02X", (uint8_t) ~(1 << r), v));
+      kb_shown[r] = v;
+      changed = true;
+    }
+  }
+  if (changed && mark_open) {
+    uint64_t lat = to_clk(now_ns) - mark_clk;
+    out[mark_index] = item("P %u", (unsigned) mark_clk);
+    mark_open = false;
+    keys++;
+    lat_sum += lat;
+    if (lat < lat_min) lat_min = lat;
+    if (lat > lat_max) lat_max = lat;
+  }
+}
+
+void cosim_spi_clock(uint32_t hz)
+{
+  spi_hz = hz;
+}
+
+uint8_t cosim_spi_transfer(uint8_t data)
+{
+  advance(8000000000ULL / spi_hz + spi_byte_ns);
+  if (frame_pos < 2) {
+    frame_tx[frame_pos] = data;
+    return frame_rx[frame_pos++];
+  }
+  return 0xFF;
+}
+
+// the clock pin is open collector: held low when driven and written low
+static void clock_pin(bool low, bool out)
+{
+  bool was_held = clock_held();
+  clk_low = low;
+  clk_out = out;
+  if (clock_held() && !was_held) {
+    clock_edge(); // our own inhibit is a falling edge as well
+  } else if (was_held && !clock_held() && ps2_free_ns < now_ns + PS2_BYTE_NS) {
+    // released, the keyboard starts its next byte after a byte time at the earliest
+    ps2_free_ns = now_ns + PS2_BYTE_NS;
+  }
+}
+
+void cosim_pin_mode(uint8_t pin, uint8_t mode)
+{
+  if (pin == PIN_KBD_CLK) {
+    clock_pin(mode == INPUT_PULLUP ? false : clk_low, mode == OUTPUT);
+  }
+}
+
+void cosim_attach_interrupt(uint8_t interrupt, void (*handler)(void))
+{
+  if (interrupt == digitalPinToInterrupt(PIN_KBD_CLK)) {
+    ps2_isr = handler;
+  }
+}
+
+// fill_kbd_matrix() of one scancode
+void cosim_trace()
+{
+  advance(decode_ns);
+}
+
+void cosim_pin_write(uint8_t pin, uint8_t value)
+{
+  advance(io_ns);
+  if (pin == PIN_KBD_CLK) {
+    clock_pin(value == LOW, clk_out);
+    return;
+  }
+  if (pin != PIN_SS) {
+    return;
+  }
+  if (value == LOW) {
+    // answer to the previous frame: loopback echo or init request with the status
+    uint16_t reply = echo ? (echo_data << 8) | (uint8_t) ~echo_data : 0xF000 | (reset ? FPGA_STATUS_RESET_ACK : 0);
+    frame_rx[0] = reply >> 8;
+    frame_rx[1] = reply & 0xFF;
+    frame_pos = 0;
+    frame_t = now_ns;
+  } else if (frame_pos == 2) {
+    frame_done();
+    frame_pos = 0;
+  }
+}
+
+// buttons and joystick pins are pulled up, nothing is pressed
+uint8_t cosim_pin_read(uint8_t pin)
+{
+  advance(io_ns);
+  if (pin == PIN_KBD_DAT) {
+    return ps2_data;
+  }
+  if (pin == PIN_KBD_CLK) {
+    return clock_held() ? LOW : HIGH; // clock edges take no time, the line is high in between
+  }
+  return HIGH;
+}
+
+void cosim_delay_us(uint32_t us)
+{
+  advance((uint64_t) us * 1000);
+}
+
+uint32_t cosim_micros()
+{
+  return now_ns / 1000;
+}
+
+static void load_trace(const char *name)
+{
+  FILE *f = fopen(name, "r");
+  if (!f) {
+    perror(name);
+    exit(2);
+  }
+  char line[256];
+  int line_no = 0;
+  uint64_t busy = 0; // the keyboard sends one byte at a time
+  while (fgets(line, sizeof(line), f)) {
+    line_no++;
+    char *s = strchr(line, '#');
+    if (s) {
+      *s = 0;
+    }
+    char *end;
+    double ms = strtod(line, &end);
+    if (end == line) {
+      continue;
+    }
+    uint64_t t = (uint64_t) (ms * 1000000.0);
+    if (t < busy) {
+      t = busy;
+    }
+    size_t first = trace.size();
+    for (s = strtok(end, " \t\r\n"); s; s = strtok(0, " \t\r\n")) {
+      t += PS2_BYTE_NS;
+      trace.push_back({t, (uint8_t) strtoul(s, 0, 16), false});
+    }
+    if (trace.size() == first) {
+      fprintf(stderr, "%s:%d: no scancode\n", name, line_no);
+      exit(2);
+    }
+    trace.back().last = true;
+    busy = t;
+  }
+  fclose(f);
+}
+
+int main(int argc, char **argv)
+{
+  int opt;
+  while ((opt = getopt(argc, argv, "l:d:i:")) != -1) {
+    switch (opt) {
+      case 'l': loop_ns = atoi(optarg); break;
+      case 'd': decode_ns = atoi(optarg); break;
+      case 'i': io_ns = atoi(optarg); break;
+      default:
+        fprintf(stderr, "usage: %s [-l loop_ns] [-d decode_ns] [-i io_ns] trace.ps2 out.frm\n", argv[0]);
+        return 2;
+    }
+  }
+  if (argc - optind != 2) {
+    fprintf(stderr, "usage: %s [-l loop_ns] [-d decode_ns] [-i io_ns] trace.ps2 out.frm\n", argv[0]);
+    return 2;
+  }
+  load_trace(argv[optind]);
+
+  setup();
+
+  // the trace starts when the keyboard is up, the testbench starts from reset:
+  // every row is sent once and KB starts released
+  base_ns = now_ns;
+  for (ps2_byte &b : trace) {
+    b.t += base_ns;
+  }
+  memset(last_sent, 0xFF, sizeof(last_sent));
+  memset(kb_shown, 0x1F, sizeof(kb_shown));
+  memset(kb_data, 0, sizeof(kb_data));
+  recording = true;
+  trace_armed = true;
+
+  uint64_t end = (trace.empty() ? now_ns : trace.back().t) + TAIL_NS;
+  while (now_ns < end) {
+    loop();
+    advance(loop_ns);
+  }
+
+  FILE *f = fopen(argv[optind + 1], "w");
+  if (!f) {
+    perror(argv[optind + 1]);
+    return 2;
+  }
+  fprintf(f, "# %s, generated by avr_kbd/cosim from the firmware build, do not edit\n", argv[optind]);
+  fprintf(f, "# sck_hz=%u loop_ns=%u decode_ns=%u io_ns=%u\n", spi_hz, loop_ns, decode_ns, io_ns);
+  for (const std::string &s : out) {
+    if (!s.empty()) {
+      fprintf(f, "%s\n", s.c_str());
+    }
+  }
+  fclose(f);
+
+  const char *trace_name = strrchr(argv[optind], '/');
+  trace_name = trace_name ? trace_name + 1 : argv[optind];
+  printf("RESULT trace=%s decode=%s keys=%u avr_latency_min=%u avr_latency_avg=%u avr_latency_max=%u ps2_inhibits=%u ps2_overruns=%u\n",
+    trace_name, KBD_DECODE == KBD_DECODE_ISR ? "isr" : "avr", keys,
+    (unsigned) (keys ? lat_min : 0), (unsigned) (keys ? lat_sum / keys : 0), (unsigned) lat_max,
+    PS2KeyRaw::inhibits(), PS2KeyRaw::overruns());
+  return 0;
+}
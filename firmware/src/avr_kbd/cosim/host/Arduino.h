@@ -0,0 +1,98 @@
+#ifndef cosim_Arduino_h
+#define cosim_Arduino_h
+
+// Host stand-in for the Arduino core, the calls used by src/main.cpp only.
+// Time is virtual: delay() and every pin or SPI access advance the clock
+// of the co-simulation (cosim.cpp) instead of waiting.
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include "cosim_hal.h"
+
+typedef uint8_t byte;
+typedef uint16_t word;
+typedef bool boolean;
+
+#define HIGH 0x1
+#define LOW 0x0
+
+#define INPUT 0x0
+#define OUTPUT 0x1
+#define INPUT_PULLUP 0x2
+
+#define CHANGE 1
+#define FALLING 2
+#define RISING 3
+
+#define A0 14
+#define A1 15
+#define A2 16
+#define A3 17
+#define A4 18
+#define A5 19
+
+#define bitRead(value, bit) (((value) >> (bit)) & 0x01)
+#define bitSet(value, bit) ((value) |= (1UL << (bit)))
+#define bitClear(value, bit) ((value) &= ~(1UL << (bit)))
+#define bitWrite(value, bit, bitvalue) ((bitvalue) ? bitSet(value, bit) : bitClear(value, bit))
+
+#ifndef max
+#define max(a, b) ((a) > (b) ? (a) : (b))
+#endif
+#ifndef min
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#endif
+#define constrain(x, low, high) ((x) < (low) ? (low) : ((x) > (high) ? (high) : (x)))
+
+#define interrupts() sei()
+#define noInterrupts() cli()
+
+#define digitalPinToInterrupt(p) ((p) == 2 ? 0 : ((p) == 3 ? 1 : -1))
+
+static inline void pinMode(uint8_t pin, uint8_t mode)
+{
+  cosim_pin_mode(pin, mode);
+}
+
+static inline void digitalWrite(uint8_t pin, uint8_t value)
+{
+  cosim_pin_write(pin, value);
+}
+
+static inline uint8_t digitalRead(uint8_t pin)
+{
+  return cosim_pin_read(pin);
+}
+
+static inline void delay(unsigned long ms)
+{
+  cosim_delay_us(ms * 1000);
+}
+
+static inline void delayMicroseconds(unsigned int us)
+{
+  cosim_delay_us(us);
+}
+
+static inline unsigned long micros()
+{
+  return cosim_micros();
+}
+
+static inline unsigned long millis()
+{
+  return cosim_micros() / 1000;
+}
+
+static inline void attachInterrupt(uint8_t interrupt, void (*handler)(void), uint8_t mode)
+{
+  cosim_attach_interrupt(interrupt, handler); // FALLING on the ps/2 clock is the only use
+}
+
+void setup();
+void loop();
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef cosim_EEPROM_h
+#define cosim_EEPROM_h
+
+// 512 bytes of erased EEPROM, the co-simulation always boots with the defaults
+
+#include <string.h>
+#include "Arduino.h"
+
+class EEPROMClass {
+  public:
+    EEPROMClass() {
+      memset(mem, 0xFF, sizeof(mem));
+    }
+    uint8_t read(int addr) {
+      return mem[addr & 0x1FF];
+    }
+    void write(int addr, uint8_t value) {
+      mem[addr & 0x1FF] = value;
+    }
+    void update(int addr, uint8_t value) {
+      mem[addr & 0x1FF] = value;
+    }
+    template <typename T> T &get(int addr, T &value) {
+      memcpy(&value, &mem[addr & 0x1FF], sizeof(T));
+      return value;
+    }
+    template <typename T> const T &put(int addr, const T &value) {
+      memcpy(&mem[addr & 0x1FF], &value, sizeof(T));
+      return value;
+    }
+
+  private:
+    uint8_t mem[512 + 16];
+};
+
+static EEPROMClass EEPROM;
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef cosim_SPI_h
+#define cosim_SPI_h
+
+// SPI master of the co-simulation, the bytes go to the cpld_kbd model in cosim.cpp
+
+#include "Arduino.h"
+
+#define LSBFIRST 0
+#define MSBFIRST 1
+
+#define SPI_MODE0 0x00
+#define SPI_MODE1 0x04
+#define SPI_MODE2 0x08
+#define SPI_MODE3 0x0C
+
+class SPISettings {
+  public:
+    // the nearest clock at or below the requested one, F_CPU / 2 .. F_CPU / 128
+    SPISettings(uint32_t clock, uint8_t bitOrder, uint8_t dataMode) {
+      hz = F_CPU / 2;
+      while (hz > F_CPU / 128 && hz > clock) {
+        hz >>= 1;
+      }
+    }
+    SPISettings() : SPISettings(4000000, MSBFIRST, SPI_MODE0) {}
+
+  private:
+    uint32_t hz;
+    friend class SPIClass;
+};
+
+class SPIClass {
+  public:
+    static void begin() {}
+    static void end() {}
+    static void beginTransaction(const SPISettings &settings) {
+      cosim_spi_clock(settings.hz);
+    }
+    static void endTransaction() {}
+    static uint8_t transfer(uint8_t data) {
+      return cosim_spi_transfer(data);
+    }
+};
+
+static SPIClass SPI;
+
+#endif
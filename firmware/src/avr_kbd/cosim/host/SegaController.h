@@ -0,0 +1,34 @@
+#ifndef SegaController_h
+#define SegaController_h
+
+// No controller plugged in: getState() reports every button released
+
+#include "Arduino.h"
+
+enum
+{
+    SC_CTL_ON    = 1, // The controller is connected
+    SC_BTN_UP    = 2,
+    SC_BTN_DOWN  = 4,
+    SC_BTN_LEFT  = 8,
+    SC_BTN_RIGHT = 16,
+    SC_BTN_START = 32,
+    SC_BTN_A     = 64,
+    SC_BTN_B     = 128,
+    SC_BTN_C     = 256,
+    SC_BTN_X     = 512,
+    SC_BTN_Y     = 1024,
+    SC_BTN_Z     = 2048,
+    SC_BTN_MODE  = 4096,
+    SC_BTN_1     = 128, // Master System compatibility
+    SC_BTN_2     = 256  // Master System compatibility
+};
+
+class SegaController {
+    public:
+        SegaController(byte db9_pin_7, byte db9_pin_1, byte db9_pin_2, byte db9_pin_3, byte db9_pin_4, byte db9_pin_6, byte db9_pin_9) {}
+
+        word getState() { return 0; }
+};
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef cosim_avr_io_h
+#define cosim_avr_io_h
+
+// Host stand-in for the ATmega8 registers the firmware touches directly:
+// SREG around the matrix updates, the trace pin port and the reset flags.
+
+#include <stdint.h>
+#include "cosim_hal.h"
+
+#define _BV(bit) (1 << (bit))
+
+extern volatile uint8_t SREG;
+extern volatile uint8_t PORTB, DDRB, PINB;
+extern volatile uint8_t PORTC, DDRC, PINC;
+extern volatile uint8_t PORTD, DDRD, PIND;
+extern volatile uint8_t MCUCSR;
+#define MCUCSR MCUCSR // a macro like in avr-libc
+
+// TRACE_PORT of the host build (Makefile): trace.h raises it on entry of the traced
+// function, which then takes its AVR time on the virtual clock
+struct cosim_trace_pin {
+  void operator|=(uint8_t) { cosim_trace(); }
+  void operator&=(uint8_t) {}
+};
+extern cosim_trace_pin cosim_trace_port;
+
+#define PORF 0
+#define EXTRF 1
+#define BORF 2
+#define WDRF 3
+
+#endif
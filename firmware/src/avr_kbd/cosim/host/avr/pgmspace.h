@@ -0,0 +1,11 @@
+#ifndef cosim_avr_pgmspace_h
+#define cosim_avr_pgmspace_h
+
+#include <stdint.h>
+
+#define PROGMEM
+#define pgm_read_byte(addr) (*(const uint8_t *) (addr))
+#define pgm_read_word(addr) (*(const uint16_t *) (addr))
+#define pgm_read_ptr(addr) (*(const void * const *) (addr))
+
+#endif
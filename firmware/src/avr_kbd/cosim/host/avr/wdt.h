@@ -0,0 +1,11 @@
+#ifndef cosim_avr_wdt_h
+#define cosim_avr_wdt_h
+
+// No watchdog in the co-simulation, a hang shows up as a stuck virtual clock.
+
+#define WDTO_2S 7
+
+#define wdt_enable(timeout) ((void) (timeout))
+#define wdt_reset() ((void) 0)
+
+#endif
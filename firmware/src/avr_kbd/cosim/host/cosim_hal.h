@@ -0,0 +1,20 @@
+#ifndef cosim_hal_h
+#define cosim_hal_h
+
+// Calls from the host HAL headers into the co-simulation driver (cosim.cpp).
+// Every call which takes time on the AVR advances the virtual clock, ps/2 bytes
+// of the trace are delivered while it runs.
+
+#include <stdint.h>
+
+void cosim_spi_clock(uint32_t hz);
+uint8_t cosim_spi_transfer(uint8_t data);
+void cosim_pin_write(uint8_t pin, uint8_t value);
+uint8_t cosim_pin_read(uint8_t pin);
+void cosim_delay_us(uint32_t us);
+uint32_t cosim_micros();
+void cosim_pin_mode(uint8_t pin, uint8_t mode);
+void cosim_attach_interrupt(uint8_t interrupt, void (*handler)(void));
+void cosim_trace();
+
+#endif
@@ -9,6 +9,37 @@
 #define JOY_TYPE JOY_SEGA // JOY_SEGA
 #endif
 
+// Keyboard decoding
+#define KBD_DECODE_AVR 0 // scancodes are decoded here and sent as matrix rows
+#define KBD_DECODE_FPGA 1 // raw scancodes are forwarded to cpld_kbd and decoded there
+#define KBD_DECODE_ISR 2 // scancodes are decoded in the ps/2 interrupt, loop() only runs the special key actions
+
+#ifndef KBD_DECODE
+#define KBD_DECODE KBD_DECODE_AVR
+#endif
+
+// PS/2 mouse (Kempston mouse), takes the JOY_FIRE2 / JOY_FIRE3 pins, kempston joystick only
+#ifndef MOUSE_ENABLE
+#define MOUSE_ENABLE 0
+#endif
+
+#if MOUSE_ENABLE && JOY_TYPE != JOY_KEMPSTON
+#error "PS/2 mouse needs the JOY_FIRE2 / JOY_FIRE3 pins, build it with JOY_TYPE=JOY_KEMPSTON"
+#endif
+
+#define MOUSE_SAMPLE_RATE 200 // reports per second
+
+// Text macros (F9 / F10 and the user texts in the EEPROM), about 1K of flash
+#ifndef MACRO_ENABLE
+#define MACRO_ENABLE 0
+#endif
+
+// SPI link calibration and runtime link check through the cpld_kbd loopback,
+// 0 keeps the link at 8 MHz like the first firmware
+#ifndef SPI_CALIBRATE
+#define SPI_CALIBRATE 1
+#endif
+
 // Pins
 #define PIN_BTN_NMI 0
 #define PIN_KBD_DAT 1
@@ -30,15 +61,65 @@
 #define JOY_FIRE2 3
 #define JOY_FIRE3 4
 
+#define PIN_MOUSE_CLK 3 // INT1, instead of JOY_FIRE2
+#define PIN_MOUSE_DAT 4 // instead of JOY_FIRE3
+
 // EEPROM offsets
 #define EEPROM_TURBO_ADDRESS 0x00
 #define EEPROM_ROMBANK_ADDRESS 0x01
+#define EEPROM_AUTOTURBO_ADDRESS 0x02
+#define EEPROM_BOOT_TIMELINE_ADDRESS 0x10 // last boot timeline, 4 x uint32 ms (avrdude -U eeprom:r:eeprom.hex:i)
+#define EEPROM_RESET_COUNT_ADDRESS 0x20 // reset counters: power on, external, brown-out, watchdog (0xFF = 0, stop at 0xFE)
+#define EEPROM_PS2_FLOW_ADDRESS 0x24 // ps/2 clock inhibits and lost bytes of the last boot that stored them, 2 x uint16
+#define EEPROM_MACRO_ADDRESS 0x40 // user text macros, 2 x MACRO_TEXT_SIZE (avrdude -U eeprom:w:macros.hex:i)
 
 // EEPROM values
 #define EEPROM_VALUE_TRUE 10
 #define EEPROM_VALUE_FALSE 20
 
+// Special key actions, run by loop() (queued by the ps/2 interrupt with KBD_DECODE_ISR)
+#define ACTION_NONE 0x00
+#define ACTION_TURBO 0x01
+#define ACTION_WAIT 0x02
+#define ACTION_RESET 0x03
+#define ACTION_MAGICK 0x04
+#define ACTION_REINIT 0x05
+#define ACTION_AUTOTURBO 0x06
+#define ACTION_TYPE 0x20 // + text macro: bit 0 = text, bit 1 = user text in the eeprom
+#define ACTION_ROMBANK 0x40 // + bank
+#define ACTION_MACRO 0x80 // + matrix position
+
 #define CMD_INIT 0xF0
 #define CMD_NONE 0xFF
 
+// CMD_INIT answer status bits
+#define FPGA_STATUS_BUSY 0x01 // host is not ready yet (rom loader is running)
+#define FPGA_STATUS_RESET_ACK 0x02 // reset has been seen long enough, can be released
+
+// Boot handshake, ms
+#define BOOT_LINK_TIMEOUT 3000 // waiting for the fpga answer
+#define BOOT_READY_TIMEOUT 5000 // waiting for the rom loader
+#define BOOT_POLL_MAX_DELAY 8 // max poll backoff
+#define RESET_PULSE_MAX 500 // reset pulse length if the fpga does not acknowledge it
+#define BOOT_KEY_HOLD 200 // space is held after the init reset
+
+// Watchdog, a hung controller restarts and picks up its live state without the init reset.
+// The longest blocking action (Ctrl+Alt+Bksp) takes 1 s, fpga_wait() and type_key() feed it
+#define WDT_TIMEOUT WDTO_2S
+
+// SPI link calibration
+#define SPI_CALIBRATION_PASSES 8 // full pattern sets a speed has to pass at boot
+#define SPI_MARGIN_PASSES 32 // and back to back pattern sets on top, the margin of the speed it keeps
+#define SPI_CHECK_INTERVAL 1000 // ms between runtime link checks
+#define SPI_PROMOTE_CHECKS 60 // clean runtime checks before a fallen back link tries the next faster speed
+#define KBD_REFRESH_INTERVAL 100 // ms between full matrix transmits, only changed bytes are sent in between
+#define PS2_FLOW_STORE_INTERVAL 600000UL // ms between EEPROM stores of changed ps/2 flow counters (10 min)
+
+// Text macros, the 48K rom takes a new key on a keyboard scan (one per frame)
+// into one of its 2 key sets, a set is free again 5 scans after its key was released
+#define MACRO_TEXT_SIZE 32 // max text length
+#define MACRO_FRAME_MS 21 // longest frame, pentagon 20.48 ms
+#define MACRO_HOLD_MS (MACRO_FRAME_MS + 3) // a key is held for one scan
+#define MACRO_FREE_MS (5 * MACRO_FRAME_MS) // a key set is free again
+
 #endif
\ No newline at end of file
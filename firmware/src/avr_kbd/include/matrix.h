@@ -103,7 +103,11 @@
 #define ZX_JOY_Y 58     // Y on SEGA
 #define ZX_JOY_Z 59     // Z on SEGA
 #define ZX_JOY_MODE 60  // MODE on SEGA
-// free pins = 61,62,63
+
+// TR-DOS / divMMC code runs at full speed
+#define ZX_K_AUTOTURBO 61
+
+// free pins = 62,63
 
 // kbd commands
 #define CMD_KBD_BYTE1 0x01
@@ -114,5 +118,12 @@
 #define CMD_KBD_BYTE6 0x06
 #define CMD_KBD_BYTE7 0x07
 #define CMD_KBD_BYTE8 0x08
+#define CMD_KBD_SCANCODE 0x09 // raw PS/2 scancode, decoded by cpld_kbd
+#define CMD_LOOPBACK 0x0A // data byte is echoed back by cpld_kbd in the next transfer
+#define CMD_KBD_COMMIT 0x0B // apply received matrix bytes at once (CMD_KBD_BYTE8 commits as well)
+#define CMD_MOUSE_X 0x0C // signed X motion, accumulated by cpld_kbd
+#define CMD_MOUSE_Y 0x0D // signed Y motion, up is positive
+#define CMD_MOUSE_BUTTONS 0x0E // PS2_MOUSE_LEFT | PS2_MOUSE_RIGHT | PS2_MOUSE_MIDDLE
+#define CMD_JOY 0x0F // joystick, applied without a commit: bits 0..7 right, left, down, up, fire, fire2, fire3, fire4, 0 = pressed
 
 #endif
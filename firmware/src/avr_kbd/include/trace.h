@@ -0,0 +1,51 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+// Trace points for the hot paths.
+// A trace pin goes high on function entry and low on exit, so the function run time
+// can be measured on a scope, a logic analyzer or in a simavr VCD capture
+// (see tools/trace_report.py for the timing report).
+//
+// Trace points are selected by TRACE_MASK at compile time, one bit per trace id:
+// PLATFORMIO_BUILD_FLAGS="-DTRACE_MASK=0x02" pio run
+// Disabled trace points compile to nothing, enabled ones are a single sbi/cbi.
+// Nested trace points share the pin, so enable one id at a time unless
+// TRACE_PORT / TRACE_DDR / TRACE_BIT are redefined per build.
+
+#include <avr/io.h>
+
+// Trace ids
+#define TRACE_PS2_ISR 0 // ps2interrupt()
+#define TRACE_FILL_MATRIX 1 // fill_kbd_matrix()
+#define TRACE_TRANSMIT_MATRIX 2 // transmit_keyboard_matrix() / transmit_system_matrix()
+#define TRACE_SEGA_READ 3 // SegaController::readCycle()
+
+#ifndef TRACE_MASK
+#define TRACE_MASK 0x00
+#endif
+
+// Trace pin, LED_PAUSE (A4 / PC4) by default, the led is not driven while tracing
+#ifndef TRACE_BIT
+#define TRACE_PORT PORTC
+#define TRACE_DDR DDRC
+#define TRACE_BIT 4
+#if TRACE_MASK
+#define TRACE_USES_LED_PAUSE
+#endif
+#endif
+
+#define TRACE_ENABLED(id) (((TRACE_MASK) >> (id)) & 1)
+
+#define TRACE_INIT() do { if (TRACE_MASK) { TRACE_DDR |= _BV(TRACE_BIT); TRACE_PORT &= ~_BV(TRACE_BIT); } } while (0)
+#define TRACE_BEGIN(id) do { if (TRACE_ENABLED(id)) { TRACE_PORT |= _BV(TRACE_BIT); } } while (0)
+#define TRACE_END(id) do { if (TRACE_ENABLED(id)) { TRACE_PORT &= ~_BV(TRACE_BIT); } } while (0)
+
+// trace the rest of the enclosing scope, covers early returns as well
+template <uint8_t id> struct TraceScope {
+  TraceScope() { TRACE_BEGIN(id); }
+  ~TraceScope() { TRACE_END(id); }
+};
+
+#define TRACE_SCOPE(id) TraceScope<id> trace_scope_
+
+#endif
@@ -0,0 +1,231 @@
+#ifndef typing_h
+#define typing_h
+
+// Text macros typed on the ZX keyboard by the AVR (see type_text() in main.cpp).
+//
+// A text is a string in the ZX Spectrum charset: printable ASCII as is, 0x0D (\r) is ENTER,
+// 0xA5..0xFF are the 48K BASIC keywords (0xEF LOAD, 0xF9 RANDOMIZE, 0xC0 USR, ...),
+// which are entered the way a person does it, with one key in K or E mode.
+// The engine follows the cursor mode of the 48K editor. A text with a key which needs
+// the other mode (a K mode keyword in L mode, a letter in K mode, e.g. "10 PRINT 1"
+// spelled out instead of "10 \xF5 1") is rejected before anything is typed.
+// A text is up to MACRO_TEXT_SIZE bytes, 0x00 terminated, an EEPROM text starting
+// with 0xFF is not programmed.
+
+#define ZX_TOKEN_FIRST 0xA5 // RND
+#define ZX_TOKEN_THEN 0xCB // K mode follows
+
+// Table entry: key position + how it is typed
+#define TYPE_KEY(k) (k) // the key alone, a K mode keyword, a digit or a letter (+CS for a capital one)
+#define TYPE_E(k) (0x40 | (k)) // E mode (CS+SS), then the key
+#define TYPE_E_SS(k) (0x80 | (k)) // E mode, then SS+key
+#define TYPE_SS(k) (0xC0 | (k)) // SS+key
+#define TYPE_MODE(e) ((e) & 0xC0)
+#define TYPE_POS(e) ((e) & 0x3F)
+#define TYPE_NO_SHIFT 0xFF
+
+// 48K BASIC keywords, ZX_TOKEN_FIRST..0xFF
+const uint8_t type_tokens[] PROGMEM = {
+  TYPE_E(ZX_K_T), // A5 RND
+  TYPE_E(ZX_K_N), // A6 INKEY$
+  TYPE_E(ZX_K_M), // A7 PI
+  TYPE_E_SS(ZX_K_2), // A8 FN
+  TYPE_E_SS(ZX_K_8), // A9 POINT
+  TYPE_E_SS(ZX_K_K), // AA SCREEN$
+  TYPE_E_SS(ZX_K_L), // AB ATTR
+  TYPE_SS(ZX_K_I), // AC AT
+  TYPE_E(ZX_K_P), // AD TAB
+  TYPE_E_SS(ZX_K_J), // AE VAL$
+  TYPE_E(ZX_K_I), // AF CODE
+  TYPE_E(ZX_K_J), // B0 VAL
+  TYPE_E(ZX_K_K), // B1 LEN
+  TYPE_E(ZX_K_Q), // B2 SIN
+  TYPE_E(ZX_K_W), // B3 COS
+  TYPE_E(ZX_K_E), // B4 TAN
+  TYPE_E_SS(ZX_K_Q), // B5 ASN
+  TYPE_E_SS(ZX_K_W), // B6 ACS
+  TYPE_E_SS(ZX_K_E), // B7 ATN
+  TYPE_E(ZX_K_Z), // B8 LN
+  TYPE_E(ZX_K_X), // B9 EXP
+  TYPE_E(ZX_K_R), // BA INT
+  TYPE_E(ZX_K_H), // BB SQR
+  TYPE_E(ZX_K_F), // BC SGN
+  TYPE_E(ZX_K_G), // BD ABS
+  TYPE_E(ZX_K_O), // BE PEEK
+  TYPE_E_SS(ZX_K_I), // BF IN
+  TYPE_E(ZX_K_L), // C0 USR
+  TYPE_E(ZX_K_Y), // C1 STR$
+  TYPE_E(ZX_K_U), // C2 CHR$
+  TYPE_SS(ZX_K_S), // C3 NOT
+  TYPE_E(ZX_K_B), // C4 BIN
+  TYPE_SS(ZX_K_U), // C5 OR
+  TYPE_SS(ZX_K_Y), // C6 AND
+  TYPE_SS(ZX_K_Q), // C7 <=
+  TYPE_SS(ZX_K_E), // C8 >=
+  TYPE_SS(ZX_K_W), // C9 <>
+  TYPE_E_SS(ZX_K_3), // CA LINE
+  TYPE_SS(ZX_K_G), // CB THEN
+  TYPE_SS(ZX_K_F), // CC TO
+  TYPE_SS(ZX_K_D), // CD STEP
+  TYPE_E_SS(ZX_K_1), // CE DEF FN
+  TYPE_E_SS(ZX_K_9), // CF CAT
+  TYPE_E_SS(ZX_K_0), // D0 FORMAT
+  TYPE_E_SS(ZX_K_6), // D1 MOVE
+  TYPE_E_SS(ZX_K_7), // D2 ERASE
+  TYPE_E_SS(ZX_K_4), // D3 OPEN #
+  TYPE_E_SS(ZX_K_5), // D4 CLOSE #
+  TYPE_E_SS(ZX_K_T), // D5 MERGE
+  TYPE_E_SS(ZX_K_R), // D6 VERIFY
+  TYPE_E_SS(ZX_K_Z), // D7 BEEP
+  TYPE_E_SS(ZX_K_H), // D8 CIRCLE
+  TYPE_E_SS(ZX_K_X), // D9 INK
+  TYPE_E_SS(ZX_K_C), // DA PAPER
+  TYPE_E_SS(ZX_K_V), // DB FLASH
+  TYPE_E_SS(ZX_K_B), // DC BRIGHT
+  TYPE_E_SS(ZX_K_M), // DD INVERSE
+  TYPE_E_SS(ZX_K_N), // DE OVER
+  TYPE_E_SS(ZX_K_O), // DF OUT
+  TYPE_E(ZX_K_C), // E0 LPRINT
+  TYPE_E(ZX_K_V), // E1 LLIST
+  TYPE_SS(ZX_K_A), // E2 STOP
+  TYPE_E(ZX_K_A), // E3 READ
+  TYPE_E(ZX_K_D), // E4 DATA
+  TYPE_E(ZX_K_S), // E5 RESTORE
+  TYPE_KEY(ZX_K_A), // E6 NEW
+  TYPE_KEY(ZX_K_B), // E7 BORDER
+  TYPE_KEY(ZX_K_C), // E8 CONTINUE
+  TYPE_KEY(ZX_K_D), // E9 DIM
+  TYPE_KEY(ZX_K_E), // EA REM
+  TYPE_KEY(ZX_K_F), // EB FOR
+  TYPE_KEY(ZX_K_G), // EC GO TO
+  TYPE_KEY(ZX_K_H), // ED GO SUB
+  TYPE_KEY(ZX_K_I), // EE INPUT
+  TYPE_KEY(ZX_K_J), // EF LOAD
+  TYPE_KEY(ZX_K_K), // F0 LIST
+  TYPE_KEY(ZX_K_L), // F1 LET
+  TYPE_KEY(ZX_K_M), // F2 PAUSE
+  TYPE_KEY(ZX_K_N), // F3 NEXT
+  TYPE_KEY(ZX_K_O), // F4 POKE
+  TYPE_KEY(ZX_K_P), // F5 PRINT
+  TYPE_KEY(ZX_K_Q), // F6 PLOT
+  TYPE_KEY(ZX_K_R), // F7 RUN
+  TYPE_KEY(ZX_K_S), // F8 SAVE
+  TYPE_KEY(ZX_K_T), // F9 RANDOMIZE
+  TYPE_KEY(ZX_K_U), // FA IF
+  TYPE_KEY(ZX_K_V), // FB CLS
+  TYPE_KEY(ZX_K_W), // FC DRAW
+  TYPE_KEY(ZX_K_X), // FD CLEAR
+  TYPE_KEY(ZX_K_Y), // FE RETURN
+  TYPE_KEY(ZX_K_Z), // FF COPY
+};
+
+// printable characters, 0x20..0x7F
+const uint8_t type_chars[] PROGMEM = {
+  TYPE_KEY(ZX_K_SP), // 20 space
+  TYPE_SS(ZX_K_1), // 21 !
+  TYPE_SS(ZX_K_P), // 22 "
+  TYPE_SS(ZX_K_3), // 23 #
+  TYPE_SS(ZX_K_4), // 24 $
+  TYPE_SS(ZX_K_5), // 25 %
+  TYPE_SS(ZX_K_6), // 26 &
+  TYPE_SS(ZX_K_7), // 27 '
+  TYPE_SS(ZX_K_8), // 28 (
+  TYPE_SS(ZX_K_9), // 29 )
+  TYPE_SS(ZX_K_B), // 2A *
+  TYPE_SS(ZX_K_K), // 2B +
+  TYPE_SS(ZX_K_N), // 2C ,
+  TYPE_SS(ZX_K_J), // 2D -
+  TYPE_SS(ZX_K_M), // 2E .
+  TYPE_SS(ZX_K_V), // 2F /
+  TYPE_KEY(ZX_K_0), // 30 0
+  TYPE_KEY(ZX_K_1), // 31 1
+  TYPE_KEY(ZX_K_2), // 32 2
+  TYPE_KEY(ZX_K_3), // 33 3
+  TYPE_KEY(ZX_K_4), // 34 4
+  TYPE_KEY(ZX_K_5), // 35 5
+  TYPE_KEY(ZX_K_6), // 36 6
+  TYPE_KEY(ZX_K_7), // 37 7
+  TYPE_KEY(ZX_K_8), // 38 8
+  TYPE_KEY(ZX_K_9), // 39 9
+  TYPE_SS(ZX_K_Z), // 3A :
+  TYPE_SS(ZX_K_O), // 3B ;
+  TYPE_SS(ZX_K_R), // 3C <
+  TYPE_SS(ZX_K_L), // 3D =
+  TYPE_SS(ZX_K_T), // 3E >
+  TYPE_SS(ZX_K_C), // 3F ?
+  TYPE_SS(ZX_K_2), // 40 @
+  TYPE_KEY(ZX_K_A), // 41 A
+  TYPE_KEY(ZX_K_B), // 42 B
+  TYPE_KEY(ZX_K_C), // 43 C
+  TYPE_KEY(ZX_K_D), // 44 D
+  TYPE_KEY(ZX_K_E), // 45 E
+  TYPE_KEY(ZX_K_F), // 46 F
+  TYPE_KEY(ZX_K_G), // 47 G
+  TYPE_KEY(ZX_K_H), // 48 H
+  TYPE_KEY(ZX_K_I), // 49 I
+  TYPE_KEY(ZX_K_J), // 4A J
+  TYPE_KEY(ZX_K_K), // 4B K
+  TYPE_KEY(ZX_K_L), // 4C L
+  TYPE_KEY(ZX_K_M), // 4D M
+  TYPE_KEY(ZX_K_N), // 4E N
+  TYPE_KEY(ZX_K_O), // 4F O
+  TYPE_KEY(ZX_K_P), // 50 P
+  TYPE_KEY(ZX_K_Q), // 51 Q
+  TYPE_KEY(ZX_K_R), // 52 R
+  TYPE_KEY(ZX_K_S), // 53 S
+  TYPE_KEY(ZX_K_T), // 54 T
+  TYPE_KEY(ZX_K_U), // 55 U
+  TYPE_KEY(ZX_K_V), // 56 V
+  TYPE_KEY(ZX_K_W), // 57 W
+  TYPE_KEY(ZX_K_X), // 58 X
+  TYPE_KEY(ZX_K_Y), // 59 Y
+  TYPE_KEY(ZX_K_Z), // 5A Z
+  TYPE_E_SS(ZX_K_Y), // 5B [
+  TYPE_E_SS(ZX_K_D), // 5C backslash
+  TYPE_E_SS(ZX_K_U), // 5D ]
+  TYPE_SS(ZX_K_H), // 5E ^
+  TYPE_SS(ZX_K_0), // 5F _
+  TYPE_SS(ZX_K_X), // 60 pound sign
+  TYPE_KEY(ZX_K_A), // 61 a
+  TYPE_KEY(ZX_K_B), // 62 b
+  TYPE_KEY(ZX_K_C), // 63 c
+  TYPE_KEY(ZX_K_D), // 64 d
+  TYPE_KEY(ZX_K_E), // 65 e
+  TYPE_KEY(ZX_K_F), // 66 f
+  TYPE_KEY(ZX_K_G), // 67 g
+  TYPE_KEY(ZX_K_H), // 68 h
+  TYPE_KEY(ZX_K_I), // 69 i
+  TYPE_KEY(ZX_K_J), // 6A j
+  TYPE_KEY(ZX_K_K), // 6B k
+  TYPE_KEY(ZX_K_L), // 6C l
+  TYPE_KEY(ZX_K_M), // 6D m
+  TYPE_KEY(ZX_K_N), // 6E n
+  TYPE_KEY(ZX_K_O), // 6F o
+  TYPE_KEY(ZX_K_P), // 70 p
+  TYPE_KEY(ZX_K_Q), // 71 q
+  TYPE_KEY(ZX_K_R), // 72 r
+  TYPE_KEY(ZX_K_S), // 73 s
+  TYPE_KEY(ZX_K_T), // 74 t
+  TYPE_KEY(ZX_K_U), // 75 u
+  TYPE_KEY(ZX_K_V), // 76 v
+  TYPE_KEY(ZX_K_W), // 77 w
+  TYPE_KEY(ZX_K_X), // 78 x
+  TYPE_KEY(ZX_K_Y), // 79 y
+  TYPE_KEY(ZX_K_Z), // 7A z
+  TYPE_E_SS(ZX_K_F), // 7B {
+  TYPE_E_SS(ZX_K_S), // 7C |
+  TYPE_E_SS(ZX_K_G), // 7D }
+  TYPE_E_SS(ZX_K_A), // 7E ~
+  TYPE_E_SS(ZX_K_P), // 7F copyright sign
+};
+
+// built-in texts, F9 and F10
+const char type_text_load[] PROGMEM = "\xEF" "\"\"\r"; // LOAD ""
+const char type_text_trdos[] PROGMEM = "\xF9" "\xC0" "15616\r"; // RANDOMIZE USR 15616, TR-DOS
+
+const char * const type_texts[] PROGMEM = {
+  type_text_load,
+  type_text_trdos
+};
+
+#endif
@@ -0,0 +1,152 @@
+#ifndef BareHAL_Arduino_h
+#define BareHAL_Arduino_h
+
+// Register level stand-in for the Arduino core (env:ATmega8_bare).
+// Only the calls used by the firmware and its libraries are here.
+//
+// Pin numbers follow the Arduino ATmega8 mapping: 0..7 PORTD, 8..13 PORTB, 14..19 (A0..A5) PORTC.
+// With a constant pin number pinMode / digitalWrite / digitalRead compile to a single sbi / cbi / sbic,
+// a pin number known only at run time takes the read-modify-write with interrupts off.
+//
+// There is no Timer0 overflow interrupt: millis() is read from the free running Timer1
+// (16 us ticks, one overflow interrupt per 1.05 s), so ps2interrupt() is not delayed by a 1 ms tick.
+// The overflow adds 1048 ms and carries the 72/125 ms remainder, so millis() does not drift.
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <util/delay.h>
+
+typedef uint8_t byte;
+typedef uint16_t word;
+typedef bool boolean;
+
+#define HIGH 0x1
+#define LOW 0x0
+
+#define INPUT 0x0
+#define OUTPUT 0x1
+#define INPUT_PULLUP 0x2
+
+#define CHANGE 1
+#define FALLING 2
+#define RISING 3
+
+#define A0 14
+#define A1 15
+#define A2 16
+#define A3 17
+#define A4 18
+#define A5 19
+
+#define bitRead(value, bit) (((value) >> (bit)) & 0x01)
+#define bitSet(value, bit) ((value) |= (1UL << (bit)))
+#define bitClear(value, bit) ((value) &= ~(1UL << (bit)))
+#define bitWrite(value, bit, bitvalue) ((bitvalue) ? bitSet(value, bit) : bitClear(value, bit))
+
+#ifndef max
+#define max(a, b) ((a) > (b) ? (a) : (b))
+#endif
+#ifndef min
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#endif
+#define constrain(x, low, high) ((x) < (low) ? (low) : ((x) > (high) ? (high) : (x)))
+
+#define interrupts() sei()
+#define noInterrupts() cli()
+
+#define digitalPinToInterrupt(p) ((p) == 2 ? 0 : ((p) == 3 ? 1 : -1))
+
+// PINx, DDRx and PORTx are consecutive registers
+static inline volatile uint8_t *hal_port(uint8_t pin)
+{
+  return pin < 8 ? &PORTD : (pin < 14 ? &PORTB : &PORTC);
+}
+
+static inline uint8_t hal_mask(uint8_t pin)
+{
+  return _BV(pin < 8 ? pin : (pin < 14 ? pin - 8 : pin - 14));
+}
+
+static inline void hal_pin_mode(uint8_t pin, uint8_t mode)
+{
+  volatile uint8_t *port = hal_port(pin);
+  uint8_t mask = hal_mask(pin);
+  if (mode == OUTPUT) {
+    *(port - 1) |= mask;
+  } else {
+    *(port - 1) &= ~mask;
+    if (mode == INPUT_PULLUP) {
+      *port |= mask;
+    } else {
+      *port &= ~mask;
+    }
+  }
+}
+
+static inline void hal_write(uint8_t pin, uint8_t value)
+{
+  if (value) {
+    *hal_port(pin) |= hal_mask(pin);
+  } else {
+    *hal_port(pin) &= ~hal_mask(pin);
+  }
+}
+
+// an ISR changing another pin of the same port must not be undone by the write back
+static inline void pinMode(uint8_t pin, uint8_t mode)
+{
+  if (__builtin_constant_p(pin)) {
+    hal_pin_mode(pin, mode);
+  } else {
+    uint8_t sreg = SREG;
+    cli();
+    hal_pin_mode(pin, mode);
+    SREG = sreg;
+  }
+}
+
+static inline void digitalWrite(uint8_t pin, uint8_t value)
+{
+  if (__builtin_constant_p(pin)) {
+    hal_write(pin, value);
+  } else {
+    uint8_t sreg = SREG;
+    cli();
+    hal_write(pin, value);
+    SREG = sreg;
+  }
+}
+
+static inline uint8_t digitalRead(uint8_t pin)
+{
+  return (*(hal_port(pin) - 2) & hal_mask(pin)) ? HIGH : LOW;
+}
+
+static inline void delay(unsigned long ms)
+{
+  while (ms--) {
+    _delay_ms(1);
+  }
+}
+
+static inline void delayMicroseconds(unsigned int us)
+{
+  while (us--) {
+    _delay_us(1);
+  }
+}
+
+unsigned long millis();
+unsigned long micros();
+
+// INT0 (pin 2) or INT1 (pin 3)
+void attachInterrupt(uint8_t interrupt, void (*handler)(void), uint8_t mode);
+void detachInterrupt(uint8_t interrupt);
+
+void setup();
+void loop();
+
+#endif
@@ -0,0 +1,114 @@
+#include "Arduino.h"
+#include "SPI.h"
+
+SPIClass SPI;
+
+#if F_CPU != 16000000L
+#error "BareHAL timing is set up for 16 MHz"
+#endif
+
+// one overflow is 65536 ticks of 16 us = 1048.576 ms
+#define MILLIS_INC 1048
+#define FRACT_INC 72
+#define FRACT_MAX 125
+
+static volatile uint32_t timer1_overflows = 0;
+static volatile uint32_t timer1_millis = 0;
+static volatile uint8_t timer1_fract = 0;
+static void (*int_handlers[2])(void) = {0, 0};
+
+ISR(TIMER1_OVF_vect)
+{
+  uint32_t ms = timer1_millis + MILLIS_INC;
+  uint8_t fract = timer1_fract + FRACT_INC;
+  if (fract >= FRACT_MAX) {
+    fract -= FRACT_MAX;
+    ms++;
+  }
+  timer1_millis = ms;
+  timer1_fract = fract;
+  timer1_overflows++;
+}
+
+ISR(INT0_vect)
+{
+  int_handlers[0]();
+}
+
+ISR(INT1_vect)
+{
+  int_handlers[1]();
+}
+
+// Timer1 overflows and count (16 us ticks), an overflow pending during the read is counted
+static void ticks(uint32_t *hi, uint16_t *lo)
+{
+  uint8_t sreg = SREG;
+  cli();
+  *hi = timer1_overflows;
+  *lo = TCNT1;
+  if ((TIFR & _BV(TOV1)) && *lo < 0x8000) {
+    (*hi)++;
+  }
+  SREG = sreg;
+}
+
+unsigned long millis()
+{
+  uint8_t sreg = SREG;
+  cli();
+  uint32_t ms = timer1_millis;
+  uint8_t fract = timer1_fract;
+  uint16_t lo = TCNT1;
+  if ((TIFR & _BV(TOV1)) && lo < 0x8000) {
+    ms += MILLIS_INC;
+    fract += FRACT_INC;
+    if (fract >= FRACT_MAX) {
+      fract -= FRACT_MAX;
+      ms++;
+    }
+  }
+  SREG = sreg;
+  // 62.5 ticks per ms, 16 bit divisions only
+  return ms + 2 * (lo / 125) + (2 * (lo % 125) + fract) / FRACT_MAX;
+}
+
+unsigned long micros()
+{
+  uint32_t hi;
+  uint16_t lo;
+  ticks(&hi, &lo);
+  return (hi << 20) | ((uint32_t) lo << 4);
+}
+
+void attachInterrupt(uint8_t interrupt, void (*handler)(void), uint8_t mode)
+{
+  // ISCx1:ISCx0 - 01 any change, 10 falling, 11 rising
+  uint8_t shift = interrupt ? ISC10 : ISC00;
+  uint8_t sreg = SREG;
+  cli();
+  int_handlers[interrupt & 1] = handler;
+  MCUCR = (MCUCR & ~(0x03 << shift)) | (mode << shift);
+  GIFR = _BV(interrupt ? INTF1 : INTF0);
+  GICR |= _BV(interrupt ? INT1 : INT0);
+  SREG = sreg;
+}
+
+void detachInterrupt(uint8_t interrupt)
+{
+  GICR &= ~_BV(interrupt ? INT1 : INT0);
+}
+
+int main()
+{
+  // Timer1 free running at F_CPU / 256
+  TCCR1A = 0;
+  TCCR1B = _BV(CS12);
+  TIMSK |= _BV(TOIE1);
+  sei();
+
+  setup();
+  for (;;) {
+    loop();
+  }
+}
@@ -0,0 +1,32 @@
+#ifndef BareHAL_EEPROM_h
+#define BareHAL_EEPROM_h
+
+// avr-libc eeprom calls behind the Arduino EEPROM library interface
+
+#include <avr/eeprom.h>
+#include "Arduino.h"
+
+class EEPROMClass {
+  public:
+    uint8_t read(int addr) {
+      return eeprom_read_byte((const uint8_t *) (uintptr_t) addr);
+    }
+    void write(int addr, uint8_t value) {
+      eeprom_write_byte((uint8_t *) (uintptr_t) addr, value);
+    }
+    void update(int addr, uint8_t value) {
+      eeprom_update_byte((uint8_t *) (uintptr_t) addr, value);
+    }
+    template <typename T> T &get(int addr, T &value) {
+      eeprom_read_block(&value, (const void *) (uintptr_t) addr, sizeof(T));
+      return value;
+    }
+    template <typename T> const T &put(int addr, const T &value) {
+      eeprom_update_block(&value, (void *) (uintptr_t) addr, sizeof(T));
+      return value;
+    }
+};
+
+static EEPROMClass EEPROM;
+
+#endif
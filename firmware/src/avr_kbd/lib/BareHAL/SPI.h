@@ -0,0 +1,62 @@
+#ifndef BareHAL_SPI_h
+#define BareHAL_SPI_h
+
+// Master mode SPI on the hardware port, same interface as the Arduino SPI library
+
+#include "Arduino.h"
+
+#define LSBFIRST 0
+#define MSBFIRST 1
+
+#define SPI_MODE0 0x00
+#define SPI_MODE1 0x04
+#define SPI_MODE2 0x08
+#define SPI_MODE3 0x0C
+
+class SPISettings {
+  public:
+    // the nearest clock at or below the requested one, F_CPU / 2 .. F_CPU / 128
+    SPISettings(uint32_t clock, uint8_t bitOrder, uint8_t dataMode) {
+      uint8_t div = 0; // divider 2 << div
+      while (div < 6 && (F_CPU >> (div + 1)) > clock) {
+        div++;
+      }
+      // even div values use SPI2X, F_CPU / 128 is SPR 11 without it
+      uint8_t spr = (div == 6) ? 3 : (div >> 1);
+      spcr = _BV(SPE) | _BV(MSTR) | (bitOrder == LSBFIRST ? _BV(DORD) : 0) | (dataMode & (_BV(CPOL) | _BV(CPHA))) | (spr & 0x03);
+      spsr = ((div & 1) || div == 6) ? 0 : _BV(SPI2X);
+    }
+    SPISettings() : SPISettings(4000000, MSBFIRST, SPI_MODE0) {}
+
+  private:
+    uint8_t spcr;
+    uint8_t spsr;
+    friend class SPIClass;
+};
+
+class SPIClass {
+  public:
+    // SS (pin 10) must stay an output, or another master could take the bus
+    static void begin() {
+      PORTB |= _BV(PB2);
+      DDRB |= _BV(PB2) | _BV(PB3) | _BV(PB5);
+      SPCR |= _BV(MSTR) | _BV(SPE);
+    }
+    static void end() {
+      SPCR &= ~_BV(SPE);
+    }
+    static void beginTransaction(const SPISettings &settings) {
+      SPCR = settings.spcr;
+      SPSR = settings.spsr;
+    }
+    static void endTransaction() {}
+    static uint8_t transfer(uint8_t data) {
+      SPDR = data;
+      while (!(SPSR & _BV(SPIF)));
+      return SPDR;
+    }
+};
+
+extern SPIClass SPI;
+
+#endif
@@ -44,33 +44,73 @@
 */
 
 #include "PS2KeyRaw.h"
+#include "trace.h"
 
 /* Private variable definition */
 #define BUFFER_SIZE 16
+#define HIGH_WATER 12     // clock line is held low from this many buffered bytes on
+#define LOW_WATER 4       // and released again when read() drained it to this
 volatile uint8_t buffer[ BUFFER_SIZE ];
 volatile uint8_t head, tail;
 uint8_t PS2_DataPin;
+uint8_t PS2_IrqPin;
+volatile bool inhibited = false;
+volatile bool inhibit_pending = false;  // nearly full, the clock line is pulled low once it is back high
+volatile uint16_t inhibit_count = 0;    // times the clock line was held low
+volatile uint16_t overrun_count = 0;    // bytes lost with a full buffer anyway
+uint8_t (*PS2_Decoder)( uint8_t ) = 0;
+volatile bool held = false;             // bytes after a decoder result are buffered raw until resume()
+
+static uint8_t bitcount = 0;      // Main state variable and bit count
 
 /* Private function declarations */
 uint8_t get_scan_code( );
 
+
+// Holds the clock line low while the buffer is still nearly full, the keyboard
+// keeps its bytes until get_scan_code() drained it. Called with the interrupts
+// off and never between the 11th clock of a byte and the clock going high
+// again: a keyboard which sees that inhibit may send the byte once more (a
+// break code without its key would stick). Before the 11th clock it aborts the
+// byte and sends it again after the release, the bits so far are discarded.
+static void hold_clock( void )
+{
+inhibit_pending = false;
+if( ( ( head - tail ) & ( BUFFER_SIZE - 1 ) ) < HIGH_WATER )
+  return;
+inhibited = true;
+inhibit_count++;
+bitcount = 0;
+digitalWrite( PS2_IrqPin, LOW );    // pull-up off first, the line is open collector
+pinMode( PS2_IrqPin, OUTPUT );
+}
+
 // The ISR for the external interrupt
 // To receive 11 bits start, 8 data, ODD parity, stop
 // Interrupt every falling incoming clock edge from keyboard
 void ps2interrupt( void )
 {
-	static uint8_t bitcount = 0;      // Main state variable and bit count
+	TRACE_SCOPE( TRACE_PS2_ISR );
 	static uint8_t incoming;
     static uint8_t parity;
 	static uint32_t prev_ms = 0;
 	uint32_t now_ms;
 	uint8_t val;
+	bool decoded;
 
+	if( inhibited )     // falling edge of our own clock inhibit
+	  return;
 	val = digitalRead( PS2_DataPin );
 	now_ms = millis();
 	if( now_ms - prev_ms > 250 )
 	  bitcount = 0;
 	prev_ms = now_ms;
+	if( inhibit_pending && bitcount == 0 )   // available() did not get to it, abort this byte
+	  {
+	  hold_clock();
+	  if( inhibited )
+	    return;
+	  }
     bitcount++;         // Now point to next bit
     switch( bitcount )
        {
@@ -102,6 +142,17 @@ void ps2interrupt( void )
                   }
                 else                  // Good so save byte in buffer
                   {
+                  decoded = false;
+                  if( PS2_Decoder && !held )   // decoded right here, only the result is buffered
+                    {
+                    incoming = PS2_Decoder( incoming );
+                    if( !incoming )
+                      {
+                      bitcount = 0;
+                      break;
+                      }
+                    decoded = true;
+                    }
                   val = head + 1;
                   if( val >= BUFFER_SIZE )
                     val = 0;
@@ -109,7 +160,13 @@ void ps2interrupt( void )
                     {
                     buffer[ val ] = incoming;
                     head = val;
+                    if( decoded )
+                      held = true;    // the result is handled in loop(), the bytes after it must wait for it
+                    if( ( ( val - tail ) & ( BUFFER_SIZE - 1 ) ) >= HIGH_WATER )
+                      inhibit_pending = true;    // not now, the clock is still low after the stop bit
                     }
+                  else
+                    overrun_count++;
                   }
                 bitcount = 0;
                 break;
@@ -130,6 +187,11 @@ uint8_t get_scan_code(void)
 	if( i >= BUFFER_SIZE )
       i = 0;
 	tail = i;
+	if( inhibited && ( ( head - i ) & ( BUFFER_SIZE - 1 ) ) <= LOW_WATER )
+	  {
+	  inhibited = false;  // before the release, its rising edge is no interrupt anyway
+	  pinMode( PS2_IrqPin, INPUT_PULLUP );
+	  }
 	return buffer[ i ];
 }
 
@@ -138,6 +200,14 @@ int8_t PS2KeyRaw::available()
 {
 int8_t  i;
 
+if( inhibit_pending )
+  {
+  noInterrupts();
+  // clock high between two bytes, a pending falling edge is a start bit at most
+  if( inhibit_pending && bitcount == 0 && digitalRead( PS2_IrqPin ) == HIGH )
+    hold_clock();
+  interrupts();
+  }
 i = head - tail;
 if( i < 0 )
   i += BUFFER_SIZE;
@@ -158,14 +228,61 @@ return result;
 }
 
 
+bool PS2KeyRaw::resume()
+{
+bool result;
+
+noInterrupts();
+result = ( head == tail );
+if( result )
+  held = false;
+interrupts();
+return result;
+}
+
+
+uint16_t PS2KeyRaw::inhibits()
+{
+uint16_t result;
+
+noInterrupts();
+result = inhibit_count;
+interrupts();
+return result;
+}
+
+
+uint16_t PS2KeyRaw::overruns()
+{
+uint16_t result;
+
+noInterrupts();
+result = overrun_count;
+interrupts();
+return result;
+}
+
+
 PS2KeyRaw::PS2KeyRaw() {
   // nothing to do here, begin() does it all
 }
 
 
+void PS2KeyRaw::begin( uint8_t data_pin, uint8_t irq_pin, uint8_t (*decoder)( uint8_t ) )
+{
+PS2_Decoder = decoder;
+begin( data_pin, irq_pin );
+}
+
+
 void PS2KeyRaw::begin( uint8_t data_pin, uint8_t irq_pin )
 {
 PS2_DataPin = data_pin;
+PS2_IrqPin = irq_pin;
+inhibited = false;
+inhibit_pending = false;
+bitcount = 0;
+held = false;
 
 // initialize the pins
 #ifdef INPUT_PULLUP
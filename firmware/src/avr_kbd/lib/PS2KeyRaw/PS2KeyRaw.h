@@ -97,9 +97,17 @@ class PS2KeyRaw {
      * The best place to call this method is in the setup routine.
      */
     static void begin( uint8_t dataPin, uint8_t irq_pin );
+
+    /**
+     * Same, every received byte is passed to decoder in the interrupt and only
+     * its non zero results are buffered. After a result the decoder is not
+     * called any more, the next bytes are buffered raw until resume().
+     */
+    static void begin( uint8_t dataPin, uint8_t irq_pin, uint8_t (*decoder)( uint8_t ) );
     
     /**
-     * Returns number of bytes available.
+     * Returns number of bytes available. Also starts a pending clock inhibit
+     * once the clock line is high again after the byte that filled the buffer.
      */
     static int8_t available();
     
@@ -108,5 +116,23 @@ class PS2KeyRaw {
      * If there is no char available, -1 is returned.
      */
     static int read();
+
+    /**
+     * With a decoder: once the buffer is empty, the interrupt decodes again
+     * and true is returned. Otherwise the next read() is a raw byte.
+     */
+    static bool resume();
+
+    /**
+     * Flow control: the clock line is held low (the keyboard keeps its bytes)
+     * while the buffer is nearly full, from available() or the next start bit
+     * on, never right after a stop bit. Returns how many times it was done.
+     */
+    static uint16_t inhibits();
+
+    /**
+     * Returns count of bytes lost with a full buffer anyway.
+     */
+    static uint16_t overruns();
 };
 #endif
\ No newline at end of file
@@ -0,0 +1,260 @@
+/*
+  PS2Mouse.cpp - PS/2 mouse in stream mode for the Buryak Pi 2021 avr firmware
+
+  Receiving is the same state machine as in PS2KeyRaw.
+  Sending (host to device): the clock is held low for 100 us, the data line is pulled low
+  (start bit) and the clock is released, then the mouse clocks the bits in, a new bit is put
+  on the data line after every falling clock edge: 8 data bits, odd parity, stop (released),
+  the mouse acknowledges by pulling the data line low on the 11th clock.
+*/
+
+#include "PS2Mouse.h"
+
+#define BUFFER_SIZE 32 // 200 reports per second of 3 bytes
+#define TX_IDLE 0
+#define TX_INHIBIT 0xFF // our own clock pull down, ignored
+#define TX_TIMEOUT 25 // ms for the whole byte
+#define ACK_TIMEOUT 25 // ms for the answer
+#define BAT_TIMEOUT 1000 // ms for the self test after a reset
+
+#define MOUSE_ACK 0xFA
+#define MOUSE_BAT_OK 0xAA
+#define MOUSE_CMD_RESET 0xFF
+#define MOUSE_CMD_SAMPLE_RATE 0xF3
+#define MOUSE_CMD_ENABLE 0xF4
+
+static volatile uint8_t buffer[ BUFFER_SIZE ];
+static volatile uint8_t head, tail;
+static uint8_t data_pin, clk_pin;
+
+static volatile uint8_t tx_bit = TX_IDLE; // 1..11 while sending
+static volatile uint8_t tx_byte;
+static volatile uint8_t tx_parity;
+static volatile bool tx_ack;
+
+// open collector output: low or released with the pull up
+static void data_write( uint8_t val )
+{
+  if( val )
+    pinMode( data_pin, INPUT_PULLUP );
+  else
+    {
+    digitalWrite( data_pin, LOW );
+    pinMode( data_pin, OUTPUT );
+    }
+}
+
+static void send_interrupt( void )
+{
+  uint8_t val;
+
+  switch( tx_bit )
+    {
+    case TX_INHIBIT:
+      return;
+    case 9:   // parity, odd
+      data_write( tx_parity ^ 1 );
+      break;
+    case 10:  // stop bit
+      data_write( 1 );
+      break;
+    case 11:  // ack from the mouse
+      tx_ack = digitalRead( data_pin ) == LOW;
+      tx_bit = TX_IDLE;
+      return;
+    default:  // data bits, LSB first
+      val = tx_byte & 1;
+      tx_parity ^= val;
+      tx_byte >>= 1;
+      data_write( val );
+    }
+  tx_bit++;
+}
+
+// clock falling edge: next bit to send or receive
+static void mouse_interrupt( void )
+{
+  static uint8_t bitcount = 0;
+  static uint8_t incoming;
+  static uint8_t parity;
+  static uint32_t prev_ms = 0;
+  uint32_t now_ms;
+  uint8_t val;
+
+  if( tx_bit != TX_IDLE )
+    {
+    send_interrupt();
+    bitcount = 0;
+    return;
+    }
+
+  val = digitalRead( data_pin );
+  now_ms = millis();
+  if( now_ms - prev_ms > 250 )
+    bitcount = 0;
+  prev_ms = now_ms;
+  bitcount++;
+  switch( bitcount )
+    {
+    case 1:  // Start bit
+      incoming = 0;
+      parity = 0;
+      break;
+    case 2:
+    case 3:
+    case 4:
+    case 5:
+    case 6:
+    case 7:
+    case 8:
+    case 9:  // Data bits
+      parity += val;
+      incoming >>= 1;
+      incoming |= ( val ) ? 0x80 : 0;
+      break;
+    case 10: // Parity check
+      parity &= 1;
+      if( parity == val )
+        parity = 0xFD;
+      break;
+    case 11: // Stop bit
+      if( parity < 0xFD )
+        {
+        val = head + 1;
+        if( val >= BUFFER_SIZE )
+          val = 0;
+        if( val != tail )
+          {
+          buffer[ val ] = incoming;
+          head = val;
+          }
+        }
+      bitcount = 0;
+      break;
+    default:
+      bitcount = 0;
+    }
+}
+
+// next byte within timeout ms, -1 on timeout
+static int wait_byte( uint16_t timeout )
+{
+  unsigned long start = millis();
+  while( !PS2Mouse::available() )
+    {
+    if( millis() - start >= timeout )
+      return -1;
+    }
+  return PS2Mouse::read();
+}
+
+
+PS2Mouse::PS2Mouse() {
+  // nothing to do here, begin() does it all
+}
+
+
+void PS2Mouse::begin( uint8_t dataPin, uint8_t irq_pin )
+{
+  data_pin = dataPin;
+  clk_pin = irq_pin;
+  pinMode( clk_pin, INPUT_PULLUP );
+  pinMode( data_pin, INPUT_PULLUP );
+  head = 0;
+  tail = 0;
+  attachInterrupt( digitalPinToInterrupt( clk_pin ), mouse_interrupt, FALLING );
+}
+
+
+bool PS2Mouse::write( uint8_t value )
+{
+  unsigned long start;
+
+  // request to send: inhibit, start bit, release the clock
+  tx_bit = TX_INHIBIT;
+  digitalWrite( clk_pin, LOW );
+  pinMode( clk_pin, OUTPUT );
+  delayMicroseconds( 100 );
+  data_write( 0 );
+  tx_byte = value;
+  tx_parity = 0;
+  tx_ack = false;
+  tail = head; // drop what was not read yet, the answer follows
+  tx_bit = 1;
+  pinMode( clk_pin, INPUT_PULLUP );
+
+  start = millis();
+  while( tx_bit != TX_IDLE )
+    {
+    if( millis() - start >= TX_TIMEOUT )
+      {
+      tx_bit = TX_IDLE;
+      data_write( 1 );
+      return false;
+      }
+    }
+  return tx_ack && wait_byte( ACK_TIMEOUT ) == MOUSE_ACK;
+}
+
+
+bool PS2Mouse::init( uint8_t sample_rate )
+{
+  if( !write( MOUSE_CMD_RESET ) )
+    return false;
+  // self test passed, then the device id
+  if( wait_byte( BAT_TIMEOUT ) != MOUSE_BAT_OK || wait_byte( ACK_TIMEOUT ) < 0 )
+    return false;
+  return write( MOUSE_CMD_SAMPLE_RATE ) && write( sample_rate ) && write( MOUSE_CMD_ENABLE );
+}
+
+
+int8_t PS2Mouse::available()
+{
+  int8_t i;
+
+  i = head - tail;
+  if( i < 0 )
+    i += BUFFER_SIZE;
+  return i;
+}
+
+
+int PS2Mouse::read()
+{
+  uint8_t i;
+
+  i = tail;
+  if( i == head )
+    return -1;
+  i++;
+  if( i >= BUFFER_SIZE )
+    i = 0;
+  tail = i;
+  return buffer[ i ];
+}
+
+
+bool PS2Mouse::packet( int16_t &dx, int16_t &dy, uint8_t &buttons )
+{
+  static uint8_t bytes[ 3 ];
+  static uint8_t count = 0;
+  int c;
+
+  while( ( c = read() ) >= 0 )
+    {
+    // bit 3 of the first byte is always set, skip bytes until it is in sync
+    if( count == 0 && !( c & 0x08 ) )
+      continue;
+    bytes[ count++ ] = c;
+    if( count == 3 )
+      {
+      count = 0;
+      buttons = bytes[ 0 ] & ( PS2_MOUSE_LEFT | PS2_MOUSE_RIGHT | PS2_MOUSE_MIDDLE );
+      // 9 bit deltas, sign in bits 4 / 5, overflow in bits 6 / 7
+      dx = ( bytes[ 0 ] & 0x40 ) ? 0 : (int16_t) bytes[ 1 ] - ( ( bytes[ 0 ] & 0x10 ) ? 256 : 0 );
+      dy = ( bytes[ 0 ] & 0x80 ) ? 0 : (int16_t) bytes[ 2 ] - ( ( bytes[ 0 ] & 0x20 ) ? 256 : 0 );
+      return true;
+      }
+    }
+  return false;
+}
@@ -0,0 +1,55 @@
+/*
+  PS2Mouse.h - PS/2 mouse in stream mode for the Buryak Pi 2021 avr firmware
+
+  Receives the mouse bytes in the clock interrupt like PS2KeyRaw does and sends
+  the host commands (reset, sample rate, enable reporting) from the same interrupt,
+  so the mouse clock pin has to be an interrupt pin as well.
+*/
+
+#ifndef PS2Mouse_h
+#define PS2Mouse_h
+#include "Arduino.h" // for attachInterrupt, FALLING
+
+// PS/2 mouse buttons, as in the first packet byte
+#define PS2_MOUSE_LEFT 0x01
+#define PS2_MOUSE_RIGHT 0x02
+#define PS2_MOUSE_MIDDLE 0x04
+
+class PS2Mouse {
+  public:
+    PS2Mouse();
+
+    /**
+     * Sets up the pins and registers the clock interrupt.
+     */
+    static void begin( uint8_t dataPin, uint8_t irq_pin );
+
+    /**
+     * Resets the mouse, sets the sample rate and enables stream mode reporting.
+     * Returns false when there is no mouse (no answer to the reset).
+     */
+    static bool init( uint8_t sample_rate );
+
+    /**
+     * Sends a command byte, true when the mouse acknowledged it (0xFA).
+     */
+    static bool write( uint8_t value );
+
+    /**
+     * Returns number of bytes available.
+     */
+    static int8_t available();
+
+    /**
+     * Returns the next byte from the mouse, -1 if there is none.
+     */
+    static int read();
+
+    /**
+     * Takes the next full movement packet from the received bytes.
+     * dx / dy are 9 bit signed, positive is right / up, zero on overflow.
+     * Returns false when no full packet has been received yet.
+     */
+    static bool packet( int16_t &dx, int16_t &dy, uint8_t &buttons );
+};
+#endif
@@ -26,6 +26,7 @@
 
 #include "Arduino.h"
 #include "SegaController.h"
+#include "trace.h"
 
 SegaController::SegaController(byte db9_pin_7, byte db9_pin_1, byte db9_pin_2, byte db9_pin_3, byte db9_pin_4, byte db9_pin_6, byte db9_pin_9)
 {
@@ -87,6 +88,8 @@ word SegaController::getState()
 
 void SegaController::readCycle(byte cycle)
 {
+    TRACE_SCOPE(TRACE_SEGA_READ);
+
     // Set the select pin low/high
     digitalWrite(_selectPin, cycle % 2);
 
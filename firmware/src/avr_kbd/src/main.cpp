@@ -4,7 +4,8 @@
  * Designed to build on PlatformIO env.
  * 
  * External libraries: https://github.com/jonthysell/SegaController/, https://github.com/techpaul/PS2KeyRaw
- * Arduino libraries: SPI, EEPROM
+ * Local libraries: PS2Mouse
+ * Arduino libraries: SPI, EEPROM (or lib/BareHAL in env:ATmega8_bare)
  * 
  * @author Andy Karpov <andy.karpov@gmail.com>
  * Ukraine, 2021
@@ -14,8 +15,19 @@
 #include "PS2KeyRaw.h"
 #include "matrix.h"
 #include "ps2_codes.h"
+#include "trace.h"
+#if MACRO_ENABLE
+  #include "typing.h"
+#endif
 #include <EEPROM.h>
 #include <SPI.h>
+#include <avr/wdt.h>
+
+#ifdef MCUCSR
+  #define RESET_FLAGS MCUCSR // atmega8
+#else
+  #define RESET_FLAGS MCUSR
+#endif
 
 PS2KeyRaw kbd;
 
@@ -26,21 +38,112 @@ PS2KeyRaw kbd;
   word joy_last_state = 0;
 #endif
 
-SPISettings settingsA(8000000, MSBFIRST, SPI_MODE0); // SPI transmission settings
+#if MOUSE_ENABLE
+  #include "PS2Mouse.h"
+  PS2Mouse mouse;
+  bool mouse_present = false;
+  int16_t mouse_dx = 0; // motion not sent yet
+  int16_t mouse_dy = 0;
+  uint8_t mouse_buttons = 0;
+  uint8_t mouse_sent_buttons = 0;
+#endif
 
-bool matrix[ZX_MATRIX_FULL_SIZE]; // matrix of pressed keys + special keys to be transmitted on CPLD side by SPI protocol
+// SPI transmission settings, fastest first
+SPISettings spi_settings[] = {
+  SPISettings(8000000, MSBFIRST, SPI_MODE0),
+  SPISettings(4000000, MSBFIRST, SPI_MODE0),
+  SPISettings(2000000, MSBFIRST, SPI_MODE0),
+  SPISettings(1000000, MSBFIRST, SPI_MODE0)
+};
+#define SPI_SPEEDS (sizeof(spi_settings) / sizeof(spi_settings[0]))
+
+#if SPI_CALIBRATE
+// loopback test patterns
+const uint8_t spi_test_patterns[] PROGMEM = {
+  0x55, 0xAA, 0x00, 0xFF, 0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0xFE, 0x7F, 0xC3, 0x3C
+};
+#define SPI_TEST_PATTERNS sizeof(spi_test_patterns)
+#endif
+
+// matrix positions of the CMD_JOY bits
+const uint8_t joy_positions[] PROGMEM = {
+  ZX_JOY_RIGHT, ZX_JOY_LEFT, ZX_JOY_DOWN, ZX_JOY_UP, ZX_JOY_FIRE, ZX_JOY_FIRE2, ZX_JOY_FIRE3, ZX_JOY_FIRE4
+};
+
+#if SPI_CALIBRATE
+uint8_t spi_speed = SPI_SPEEDS - 1; // index in spi_settings, slowest until calibrated
+uint8_t spi_speed_max = SPI_SPEEDS - 1; // calibrated speed, the runtime check never goes faster
+#else
+uint8_t spi_speed = 0; // index in spi_settings, not calibrated
+uint8_t spi_speed_max = 0;
+#endif
+uint8_t spi_clean_checks = 0; // runtime checks passed in a row since the last fall back
+uint8_t spi_errors = 0; // loopback errors found at runtime
+
+// matrix of pressed keys + special keys to be transmitted on CPLD side by SPI protocol,
+// packed as the transmitted bytes: key k is bit k % 8 of row k / 8
+volatile uint8_t matrix_rows[ZX_MATRIX_FULL_SIZE / 8];
+volatile uint8_t matrix_gen = 0; // bumped by the ps/2 interrupt after every decoded scancode (KBD_DECODE_ISR)
+uint8_t isr_action = ACTION_NONE; // action of the scancode being decoded in the interrupt
+uint8_t seen_gen = 0; // matrix_gen of the last key activity shown by the led
+uint8_t sent_rows[ZX_MATRIX_FULL_SIZE / 8]; // matrix bytes as cpld_kbd has them
+uint8_t joy_sent = 0xFF; // last CMD_JOY byte, all released after the fpga start
 
 byte turbo = 0x0;
 bool is_turbo = false;
+bool is_auto_turbo = false;
 bool is_wait = false;
 byte rom_bank = 0x0;
 bool blink = false;
 bool init_done = false;
+uint8_t fpga_status = FPGA_STATUS_BUSY; // status byte of the last CMD_INIT answer
+
+#if MACRO_ENABLE
+// rom key sets as seen by the text macros: key in the set and the time the set is free again
+uint8_t type_set_key[2] = {0xFF, 0xFF};
+unsigned long type_set_free[2] = {0, 0};
+#endif
+
+// boot timeline, ms since power on
+struct boot_timeline_t {
+  uint32_t link_up;    // fpga answered, 0 if it did not within BOOT_LINK_TIMEOUT
+  uint32_t host_ready; // rom loader finished
+  uint32_t reset_done; // init reset released
+  uint32_t first_key;  // first scancode accepted
+};
+boot_timeline_t boot_timeline = {0, 0, 0, 0};
+bool first_key_done = false;
+
+// ps/2 flow control of this boot, PS2KeyRaw holds the clock line low while its buffer is nearly full,
+// stored when it changed at most every PS2_FLOW_STORE_INTERVAL (the EEPROM keeps the last boot that stored)
+struct ps2_flow_t {
+  uint16_t inhibits; // clock line held low
+  uint16_t overruns; // bytes lost anyway
+};
+ps2_flow_t ps2_flow = {0, 0};
+
+// live state, kept in the ram over a watchdog reset (not cleared by the startup code)
+struct live_state_t {
+  uint8_t turbo;
+  uint8_t rom_bank;
+  uint8_t is_auto_turbo;
+  uint8_t is_wait;
+  uint8_t spi_speed;
+  uint8_t spi_speed_max;
+  uint8_t check; // live_state_check() of the bytes above
+};
+live_state_t live_state __attribute__((section(".noinit")));
+uint8_t reset_flags = 0; // reset cause of this start
 
 unsigned long t = 0;  // current time
 unsigned long tl = 0; // led poll time
 unsigned long te = 0; // eeprom store time
 unsigned long tb = 0; // blink state
+#if SPI_CALIBRATE
+unsigned long ts = 0; // spi link check time
+#endif
+unsigned long tr = 0; // full matrix transmit time
+unsigned long tf = 0; // ps/2 flow store time
 
 int capsed_keys[20] = {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0};
 int capsed_keys_size = 0;
@@ -49,10 +152,35 @@ void push_capsed_key(int key);
 void pop_capsed_key(int key);
 void process_capsed_key(int key, bool up);
 void fill_kbd_matrix(int sc);
+uint8_t kbd_decode_isr(uint8_t sc);
+void post_action(uint8_t action);
+void run_action(uint8_t action);
+void key_activity(unsigned long n);
+void matrix_set(uint8_t k, bool value);
 uint8_t get_matrix_byte(uint8_t pos);
+uint8_t get_joy_byte();
+uint16_t spi_frame(uint8_t addr, uint8_t data);
+uint16_t spi_transfer(uint8_t addr, uint8_t data);
 void spi_send(uint8_t addr, uint8_t data);
+#if SPI_CALIBRATE
+uint8_t spi_loopback_test(uint8_t passes, bool back_to_back);
+bool spi_speed_ok();
+void spi_calibrate();
+void spi_check();
+#endif
+void transmit_matrix_bytes(uint8_t from, uint8_t to, bool changed_only);
 void transmit_keyboard_matrix();
+void transmit_system_matrix();
+void transmit_mouse();
+void transmit_joy();
+bool fpga_wait(uint8_t mask, uint8_t value, unsigned long timeout);
 void send_macros(uint8_t pos);
+#if MACRO_ENABLE
+void type_key(uint8_t pos, uint8_t shift);
+void type_text(uint8_t text);
+#endif
+void reset_pulse();
+void do_init_reset();
 void do_reset();
 void do_magick();
 void set_rombank(byte bank);
@@ -63,6 +191,11 @@ void eeprom_store_bool(int addr, bool value);
 void eeprom_store_byte(int addr, byte value);
 void eeprom_restore_values();
 void eeprom_store_values();
+void set_mode_matrix();
+uint8_t live_state_check();
+void live_state_save();
+bool live_state_restore();
+void count_resets(uint8_t flags);
 void setup();
 void loop();
 
@@ -116,6 +249,7 @@ void process_capsed_key(int key, bool up)
 // transform PS/2 scancodes into internal matrix of pressed keys
 void fill_kbd_matrix(int sc)
 {
+  TRACE_SCOPE(TRACE_FILL_MATRIX);
 
   static bool is_up=false, is_e=false, is_e1=false;
   static bool is_ctrl=false, is_alt=false, is_del=false, is_bksp=false, is_shift=false, is_ss_used=false;
@@ -147,79 +281,79 @@ void fill_kbd_matrix(int sc)
     // Shift -> CS for ZX
     case PS2_L_SHIFT: 
     case PS2_R_SHIFT:
-      matrix[ZX_K_CS] = !is_up;
+      matrix_set(ZX_K_CS, !is_up);
       is_shift = !is_up;
       break;
 
     // Ctrl -> SS for ZX
     case PS2_L_CTRL:
     case PS2_R_CTRL:
-      matrix[ZX_K_SS] = !is_up;
+      matrix_set(ZX_K_SS, !is_up);
       is_ctrl = !is_up;
       break;
 
     // Alt (L) -> SS+CS for ZX
     case PS2_L_ALT:
-      matrix[ZX_K_SS] = !is_up;
-      matrix[ZX_K_CS] = !is_up;
+      matrix_set(ZX_K_SS, !is_up);
+      matrix_set(ZX_K_CS, !is_up);
       is_alt = !is_up;
       process_capsed_key(scancode, is_up);
       break;
 
     // Alt (R) -> SS+CS for ZX
     case PS2_R_ALT:
-      matrix[ZX_K_SS] = !is_up;
-      matrix[ZX_K_CS] = !is_up;
+      matrix_set(ZX_K_SS, !is_up);
+      matrix_set(ZX_K_CS, !is_up);
       is_alt = !is_up;
       process_capsed_key(scancode, is_up);
       break;
 
     // Del -> SS+C for ZX
     case PS2_DELETE:
-       matrix[ZX_K_SS] = !is_up;
-       matrix[ZX_K_C] =  !is_up;
+       matrix_set(ZX_K_SS, !is_up);
+       matrix_set(ZX_K_C, !is_up);
       is_del = !is_up;
     break;
 
     // Ins -> SS+A for ZX
     case PS2_INSERT:
-       matrix[ZX_K_SS] = !is_up;
-       matrix[ZX_K_A] =  !is_up;
+       matrix_set(ZX_K_SS, !is_up);
+       matrix_set(ZX_K_A, !is_up);
     break;
 
     // Cursor -> CS + 5,6,7,8
     case PS2_UP:
-      matrix[ZX_K_CS] = !is_up;
-      matrix[ZX_K_7] = !is_up;
+      matrix_set(ZX_K_CS, !is_up);
+      matrix_set(ZX_K_7, !is_up);
       process_capsed_key(scancode, is_up);
       break;
     case PS2_DOWN:
-      matrix[ZX_K_CS] = !is_up;
-      matrix[ZX_K_6] = !is_up;
+      matrix_set(ZX_K_CS, !is_up);
+      matrix_set(ZX_K_6, !is_up);
       process_capsed_key(scancode, is_up);
       break;
     case PS2_LEFT:
-      matrix[ZX_K_CS] = !is_up;
-      matrix[ZX_K_5] = !is_up;
+      matrix_set(ZX_K_CS, !is_up);
+      matrix_set(ZX_K_5, !is_up);
       process_capsed_key(scancode, is_up);
       break;
     case PS2_RIGHT:
-      matrix[ZX_K_CS] = !is_up;
-      matrix[ZX_K_8] = !is_up;
+      matrix_set(ZX_K_CS, !is_up);
+      matrix_set(ZX_K_8, !is_up);
       process_capsed_key(scancode, is_up);
       break;
 
     // ESC -> CS+SPACE for ZX
     case PS2_ESC:
-      matrix[ZX_K_CS] = !is_up;
-      matrix[ZX_K_SP] = !is_up;
+      matrix_set(ZX_K_CS, !is_up);
+      matrix_set(ZX_K_SP, !is_up);
       process_capsed_key(scancode, is_up);
       break;
 
     // Backspace -> CS+0
     case PS2_BACKSPACE:
-      matrix[ZX_K_CS] = !is_up;
-      matrix[ZX_K_0] = !is_up;
+      matrix_set(ZX_K_CS, !is_up);
+      matrix_set(ZX_K_0, !is_up);
       process_capsed_key(scancode, is_up);
       is_bksp = !is_up;
       break;
@@ -227,84 +361,84 @@ void fill_kbd_matrix(int sc)
     // Enter
     case PS2_ENTER:
     case PS2_KP_ENTER:
-      matrix[ZX_K_ENT] = !is_up;
+      matrix_set(ZX_K_ENT, !is_up);
       break;
 
     // Space
     case PS2_SPACE:
-      matrix[ZX_K_SP] = !is_up;
+      matrix_set(ZX_K_SP, !is_up);
       break;
 
     // Letters & numbers
-    case PS2_A: matrix[ZX_K_A] = !is_up; break;
-    case PS2_B: matrix[ZX_K_B] = !is_up; break;
-    case PS2_C: matrix[ZX_K_C] = !is_up; break;
-    case PS2_D: matrix[ZX_K_D] = !is_up; break;
-    case PS2_E: matrix[ZX_K_E] = !is_up; break;
-    case PS2_F: matrix[ZX_K_F] = !is_up; break;
-    case PS2_G: matrix[ZX_K_G] = !is_up; break;
-    case PS2_H: matrix[ZX_K_H] = !is_up; break;
-    case PS2_I: matrix[ZX_K_I] = !is_up; break;
-    case PS2_J: matrix[ZX_K_J] = !is_up; break;
-    case PS2_K: matrix[ZX_K_K] = !is_up; break;
-    case PS2_L: matrix[ZX_K_L] = !is_up; break;
-    case PS2_M: matrix[ZX_K_M] = !is_up; break;
-    case PS2_N: matrix[ZX_K_N] = !is_up; break;
-    case PS2_O: matrix[ZX_K_O] = !is_up; break;
-    case PS2_P: matrix[ZX_K_P] = !is_up; break;
-    case PS2_Q: matrix[ZX_K_Q] = !is_up; break;
-    case PS2_R: matrix[ZX_K_R] = !is_up; break;
-    case PS2_S: matrix[ZX_K_S] = !is_up; break;
-    case PS2_T: matrix[ZX_K_T] = !is_up; break;
-    case PS2_U: matrix[ZX_K_U] = !is_up; break;
-    case PS2_V: matrix[ZX_K_V] = !is_up; break;
-    case PS2_W: matrix[ZX_K_W] = !is_up; break;
-    case PS2_X: matrix[ZX_K_X] = !is_up; break;
-    case PS2_Y: matrix[ZX_K_Y] = !is_up; break;
-    case PS2_Z: matrix[ZX_K_Z] = !is_up; break;
+    case PS2_A: matrix_set(ZX_K_A, !is_up); break;
+    case PS2_B: matrix_set(ZX_K_B, !is_up); break;
+    case PS2_C: matrix_set(ZX_K_C, !is_up); break;
+    case PS2_D: matrix_set(ZX_K_D, !is_up); break;
+    case PS2_E: matrix_set(ZX_K_E, !is_up); break;
+    case PS2_F: matrix_set(ZX_K_F, !is_up); break;
+    case PS2_G: matrix_set(ZX_K_G, !is_up); break;
+    case PS2_H: matrix_set(ZX_K_H, !is_up); break;
+    case PS2_I: matrix_set(ZX_K_I, !is_up); break;
+    case PS2_J: matrix_set(ZX_K_J, !is_up); break;
+    case PS2_K: matrix_set(ZX_K_K, !is_up); break;
+    case PS2_L: matrix_set(ZX_K_L, !is_up); break;
+    case PS2_M: matrix_set(ZX_K_M, !is_up); break;
+    case PS2_N: matrix_set(ZX_K_N, !is_up); break;
+    case PS2_O: matrix_set(ZX_K_O, !is_up); break;
+    case PS2_P: matrix_set(ZX_K_P, !is_up); break;
+    case PS2_Q: matrix_set(ZX_K_Q, !is_up); break;
+    case PS2_R: matrix_set(ZX_K_R, !is_up); break;
+    case PS2_S: matrix_set(ZX_K_S, !is_up); break;
+    case PS2_T: matrix_set(ZX_K_T, !is_up); break;
+    case PS2_U: matrix_set(ZX_K_U, !is_up); break;
+    case PS2_V: matrix_set(ZX_K_V, !is_up); break;
+    case PS2_W: matrix_set(ZX_K_W, !is_up); break;
+    case PS2_X: matrix_set(ZX_K_X, !is_up); break;
+    case PS2_Y: matrix_set(ZX_K_Y, !is_up); break;
+    case PS2_Z: matrix_set(ZX_K_Z, !is_up); break;
 
     // digits
-    case PS2_0: matrix[ZX_K_0] = !is_up; break;
-    case PS2_1: matrix[ZX_K_1] = !is_up; break;
-    case PS2_2: matrix[ZX_K_2] = !is_up; break;
-    case PS2_3: matrix[ZX_K_3] = !is_up; break;
-    case PS2_4: matrix[ZX_K_4] = !is_up; break;
-    case PS2_5: matrix[ZX_K_5] = !is_up; break;
-    case PS2_6: matrix[ZX_K_6] = !is_up; break;
-    case PS2_7: matrix[ZX_K_7] = !is_up; break;
-    case PS2_8: matrix[ZX_K_8] = !is_up; break;
-    case PS2_9: matrix[ZX_K_9] = !is_up; break;
+    case PS2_0: matrix_set(ZX_K_0, !is_up); break;
+    case PS2_1: matrix_set(ZX_K_1, !is_up); break;
+    case PS2_2: matrix_set(ZX_K_2, !is_up); break;
+    case PS2_3: matrix_set(ZX_K_3, !is_up); break;
+    case PS2_4: matrix_set(ZX_K_4, !is_up); break;
+    case PS2_5: matrix_set(ZX_K_5, !is_up); break;
+    case PS2_6: matrix_set(ZX_K_6, !is_up); break;
+    case PS2_7: matrix_set(ZX_K_7, !is_up); break;
+    case PS2_8: matrix_set(ZX_K_8, !is_up); break;
+    case PS2_9: matrix_set(ZX_K_9, !is_up); break;
 
     // Keypad digits
-    case PS2_KP_0: matrix[ZX_K_0] = !is_up; break;
-    case PS2_KP_1: matrix[ZX_K_1] = !is_up; break;
-    case PS2_KP_2: matrix[ZX_K_2] = !is_up; break;
-    case PS2_KP_3: matrix[ZX_K_3] = !is_up; break;
-    case PS2_KP_4: matrix[ZX_K_4] = !is_up; break;
-    case PS2_KP_5: matrix[ZX_K_5] = !is_up; break;
-    case PS2_KP_6: matrix[ZX_K_6] = !is_up; break;
-    case PS2_KP_7: matrix[ZX_K_7] = !is_up; break;
-    case PS2_KP_8: matrix[ZX_K_8] = !is_up; break;
-    case PS2_KP_9: matrix[ZX_K_9] = !is_up; break;
+    case PS2_KP_0: matrix_set(ZX_K_0, !is_up); break;
+    case PS2_KP_1: matrix_set(ZX_K_1, !is_up); break;
+    case PS2_KP_2: matrix_set(ZX_K_2, !is_up); break;
+    case PS2_KP_3: matrix_set(ZX_K_3, !is_up); break;
+    case PS2_KP_4: matrix_set(ZX_K_4, !is_up); break;
+    case PS2_KP_5: matrix_set(ZX_K_5, !is_up); break;
+    case PS2_KP_6: matrix_set(ZX_K_6, !is_up); break;
+    case PS2_KP_7: matrix_set(ZX_K_7, !is_up); break;
+    case PS2_KP_8: matrix_set(ZX_K_8, !is_up); break;
+    case PS2_KP_9: matrix_set(ZX_K_9, !is_up); break;
 
     // '/" -> SS+P / SS+7
     case PS2_QUOTE:
-      matrix[ZX_K_SS] = !is_up;
-      matrix[is_shift ? ZX_K_P : ZX_K_7] = !is_up;
+      matrix_set(ZX_K_SS, !is_up);
+      matrix_set(is_shift ? ZX_K_P : ZX_K_7, !is_up);
       if (is_up) {
-        matrix[ZX_K_P] = false;
-        matrix[ZX_K_7] = false;
+        matrix_set(ZX_K_P, false);
+        matrix_set(ZX_K_7, false);
       }
       is_ss_used = is_shift;
       break;
 
     // ,/< -> SS+N / SS+R
     case PS2_COMMA:
-      matrix[ZX_K_SS] = !is_up;
-      matrix[is_shift ? ZX_K_R : ZX_K_N] = !is_up;
+      matrix_set(ZX_K_SS, !is_up);
+      matrix_set(is_shift ? ZX_K_R : ZX_K_N, !is_up);
       if (is_up) {
-        matrix[ZX_K_R] = false;
-        matrix[ZX_K_N] = false;
+        matrix_set(ZX_K_R, false);
+        matrix_set(ZX_K_N, false);
       }
       is_ss_used = is_shift;
       break;
@@ -312,22 +446,22 @@ void fill_kbd_matrix(int sc)
     // ./> -> SS+M / SS+T
     case PS2_PERIOD:
     case PS2_KP_PERIOD:
-      matrix[ZX_K_SS] = !is_up;
-      matrix[is_shift ? ZX_K_T : ZX_K_M] = !is_up;
+      matrix_set(ZX_K_SS, !is_up);
+      matrix_set(is_shift ? ZX_K_T : ZX_K_M, !is_up);
       if (is_up) {
-        matrix[ZX_K_T] = false;
-        matrix[ZX_K_M] = false;
+        matrix_set(ZX_K_T, false);
+        matrix_set(ZX_K_M, false);
       }
       is_ss_used = is_shift;
       break;
 
     // ;/: -> SS+O / SS+Z
     case PS2_SEMICOLON:
-      matrix[ZX_K_SS] = !is_up;
-      matrix[is_shift ? ZX_K_Z : ZX_K_O] = !is_up;
+      matrix_set(ZX_K_SS, !is_up);
+      matrix_set(is_shift ? ZX_K_Z : ZX_K_O, !is_up);
       if (is_up) {
-        matrix[ZX_K_Z] = false;
-        matrix[ZX_K_O] = false;
+        matrix_set(ZX_K_Z, false);
+        matrix_set(ZX_K_O, false);
       }
       is_ss_used = is_shift;
       break;
@@ -335,25 +469,25 @@ void fill_kbd_matrix(int sc)
     // [,{ -> SS+Y / SS+F
     case PS2_L_BRACKET:
       if (!is_up) {
-        send_macros(is_shift ? ZX_K_F : ZX_K_Y);
+        post_action(ACTION_MACRO | (is_shift ? ZX_K_F : ZX_K_Y));
       }
       break;
 
     // ],} -> SS+U / SS+G
     case PS2_R_BRACKET:
       if (!is_up) {
-        send_macros(is_shift ? ZX_K_G : ZX_K_U);
+        post_action(ACTION_MACRO | (is_shift ? ZX_K_G : ZX_K_U));
       }
       break;
 
     // /,? -> SS+V / SS+C
     case PS2_SLASH:
     case PS2_KP_SLASH:
-      matrix[ZX_K_SS] = !is_up;
-      matrix[is_shift ? ZX_K_C : ZX_K_V] = !is_up;
+      matrix_set(ZX_K_SS, !is_up);
+      matrix_set(is_shift ? ZX_K_C : ZX_K_V, !is_up);
       if (is_up) {
-        matrix[ZX_K_C] = false;
-        matrix[ZX_K_V] = false;
+        matrix_set(ZX_K_C, false);
+        matrix_set(ZX_K_V, false);
       }
       is_ss_used = is_shift;
       break;
@@ -361,28 +495,28 @@ void fill_kbd_matrix(int sc)
     // \,| -> SS+D / SS+S
     case PS2_BACK_SLASH:
       if (!is_up) {
-        send_macros(is_shift ? ZX_K_S : ZX_K_D);
+        post_action(ACTION_MACRO | (is_shift ? ZX_K_S : ZX_K_D));
       }
       break;
 
     // =,+ -> SS+L / SS+K
     case PS2_EQUALS:
-      matrix[ZX_K_SS] = !is_up;
-      matrix[is_shift ? ZX_K_K : ZX_K_L] = !is_up;
+      matrix_set(ZX_K_SS, !is_up);
+      matrix_set(is_shift ? ZX_K_K : ZX_K_L, !is_up);
       if (is_up) {
-        matrix[ZX_K_K] = false;
-        matrix[ZX_K_L] = false;
+        matrix_set(ZX_K_K, false);
+        matrix_set(ZX_K_L, false);
       }
       is_ss_used = is_shift;
       break;
 
     // -,_ -> SS+J / SS+0
     case PS2_MINUS:
-      matrix[ZX_K_SS] = !is_up;
-      matrix[is_shift ? ZX_K_0 : ZX_K_J] = !is_up;
+      matrix_set(ZX_K_SS, !is_up);
+      matrix_set(is_shift ? ZX_K_0 : ZX_K_J, !is_up);
       if (is_up) {
-        matrix[ZX_K_0] = false;
-        matrix[ZX_K_J] = false;
+        matrix_set(ZX_K_0, false);
+        matrix_set(ZX_K_J, false);
       }
       is_ss_used = is_shift;
       break;
@@ -390,144 +524,147 @@ void fill_kbd_matrix(int sc)
     // `,~ -> SS+X / SS+A
     case PS2_ACCENT:
       if (is_shift and !is_up) {
-        send_macros(is_shift ? ZX_K_A : ZX_K_X);
+        post_action(ACTION_MACRO | (is_shift ? ZX_K_A : ZX_K_X));
       }
       if (!is_shift) {
-        matrix[ZX_K_SS] = !is_up;
-        matrix[ZX_K_X] = !is_up;
+        matrix_set(ZX_K_SS, !is_up);
+        matrix_set(ZX_K_X, !is_up);
         is_ss_used = is_shift;
       }
       break;
 
     // Keypad * -> SS+B
     case PS2_KP_STAR:
-      matrix[ZX_K_SS] = !is_up;
-      matrix[ZX_K_B] = !is_up;
+      matrix_set(ZX_K_SS, !is_up);
+      matrix_set(ZX_K_B, !is_up);
       break;
 
     // Keypad - -> SS+J
     case PS2_KP_MINUS:
-      matrix[ZX_K_SS] = !is_up;
-      matrix[ZX_K_J] = !is_up;
+      matrix_set(ZX_K_SS, !is_up);
+      matrix_set(ZX_K_J, !is_up);
       break;
 
     // Keypad + -> SS+K
     case PS2_KP_PLUS:
-      matrix[ZX_K_SS] = !is_up;
-      matrix[ZX_K_K] = !is_up;
+      matrix_set(ZX_K_SS, !is_up);
+      matrix_set(ZX_K_K, !is_up);
       break;
 
     // Tab
     case PS2_TAB:
-      matrix[ZX_K_CS] = !is_up;
-      matrix[ZX_K_I] = !is_up;
+      matrix_set(ZX_K_CS, !is_up);
+      matrix_set(ZX_K_I, !is_up);
       process_capsed_key(scancode, is_up);
       break;
 
     // CapsLock
     case PS2_CAPS:
-      matrix[ZX_K_SS] = !is_up;
-      matrix[ZX_K_CS] = !is_up;
+      matrix_set(ZX_K_SS, !is_up);
+      matrix_set(ZX_K_CS, !is_up);
       process_capsed_key(scancode, is_up);
       break;
 
     // PgUp -> CS+3 for ZX
     case PS2_PGUP:
-      matrix[ZX_K_CS] = !is_up;
-      matrix[ZX_K_3] = !is_up;
+      matrix_set(ZX_K_CS, !is_up);
+      matrix_set(ZX_K_3, !is_up);
       process_capsed_key(scancode, is_up);
       break;
 
     // PgDn -> CS+4 for ZX
     case PS2_PGDN:
-      matrix[ZX_K_CS] = !is_up;
-      matrix[ZX_K_4] = !is_up;
+      matrix_set(ZX_K_CS, !is_up);
+      matrix_set(ZX_K_4, !is_up);
       process_capsed_key(scancode, is_up);
       break;
 
-    // Scroll Lock -> Turbo
+    // Scroll Lock -> Turbo, Ctrl+Scroll Lock -> Auto turbo
     case PS2_SCROLL: 
       if (is_up) {
-        if (turbo == 0x0) {
-          turbo = 0x01;
-        } else if (turbo == 0x01) {
-          turbo = 0x02;
-        } else {
-          turbo = 0x0;
-        }
-
-        is_turbo = (turbo > 0) ? true : false;
-        eeprom_store_byte(EEPROM_TURBO_ADDRESS, turbo);
-        matrix[ZX_K_TURBO0] = bitRead(turbo, 0);
-        matrix[ZX_K_TURBO1] = bitRead(turbo, 1);
-        matrix[ZX_K_TURBO] = is_turbo;
+        post_action(is_ctrl ? ACTION_AUTOTURBO : ACTION_TURBO);
       }
     break;
 
     // Pause -> Wait
     case PS2_PAUSE:
       if (is_up) {
-        is_wait = !is_wait;
-        matrix[ZX_K_WAIT] = is_wait; 
+        post_action(ACTION_WAIT);
       }
     break;
 
     // F1 -Rom bank 0
     case PS2_F1:
       if (is_up) {
-        set_rombank(0);
+        post_action(ACTION_ROMBANK | 0);
       }
     break;
 
     // F2 -Rom bank 1
     case PS2_F2:
       if (is_up) {
-        set_rombank(1);
+        post_action(ACTION_ROMBANK | 1);
       }
     break;
 
     // F3 -Rom bank 2
     case PS2_F3:
       if (is_up) {
-        set_rombank(2);
+        post_action(ACTION_ROMBANK | 2);
       }
     break;
 
     // F4 -Rom bank 3
     case PS2_F4:
       if (is_up) {
-        set_rombank(3);
+        post_action(ACTION_ROMBANK | 3);
       }
     break;
 
     // F5 -Rom bank 4
     case PS2_F5:
       if (is_up) {
-        set_rombank(4);
+        post_action(ACTION_ROMBANK | 4);
       }
     break;
 
     // F6 -Rom bank 5
     case PS2_F6:
       if (is_up) {
-        set_rombank(5);
+        post_action(ACTION_ROMBANK | 5);
       }
     break;
 
     // F7 -Rom bank 6
     case PS2_F7:
       if (is_up) {
-        set_rombank(6);
+        post_action(ACTION_ROMBANK | 6);
       }
     break;
 
     // F8 -Rom bank 7
     case PS2_F8:
       if (is_up) {
-        set_rombank(7);
+        post_action(ACTION_ROMBANK | 7);
       }
     break;
 
+#if MACRO_ENABLE
+    // F9 -> LOAD "", Ctrl+F9 -> user text 0
+    case PS2_F9:
+      if (is_up) {
+        post_action(ACTION_TYPE | (is_ctrl ? 0x02 : 0x00));
+      }
+    break;
+
+    // F10 -> RANDOMIZE USR 15616, Ctrl+F10 -> user text 1
+    case PS2_F10:
+      if (is_up) {
+        post_action(ACTION_TYPE | (is_ctrl ? 0x03 : 0x01));
+      }
+    break;
+#endif
+
     // F11 - RESET
     case PS2_F11:
       if (is_up) {
@@ -537,20 +674,20 @@ void fill_kbd_matrix(int sc)
         is_shift = false;
         is_ss_used = false;
         capsed_keys_size = 0;
-        do_reset();        
+        post_action(ACTION_RESET);
       }
     break;
 
     // F12 -> Magick button
     case PS2_F12:
       if (is_up) {
-        do_magick();
+        post_action(ACTION_MAGICK);
       }
     break;
   }
 
   if (is_ss_used and capsed_keys_size == 0) {
-      matrix[ZX_K_CS] = false;
+      matrix_set(ZX_K_CS, false);
   }
 
   // Ctrl+Alt+Del -> RESET
@@ -561,7 +698,7 @@ void fill_kbd_matrix(int sc)
     is_shift = false;
     is_ss_used = false;
     capsed_keys_size = 0;
-    do_reset();
+    post_action(ACTION_RESET);
   }
 
   // Ctrl+Alt+Bksp -> REINIT controller
@@ -572,16 +709,7 @@ void fill_kbd_matrix(int sc)
       is_shift = false;
       is_ss_used = false;
       capsed_keys_size = 0;
-      clear_matrix(ZX_MATRIX_SIZE);
-      matrix[ZX_K_RESET] = true;
-      transmit_keyboard_matrix();
-      matrix[ZX_K_S] = true;
-      transmit_keyboard_matrix();
-      delay(500);
-      matrix[ZX_K_RESET] = false;
-      transmit_keyboard_matrix();
-      delay(500);
-      matrix[ZX_K_S] = false;
+      post_action(ACTION_REINIT);
   }
 
    // clear flags
@@ -593,101 +721,501 @@ void fill_kbd_matrix(int sc)
    }
 }
 
-uint8_t get_matrix_byte(uint8_t pos)
+#if KBD_DECODE == KBD_DECODE_ISR
+// ps/2 interrupt: keys go to the matrix at once, the scancode's action (if any) is queued for loop(),
+// which also decodes the scancodes held back while the action runs
+uint8_t kbd_decode_isr(uint8_t sc)
 {
-  uint8_t result = 0;
-  for (uint8_t i=0; i<8; i++) {
-    uint8_t k = pos*8 + i;
-    if (k < ZX_MATRIX_FULL_SIZE) {
-      bitWrite(result, i, matrix[k]);
-    }
+  isr_action = ACTION_NONE;
+  fill_kbd_matrix(sc);
+  matrix_gen++;
+  return isr_action;
+}
+#endif
+
+// special keys which transmit, wait or write the eeprom, not allowed in the interrupt
+void post_action(uint8_t action)
+{
+#if KBD_DECODE == KBD_DECODE_ISR
+  isr_action = action;
+#else
+  run_action(action);
+#endif
+}
+
+void run_action(uint8_t action)
+{
+  if (action & ACTION_MACRO) {
+    send_macros(action & ~ACTION_MACRO);
+    return;
+  }
+  if ((action & 0xF0) == ACTION_ROMBANK) {
+    set_rombank(action & 0x07);
+    return;
+  }
+#if MACRO_ENABLE
+  if ((action & 0xF0) == ACTION_TYPE) {
+    type_text(action & 0x03);
+    return;
+  }
+#endif
+  switch (action) {
+    case ACTION_TURBO:
+      if (turbo == 0x0) {
+        turbo = 0x01;
+      } else if (turbo == 0x01) {
+        turbo = 0x02;
+      } else if (turbo == 0x02) {
+        turbo = 0x03;
+      } else {
+        turbo = 0x0;
+      }
+
+      is_turbo = (turbo > 0) ? true : false;
+      eeprom_store_byte(EEPROM_TURBO_ADDRESS, turbo);
+      matrix_set(ZX_K_TURBO0, bitRead(turbo, 0));
+      matrix_set(ZX_K_TURBO1, bitRead(turbo, 1));
+      matrix_set(ZX_K_TURBO, is_turbo);
+      break;
+
+    case ACTION_AUTOTURBO:
+      is_auto_turbo = !is_auto_turbo;
+      eeprom_store_bool(EEPROM_AUTOTURBO_ADDRESS, is_auto_turbo);
+      matrix_set(ZX_K_AUTOTURBO, is_auto_turbo);
+      break;
+
+    case ACTION_WAIT:
+      is_wait = !is_wait;
+      matrix_set(ZX_K_WAIT, is_wait); 
+      break;
+
+    case ACTION_RESET:
+      do_reset();
+      break;
+
+    case ACTION_MAGICK:
+      do_magick();
+      break;
+
+    // Ctrl+Alt+Bksp -> REINIT controller
+    case ACTION_REINIT:
+      clear_matrix(ZX_MATRIX_SIZE);
+      matrix_set(ZX_K_RESET, true);
+      transmit_keyboard_matrix();
+      matrix_set(ZX_K_S, true);
+      transmit_keyboard_matrix();
+      delay(500);
+      matrix_set(ZX_K_RESET, false);
+      transmit_keyboard_matrix();
+      delay(500);
+      matrix_set(ZX_K_S, false);
+      break;
   }
-  return result;
 }
 
-void spi_send(uint8_t addr, uint8_t data) 
+// the interrupt may update the matrix as well, so the bit is changed with interrupts off
+void matrix_set(uint8_t k, bool value)
+{
+  uint8_t sreg = SREG;
+  cli();
+  if (value) {
+    matrix_rows[k >> 3] |= _BV(k & 7);
+  } else {
+    matrix_rows[k >> 3] &= ~_BV(k & 7);
+  }
+  SREG = sreg;
+}
+
+uint8_t get_matrix_byte(uint8_t pos)
+{
+  return matrix_rows[pos];
+}
+
+// one frame, inside a transaction of the caller
+uint16_t spi_frame(uint8_t addr, uint8_t data)
 {
     uint8_t in_cmd = 0;
     uint8_t in_data = 0;
 
-    SPI.beginTransaction(settingsA);
     digitalWrite(PIN_SS, LOW);
     //uint8_t cmd = SPI.transfer(addr); // command (1...6)
     //uint8_t res = SPI.transfer(data); // data byte
     in_cmd = SPI.transfer(addr); // command (1...6)
     in_data = SPI.transfer(data); // data byte
     digitalWrite(PIN_SS, HIGH);
-    SPI.endTransaction();
 
     if (in_cmd == CMD_INIT) {
       init_done = true;
+      fpga_status = in_data;
+    }
+
+    return (in_cmd << 8) | in_data;
+}
+
+uint16_t spi_transfer(uint8_t addr, uint8_t data)
+{
+    SPI.beginTransaction(spi_settings[spi_speed]);
+    uint16_t res = spi_frame(addr, data);
+    SPI.endTransaction();
+    return res;
+}
+
+void spi_send(uint8_t addr, uint8_t data)
+{
+    spi_transfer(addr, data);
+}
+
+#if SPI_CALIBRATE
+// run test patterns through the cpld_kbd loopback at current speed, returns count of errors,
+// back to back: all the frames in one transaction with the shortest SS high time between them
+uint8_t spi_loopback_test(uint8_t passes, bool back_to_back)
+{
+  uint8_t errors = 0;
+  uint8_t prev = pgm_read_byte(&spi_test_patterns[0]);
+  spi_transfer(CMD_LOOPBACK, prev);
+  if (back_to_back) {
+    SPI.beginTransaction(spi_settings[spi_speed]);
+  }
+  for (uint8_t p=0; p<passes; p++) {
+    for (uint8_t i=1; i<=SPI_TEST_PATTERNS; i++) {
+      uint8_t next = pgm_read_byte(&spi_test_patterns[i % SPI_TEST_PATTERNS]);
+      // previous pattern comes back as is in command byte and inverted in data byte
+      uint16_t res = back_to_back ? spi_frame(CMD_LOOPBACK, next) : spi_transfer(CMD_LOOPBACK, next);
+      if (res != ((prev << 8) | (uint8_t) ~prev) && errors < 0xFF) {
+        errors++;
+      }
+      prev = next;
+    }
+  }
+  if (back_to_back) {
+    SPI.endTransaction();
+  }
+  return errors;
+}
+
+// a speed the link keeps: the normal passes and then the margin passes back to back without an error
+bool spi_speed_ok()
+{
+  return spi_loopback_test(SPI_CALIBRATION_PASSES, false) == 0 && spi_loopback_test(SPI_MARGIN_PASSES, true) == 0;
+}
+
+// select the fastest speed which passes the strict test, the slowest one when nothing passes
+void spi_calibrate()
+{
+  for (spi_speed = 0; spi_speed < SPI_SPEEDS - 1; spi_speed++) {
+    if (spi_speed_ok()) {
+      break;
+    }
+  }
+  spi_speed_max = spi_speed;
+  spi_clean_checks = 0;
+}
+
+// runtime link check, fall back to the next slower speed on errors,
+// go back up towards the calibrated speed after SPI_PROMOTE_CHECKS clean checks
+void spi_check()
+{
+  if (spi_loopback_test(1, false) != 0) {
+    if (spi_errors < 0xFF) {
+      spi_errors++;
+    }
+    if (spi_speed < SPI_SPEEDS - 1) {
+      spi_speed++;
+    }
+    spi_clean_checks = 0;
+    return;
+  }
+  if (spi_speed <= spi_speed_max || ++spi_clean_checks < SPI_PROMOTE_CHECKS) {
+    return;
+  }
+  // the faster speed has to pass the strict test of the calibration again
+  spi_clean_checks = 0;
+  spi_speed--;
+  if (!spi_speed_ok()) {
+    spi_speed++;
+  }
+}
+#endif
+
+// transmit matrix bytes [from, to) from AVR to CPLD side via SPI, or only the ones changed since they were sent
+void transmit_matrix_bytes(uint8_t from, uint8_t to, bool changed_only)
+{
+    uint8_t rows[ZX_MATRIX_FULL_SIZE / 8];
+    uint8_t gen;
+    uint8_t last = 0;
+    // lock-free snapshot: copied again if the interrupt decoded a scancode in between
+    do {
+      gen = matrix_gen;
+      for (uint8_t i=from; i<to; i++) {
+        rows[i] = get_matrix_byte(i);
+      }
+    } while (gen != matrix_gen);
+    for (uint8_t i=from; i<to; i++) {
+      if (!changed_only || rows[i] != sent_rows[i]) {
+        spi_send(i+1, rows[i]);
+        sent_rows[i] = rows[i];
+        last = i+1;
+      }
+    }
+    // the last byte commits the update on cpld side, partial updates need an explicit commit
+    if (last != 0 && last < 8) {
+      spi_send(CMD_KBD_COMMIT, 0x00);
     }
 }
 
 // transmit keyboard matrix from AVR to CPLD side via SPI
 void transmit_keyboard_matrix()
 {
-    uint8_t bytes = 8;
-    for (uint8_t i=0; i<bytes; i++) {
-      uint8_t data = get_matrix_byte(i);
-      spi_send(i+1, data);
+    TRACE_SCOPE(TRACE_TRANSMIT_MATRIX);
+    transmit_matrix_bytes(0, 8, false);
+}
+
+// transmit special signals and joystick only, keyboard rows are owned by the cpld_kbd decoder
+void transmit_system_matrix()
+{
+    TRACE_SCOPE(TRACE_TRANSMIT_MATRIX);
+    transmit_matrix_bytes(5, 8, false);
+}
+
+// joystick bits of the matrix in CMD_JOY order
+uint8_t get_joy_byte()
+{
+  uint8_t joy = 0;
+  for (uint8_t i=0; i<8; i++) {
+    uint8_t pos = pgm_read_byte(&joy_positions[i]);
+    if (get_matrix_byte(pos >> 3) & _BV(pos & 7)) {
+      joy |= _BV(i);
     }
+  }
+  return joy;
+}
+
+// a joystick change goes out at once in a single frame, ahead of the matrix rows
+void transmit_joy()
+{
+  uint8_t joy = get_joy_byte();
+  if (joy != joy_sent) {
+    spi_send(CMD_JOY, joy);
+    joy_sent = joy;
+  }
 }
 
+#if MOUSE_ENABLE
+// send the motion collected since the last call, cpld_kbd adds it to the kempston mouse position
+void transmit_mouse()
+{
+  int16_t step;
+  if (mouse_dx != 0) {
+    step = constrain(mouse_dx, -128, 127);
+    spi_send(CMD_MOUSE_X, (uint8_t) step);
+    mouse_dx -= step;
+  }
+  if (mouse_dy != 0) {
+    step = constrain(mouse_dy, -128, 127);
+    spi_send(CMD_MOUSE_Y, (uint8_t) step);
+    mouse_dy -= step;
+  }
+  if (mouse_buttons != mouse_sent_buttons) {
+    spi_send(CMD_MOUSE_BUTTONS, mouse_buttons);
+    mouse_sent_buttons = mouse_buttons;
+  }
+}
+#endif
+
 // transmit keyboard macros (sequence of keyboard clicks) to emulate typing some special symbols [, ], {, }, ~, |, `
 void send_macros(uint8_t pos)
 {
   clear_matrix(ZX_MATRIX_SIZE);
   transmit_keyboard_matrix();
   delay(20);
-  matrix[ZX_K_CS] = true;
+  matrix_set(ZX_K_CS, true);
   transmit_keyboard_matrix();
   delay(20);
-  matrix[ZX_K_SS] = true;
+  matrix_set(ZX_K_SS, true);
   transmit_keyboard_matrix();
   delay(20);
-  matrix[ZX_K_SS] = false;
+  matrix_set(ZX_K_SS, false);
   transmit_keyboard_matrix();
   delay(20);
-  matrix[pos] = true;
+  matrix_set(pos, true);
   transmit_keyboard_matrix();
   delay(20);
-  matrix[ZX_K_CS] = false;
-  matrix[pos] = false;
+  matrix_set(ZX_K_CS, false);
+  matrix_set(pos, false);
   transmit_keyboard_matrix();
   delay(20);
 }
 
-void do_init_reset()
+#if MACRO_ENABLE
+// press a key (and a shift) for one rom scan, the previous key is released at the same time.
+// A release and a wait are only needed when the rom would not take the key yet:
+// it is the same key as in a busy set or both sets are busy
+void type_key(uint8_t pos, uint8_t shift)
 {
+  uint8_t set;
+  unsigned long now = millis();
+
+  wdt_reset();
+  if (type_set_key[0] == pos) {
+    set = 0;
+  } else if (type_set_key[1] == pos) {
+    set = 1;
+  } else {
+    set = ((long) (type_set_free[1] - type_set_free[0]) < 0) ? 1 : 0;
+  }
+  if ((long) (type_set_free[set] - now) > 0) {
+    clear_matrix(ZX_MATRIX_SIZE);
+    transmit_keyboard_matrix();
+    delay(type_set_free[set] - now);
+  }
+
   clear_matrix(ZX_MATRIX_SIZE);
-  matrix[ZX_K_SP] = true;
-  matrix[ZX_K_RESET] = true;
+  matrix_set(pos, true);
+  if (shift != TYPE_NO_SHIFT) {
+    matrix_set(shift, true);
+  }
   transmit_keyboard_matrix();
-  delay(500);
-  matrix[ZX_K_RESET] = false;
-  transmit_keyboard_matrix(); 
-  delay(200);
-  matrix[ZX_K_SP] = false;
-  transmit_keyboard_matrix();  
+  delay(MACRO_HOLD_MS);
+  type_set_key[set] = pos;
+  type_set_free[set] = millis() + MACRO_FREE_MS;
 }
 
-void do_reset()
+// type a text macro (see typing.h) in the 48K editor, bit 1 of text selects a user text in the eeprom.
+// The first pass only follows the cursor mode, a text with a key the editor would take
+// in the other mode (a letter in K mode, a K mode keyword in L mode) is not typed at all
+void type_text(uint8_t text)
 {
+  const char *flash_text = (const char *) pgm_read_ptr(&type_texts[text & 0x01]);
+  int addr = EEPROM_MACRO_ADDRESS + (text & 0x01) * MACRO_TEXT_SIZE;
+
+  if ((text & 0x02) && EEPROM.read(addr) == 0xFF) {
+    return;
+  }
+
+  for (uint8_t pass=0; pass<2; pass++) {
+    bool is_k_mode = true, is_quoted = false;
+
+    if (pass == 1) {
+      clear_matrix(ZX_MATRIX_SIZE);
+      type_set_key[0] = type_set_key[1] = 0xFF;
+      type_set_free[0] = type_set_free[1] = millis();
+    }
+
+    for (uint8_t i=0; i<MACRO_TEXT_SIZE; i++) {
+      uint8_t c = (text & 0x02) ? EEPROM.read(addr + i) : pgm_read_byte(flash_text + i);
+      uint8_t e;
+      bool is_letter = (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z');
+
+      if (c == 0x00) {
+        break;
+      } else if (c >= ZX_TOKEN_FIRST) {
+        e = pgm_read_byte(&type_tokens[c - ZX_TOKEN_FIRST]);
+        if (TYPE_MODE(e) == TYPE_KEY(0) && !is_k_mode) {
+          return; // command keyword in the middle of a statement
+        }
+      } else if (c >= 0x20) {
+        e = pgm_read_byte(&type_chars[c - 0x20]);
+        if (is_letter && is_k_mode) {
+          return; // would be a command keyword, e.g. PRINT spelled out instead of 0xF5
+        }
+      } else if (c == '\r') {
+        e = TYPE_KEY(ZX_K_ENT);
+      } else {
+        continue;
+      }
+
+      if (pass == 1) {
+        switch (TYPE_MODE(e)) {
+          case TYPE_E(0):
+            type_key(ZX_K_SS, ZX_K_CS);
+            type_key(TYPE_POS(e), TYPE_NO_SHIFT);
+            break;
+          case TYPE_E_SS(0):
+            type_key(ZX_K_SS, ZX_K_CS);
+            type_key(TYPE_POS(e), ZX_K_SS);
+            break;
+          case TYPE_SS(0):
+            type_key(TYPE_POS(e), ZX_K_SS);
+            break;
+          default:
+            type_key(TYPE_POS(e), (c >= 'A' && c <= 'Z') ? ZX_K_CS : TYPE_NO_SHIFT);
+            break;
+        }
+      }
+
+      // cursor mode of the next key: K at a statement start, digits and spaces of a line number keep it
+      if (c == '\r') {
+        is_k_mode = true;
+        is_quoted = false;
+      } else if (c == '"') {
+        is_quoted = !is_quoted;
+        is_k_mode = false;
+      } else if (!is_quoted && (c == ':' || c == ZX_TOKEN_THEN)) {
+        is_k_mode = true;
+      } else if (!(is_k_mode && ((c >= '0' && c <= '9') || c == ' '))) {
+        is_k_mode = false;
+      }
+    }
+  }
+
   clear_matrix(ZX_MATRIX_SIZE);
-  matrix[ZX_K_RESET] = true;
   transmit_keyboard_matrix();
-  delay(500);
-  matrix[ZX_K_RESET] = false;
+}
+#endif
+
+// poll the fpga with a growing delay until (status & mask) == value, false on timeout
+bool fpga_wait(uint8_t mask, uint8_t value, unsigned long timeout)
+{
+  unsigned long start = millis();
+  uint8_t backoff = 1;
+  while (true) {
+    wdt_reset();
+    spi_send(CMD_NONE, 0x00);
+    if (init_done && ((fpga_status & mask) == value)) {
+      return true;
+    }
+    if (millis() - start >= timeout) {
+      return false;
+    }
+    delay(backoff);
+    if (backoff < BOOT_POLL_MAX_DELAY) {
+      backoff <<= 1;
+    }
+  }
+}
+
+// hold reset until the fpga acknowledges it, older fpga firmwares never do, so it is bounded
+void reset_pulse()
+{
+  matrix_set(ZX_K_RESET, true);
+  transmit_keyboard_matrix();
+  fpga_wait(FPGA_STATUS_RESET_ACK, FPGA_STATUS_RESET_ACK, RESET_PULSE_MAX);
+  matrix_set(ZX_K_RESET, false);
+  transmit_keyboard_matrix();
+}
+
+void do_init_reset()
+{
+  clear_matrix(ZX_MATRIX_SIZE);
+  matrix_set(ZX_K_SP, true);
+  reset_pulse();
+  delay(BOOT_KEY_HOLD);
+  matrix_set(ZX_K_SP, false);
   transmit_keyboard_matrix();  
 }
 
+void do_reset()
+{
+  clear_matrix(ZX_MATRIX_SIZE);
+  reset_pulse();
+}
+
 void do_magick()
 {
-  matrix[ZX_K_MAGICK] = true;
+  matrix_set(ZX_K_MAGICK, true);
   transmit_keyboard_matrix();
   delay(500);
-  matrix[ZX_K_MAGICK] = false;
+  matrix_set(ZX_K_MAGICK, false);
   transmit_keyboard_matrix();
 }
 
@@ -695,9 +1223,9 @@ void set_rombank(byte bank)
 {
   rom_bank = bank;
   eeprom_store_byte(EEPROM_ROMBANK_ADDRESS, rom_bank);
-  matrix[ZX_K_ROMBANK0] = bitRead(rom_bank, 0);
-  matrix[ZX_K_ROMBANK1] = bitRead(rom_bank, 1);
-  matrix[ZX_K_ROMBANK2] = bitRead(rom_bank, 2);
+  matrix_set(ZX_K_ROMBANK0, bitRead(rom_bank, 0));
+  matrix_set(ZX_K_ROMBANK1, bitRead(rom_bank, 1));
+  matrix_set(ZX_K_ROMBANK2, bitRead(rom_bank, 2));
   do_reset();
 }
 
@@ -705,7 +1233,7 @@ void clear_matrix(int clear_size)
 {
     // all keys up
   for (int i=0; i<clear_size; i++) {
-      matrix[i] = false;
+      matrix_set(i, false);
   }
 }
 
@@ -745,28 +1273,99 @@ void eeprom_restore_values()
     rom_bank = 0;
     eeprom_store_byte(EEPROM_ROMBANK_ADDRESS, rom_bank);
   }
-  if (turbo > 0x02) {
+  if (turbo > 0x03) {
     turbo = 0;
     eeprom_store_byte(EEPROM_TURBO_ADDRESS, turbo);
   }
   is_turbo = (turbo > 0) ? true : false;
-  matrix[ZX_K_TURBO0] = bitRead(turbo, 0);
-  matrix[ZX_K_TURBO1] = bitRead(turbo, 1);
-  matrix[ZX_K_TURBO] = is_turbo;
-  matrix[ZX_K_ROMBANK0] = bitRead(rom_bank, 0);
-  matrix[ZX_K_ROMBANK1] = bitRead(rom_bank, 1);
-  matrix[ZX_K_ROMBANK2] = bitRead(rom_bank, 2);
+  is_auto_turbo = eeprom_restore_bool(EEPROM_AUTOTURBO_ADDRESS, false);
+  set_mode_matrix();
 }
 
 void eeprom_store_values()
 {
   eeprom_store_byte(EEPROM_TURBO_ADDRESS, turbo);
   eeprom_store_byte(EEPROM_ROMBANK_ADDRESS, rom_bank);
+  eeprom_store_bool(EEPROM_AUTOTURBO_ADDRESS, is_auto_turbo);
+}
+
+// special signals of the current modes
+void set_mode_matrix()
+{
+  matrix_set(ZX_K_TURBO0, bitRead(turbo, 0));
+  matrix_set(ZX_K_TURBO1, bitRead(turbo, 1));
+  matrix_set(ZX_K_TURBO, is_turbo);
+  matrix_set(ZX_K_AUTOTURBO, is_auto_turbo);
+  matrix_set(ZX_K_WAIT, is_wait);
+  matrix_set(ZX_K_ROMBANK0, bitRead(rom_bank, 0));
+  matrix_set(ZX_K_ROMBANK1, bitRead(rom_bank, 1));
+  matrix_set(ZX_K_ROMBANK2, bitRead(rom_bank, 2));
+}
+
+uint8_t live_state_check()
+{
+  const uint8_t *p = (const uint8_t *) &live_state;
+  uint8_t sum = 0x5A;
+  for (uint8_t i=0; i<sizeof(live_state) - 1; i++) {
+    sum = ((sum << 1) | (sum >> 7)) ^ p[i];
+  }
+  return sum;
+}
+
+void live_state_save()
+{
+  live_state.turbo = turbo;
+  live_state.rom_bank = rom_bank;
+  live_state.is_auto_turbo = is_auto_turbo;
+  live_state.is_wait = is_wait;
+  live_state.spi_speed = spi_speed;
+  live_state.spi_speed_max = spi_speed_max;
+  live_state.check = live_state_check();
+}
+
+// false if the ram does not hold a valid live state (power on, external reset)
+bool live_state_restore()
+{
+  if (live_state.check != live_state_check() || live_state.turbo > 0x03 || live_state.rom_bank > 7 || live_state.spi_speed >= SPI_SPEEDS || live_state.spi_speed_max > live_state.spi_speed) {
+    return false;
+  }
+  turbo = live_state.turbo;
+  rom_bank = live_state.rom_bank;
+  is_turbo = (turbo > 0) ? true : false;
+  is_auto_turbo = live_state.is_auto_turbo;
+  is_wait = live_state.is_wait;
+  spi_speed = live_state.spi_speed;
+  spi_speed_max = live_state.spi_speed_max;
+  set_mode_matrix();
+  return true;
+}
+
+// one counter per reset cause bit (PORF, EXTRF, BORF, WDRF)
+void count_resets(uint8_t flags)
+{
+  for (uint8_t i=0; i<4; i++) {
+    if (bitRead(flags, i)) {
+      byte count = EEPROM.read(EEPROM_RESET_COUNT_ADDRESS + i);
+      if (count == 0xFF) {
+        count = 0;
+      }
+      if (count < 0xFE) {
+        eeprom_store_byte(EEPROM_RESET_COUNT_ADDRESS + i, count + 1);
+      }
+    }
+  }
 }
 
 // initial setup
 void setup()
 {
+  bool is_warm;
+
+  // the reset cause flags stay set until cleared
+  reset_flags = RESET_FLAGS;
+  RESET_FLAGS = 0;
+  wdt_enable(WDT_TIMEOUT);
+
   SPI.begin();
 
   pinMode(PIN_SS, OUTPUT);
@@ -776,8 +1375,11 @@ void setup()
   pinMode(LED_KBD, OUTPUT);
   pinMode(LED_TURBO, OUTPUT);
   pinMode(LED_ROMBANK, OUTPUT);
+#ifndef TRACE_USES_LED_PAUSE
   pinMode(LED_PAUSE, OUTPUT);
+#endif
   pinMode(AUDIO_OFF, OUTPUT);
+  TRACE_INIT();
 
 // set up pins for kempston joy
 #if JOY_TYPE==JOY_KEMPSTON
@@ -786,15 +1388,19 @@ void setup()
   pinMode(JOY_LEFT, INPUT_PULLUP);
   pinMode(JOY_RIGHT, INPUT_PULLUP);
   pinMode(JOY_FIRE, INPUT_PULLUP);
+#if !MOUSE_ENABLE
   pinMode(JOY_FIRE2, INPUT_PULLUP);
   pinMode(JOY_FIRE3, INPUT_PULLUP);
+#endif
 #endif
 
   digitalWrite(LED_PWR, HIGH);
   digitalWrite(LED_KBD, HIGH);
   digitalWrite(LED_TURBO, LOW);
   digitalWrite(LED_ROMBANK, LOW);
+#ifndef TRACE_USES_LED_PAUSE
   digitalWrite(LED_PAUSE, LOW);
+#endif
   digitalWrite(AUDIO_OFF, LOW);
 
   // ps/2
@@ -807,77 +1413,198 @@ void setup()
   // clear full matrix
   clear_matrix(ZX_MATRIX_FULL_SIZE);
 
-  // restore saved modes from EEPROM
-  eeprom_restore_values();
+  // a watchdog restart picks up the live state, otherwise restore saved modes from EEPROM
+  is_warm = bitRead(reset_flags, WDRF) && live_state_restore();
+  if (!is_warm) {
+    eeprom_restore_values();
+  }
+  count_resets(reset_flags);
 
   digitalWrite(LED_TURBO, (turbo != 0) ? HIGH : LOW);
   digitalWrite(LED_ROMBANK, (rom_bank != 0) ? HIGH: LOW);
 
+#if KBD_DECODE == KBD_DECODE_ISR
+  kbd.begin(PIN_KBD_DAT, PIN_KBD_CLK, kbd_decode_isr);
+#else
   kbd.begin(PIN_KBD_DAT, PIN_KBD_CLK);
+#endif
 
-  // waiting for init
-  while (!init_done) {
+  if (is_warm) {
+    // the host kept running, no calibration and no init reset, all keys up at once
+    first_key_done = true; // the eeprom keeps the timeline of the cold boot
     spi_send(CMD_NONE, 0x00);
+    transmit_keyboard_matrix();
+  } else {
+    // waiting for init, bounded: the keyboard has to work even if the fpga is late,
+    // link_up stays 0 if the fpga did not answer
+    if (fpga_wait(0, 0, BOOT_LINK_TIMEOUT)) {
+      boot_timeline.link_up = millis();
+    }
+
+#if SPI_CALIBRATE
+    spi_calibrate();
+#endif
+
+    if (init_done) {
+      // push restored settings at once, the rom loader waits for this first commit (O_BANK_VALID)
+      // to load the saved bank instead of bank 0
+      transmit_keyboard_matrix();
+      fpga_wait(FPGA_STATUS_BUSY, 0, BOOT_READY_TIMEOUT);
+    }
+    boot_timeline.host_ready = millis();
+
+    do_init_reset();
+    boot_timeline.reset_done = millis();
   }
 
-  do_init_reset();
+#if MOUSE_ENABLE
+  // the mouse has to be plugged in at power on
+  mouse.begin(PIN_MOUSE_DAT, PIN_MOUSE_CLK);
+  mouse_present = mouse.init(MOUSE_SAMPLE_RATE);
+#endif
 
   digitalWrite(LED_KBD, LOW);
 }
 
 
+// keyboard led and the first key of the boot timeline
+void key_activity(unsigned long n)
+{
+  tl = n;
+  digitalWrite(LED_KBD, HIGH);
+  if (!first_key_done) {
+    // keep the timeline of this boot for later inspection
+    first_key_done = true;
+    boot_timeline.first_key = n;
+    EEPROM.put(EEPROM_BOOT_TIMELINE_ADDRESS, boot_timeline);
+  }
+}
+
 // main loop
 void loop()
 {
   unsigned long n = millis();
-  
-  if (kbd.available()) {
-    int c = kbd.read();
-    tl = n;
-    digitalWrite(LED_KBD, HIGH);
-    fill_kbd_matrix(c);
-  }
+
+  wdt_reset();
+  live_state_save();
 
 // read sega joystick
 #if JOY_TYPE==JOY_SEGA
   joy_current_state = joystick.getState();
   if (joy_current_state != joy_last_state) {
-    matrix[ZX_JOY_UP] = !(joy_current_state & SC_BTN_UP);
-    matrix[ZX_JOY_DOWN] = !(joy_current_state & SC_BTN_DOWN);
-    matrix[ZX_JOY_LEFT] = !(joy_current_state & SC_BTN_LEFT);
-    matrix[ZX_JOY_RIGHT] = !(joy_current_state & SC_BTN_RIGHT);
-    matrix[ZX_JOY_FIRE] = !(joy_current_state & SC_BTN_B);
-    matrix[ZX_JOY_FIRE2] = !(joy_current_state & SC_BTN_C);
-    matrix[ZX_JOY_FIRE3] = !(joy_current_state & SC_BTN_A);
-    matrix[ZX_JOY_FIRE4] = !(joy_current_state & SC_BTN_START);
-    matrix[ZX_JOY_X] = !(joy_current_state & SC_BTN_X);
-    matrix[ZX_JOY_Y] = !(joy_current_state & SC_BTN_Y);
-    matrix[ZX_JOY_Z] = !(joy_current_state & SC_BTN_Z);
-    matrix[ZX_JOY_MODE] = !(joy_current_state & SC_BTN_MODE);
+    matrix_set(ZX_JOY_UP, !(joy_current_state & SC_BTN_UP));
+    matrix_set(ZX_JOY_DOWN, !(joy_current_state & SC_BTN_DOWN));
+    matrix_set(ZX_JOY_LEFT, !(joy_current_state & SC_BTN_LEFT));
+    matrix_set(ZX_JOY_RIGHT, !(joy_current_state & SC_BTN_RIGHT));
+    matrix_set(ZX_JOY_FIRE, !(joy_current_state & SC_BTN_B));
+    matrix_set(ZX_JOY_FIRE2, !(joy_current_state & SC_BTN_C));
+    matrix_set(ZX_JOY_FIRE3, !(joy_current_state & SC_BTN_A));
+    matrix_set(ZX_JOY_FIRE4, !(joy_current_state & SC_BTN_START));
+    matrix_set(ZX_JOY_X, !(joy_current_state & SC_BTN_X));
+    matrix_set(ZX_JOY_Y, !(joy_current_state & SC_BTN_Y));
+    matrix_set(ZX_JOY_Z, !(joy_current_state & SC_BTN_Z));
+    matrix_set(ZX_JOY_MODE, !(joy_current_state & SC_BTN_MODE));
     joy_last_state = joy_current_state;    
   }
 #else
   // read kempston joystick
-  matrix[ZX_JOY_UP] = digitalRead(JOY_UP);
-  matrix[ZX_JOY_DOWN] = digitalRead(JOY_DOWN);
-  matrix[ZX_JOY_LEFT] = digitalRead(JOY_LEFT);
-  matrix[ZX_JOY_RIGHT] = digitalRead(JOY_RIGHT);
-  matrix[ZX_JOY_FIRE] = digitalRead(JOY_FIRE);
-  matrix[ZX_JOY_FIRE2] = digitalRead(JOY_FIRE2);
-  matrix[ZX_JOY_FIRE3] = true;
-  matrix[ZX_JOY_FIRE4] = true;
-  matrix[ZX_JOY_X] = true;
-  matrix[ZX_JOY_Y] = true;
-  matrix[ZX_JOY_Z] = true;
-  matrix[ZX_JOY_MODE] = true;
+  matrix_set(ZX_JOY_UP, digitalRead(JOY_UP));
+  matrix_set(ZX_JOY_DOWN, digitalRead(JOY_DOWN));
+  matrix_set(ZX_JOY_LEFT, digitalRead(JOY_LEFT));
+  matrix_set(ZX_JOY_RIGHT, digitalRead(JOY_RIGHT));
+  matrix_set(ZX_JOY_FIRE, digitalRead(JOY_FIRE));
+#if MOUSE_ENABLE
+  matrix_set(ZX_JOY_FIRE2, true);
+#else
+  matrix_set(ZX_JOY_FIRE2, digitalRead(JOY_FIRE2));
+#endif
+  matrix_set(ZX_JOY_FIRE3, true);
+  matrix_set(ZX_JOY_FIRE4, true);
+  matrix_set(ZX_JOY_X, true);
+  matrix_set(ZX_JOY_Y, true);
+  matrix_set(ZX_JOY_Z, true);
+  matrix_set(ZX_JOY_MODE, true);
+#endif
+
+  // the joystick goes first, keys and matrix rows can wait
+  transmit_joy();
+
+#if KBD_DECODE == KBD_DECODE_ISR
+  // keys are in the matrix already, the ring carries the special key actions only.
+  // The interrupt buffers the scancodes after an action raw, so the matrix and the
+  // shift state do not change under a macro or a reinit, they are decoded here once it is done.
+  if (kbd.available()) {
+    run_action(kbd.read());
+    while (!kbd.resume()) {
+      int c = kbd.read();
+      uint8_t action = (c < 0) ? ACTION_NONE : kbd_decode_isr(c);
+      if (action != ACTION_NONE) {
+        run_action(action);
+      }
+    }
+  }
+  if (matrix_gen != seen_gen) {
+    seen_gen = matrix_gen;
+    key_activity(n);
+  }
+#else
+  if (kbd.available()) {
+    int c = kbd.read();
+    key_activity(n);
+#if KBD_DECODE == KBD_DECODE_FPGA
+    // forward scancode as is, cpld_kbd updates its matrix right away
+    spi_send(CMD_KBD_SCANCODE, c);
+#endif
+    // still decoded here for the special keys and macros
+    fill_kbd_matrix(c);
+  }
 #endif
 
   if (digitalRead(PIN_BTN_NMI) == LOW) {
     do_magick();
   }
 
-  // transmit kbd always
-  transmit_keyboard_matrix();
+  // transmit the changed matrix bytes, all of them once in a while
+  bool is_refresh = (n - tr >= KBD_REFRESH_INTERVAL);
+  if (is_refresh) {
+    tr = n;
+  }
+#if KBD_DECODE == KBD_DECODE_FPGA
+  // keyboard rows are decoded by cpld_kbd, the refresh sends our copy of them as well,
+  // so a lost scancode frame can not leave a key stuck
+  transmit_matrix_bytes(is_refresh ? 0 : 5, 8, !is_refresh);
+#else
+  transmit_matrix_bytes(0, 8, !is_refresh);
+#endif
+
+#if MOUSE_ENABLE
+  if (mouse_present) {
+    int16_t dx, dy;
+    while (mouse.packet(dx, dy, mouse_buttons)) {
+      mouse_dx += dx;
+      mouse_dy += dy;
+    }
+    transmit_mouse();
+  }
+#endif
+
+#if SPI_CALIBRATE
+  // check spi link
+  if (n - ts >= SPI_CHECK_INTERVAL) {
+    spi_check();
+    ts = n;
+  }
+#endif
+
+  // store the ps/2 flow counters, rarely: every store wears the EEPROM
+  if (n - tf >= PS2_FLOW_STORE_INTERVAL) {
+    if (kbd.inhibits() != ps2_flow.inhibits || kbd.overruns() != ps2_flow.overruns) {
+      ps2_flow.inhibits = kbd.inhibits();
+      ps2_flow.overruns = kbd.overruns();
+      EEPROM.put(EEPROM_PS2_FLOW_ADDRESS, ps2_flow);
+    }
+    tf = n;
+  }
 
   // update leds
   if (n - tl >= 200) {
@@ -890,13 +1617,17 @@ void loop()
     tb = n;
   }
 
-  if (turbo == 0x02) {
+  if (turbo == 0x03) {
+    digitalWrite(LED_TURBO, (n & 0x80) ? HIGH : LOW); // fast blink
+  } else if (turbo == 0x02) {
     digitalWrite(LED_TURBO, blink ? HIGH : LOW);
   } else {
     digitalWrite(LED_TURBO, (turbo != 0) ? HIGH : LOW);
   }
 
+#ifndef TRACE_USES_LED_PAUSE
   digitalWrite(LED_PAUSE, is_wait ? HIGH: LOW);
+#endif
   digitalWrite(AUDIO_OFF, is_wait ? HIGH: LOW);
   digitalWrite(LED_ROMBANK, rom_bank != 0 ? HIGH : LOW);
   
@@ -0,0 +1,128 @@
+#!/usr/bin/env python3
+"""
+Arduino core build (env:ATmega8) vs the bare register level build (env:ATmega8_bare).
+
+Builds the release firmwares of build.sh (kempston, sega, mouse) and the bare build
+one after the other and prints flash / RAM use side by side, the exit status is 1
+when a build does not fit the ATmega8. With captures of the builds it adds the
+ps2interrupt() run time and entry jitter (see trace_report.py).
+
+  compare_builds.py                      # pio run every build, size table
+  compare_builds.py -D MACRO_ENABLE=1    # same with an extra define in every build
+  compare_builds.py --no-build           # use the existing .pio/build output, one row per env
+  compare_builds.py --vcd kempston=arduino.vcd --vcd bare=bare.vcd
+
+A capture needs a build with the ps2 isr trace point and the keyboard typing:
+  PLATFORMIO_BUILD_FLAGS="-DTRACE_MASK=0x01" pio run -e ATmega8_bare
+then record the trace pin (PC4, A4) and the ps/2 clock (PD2) with simavr or a logic analyzer.
+"""
+
+import argparse
+import os
+import shutil
+import subprocess
+import sys
+
+from trace_report import find_signal, latencies, parse_vcd, pulses
+
+ENVS = ["ATmega8", "ATmega8_bare"]
+# name, env, PLATFORMIO_BUILD_FLAGS, the release builds as in build.sh
+BUILDS = [
+    ("kempston", "ATmega8", "-DJOY_TYPE=0"),
+    ("sega", "ATmega8", "-DJOY_TYPE=1"),
+    ("mouse", "ATmega8", "-DJOY_TYPE=0 -DMOUSE_ENABLE=1"),
+    ("bare", "ATmega8_bare", "-DJOY_TYPE=0"),
+]
+FLASH_SIZE = 8192
+RAM_SIZE = 1024
+PROJECT_DIR = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+
+def find_avr_size():
+    tool = shutil.which("avr-size")
+    if tool:
+        return tool
+    tool = os.path.expanduser("~/.platformio/packages/toolchain-atmelavr/bin/avr-size")
+    if os.path.exists(tool):
+        return tool
+    sys.exit("avr-size not found")
+
+
+def sizes(avr_size, env):
+    """(flash, ram) bytes of the env's firmware.elf."""
+    elf = os.path.join(PROJECT_DIR, ".pio", "build", env, "firmware.elf")
+    if not os.path.exists(elf):
+        sys.exit("%s not found, build it first" % elf)
+    out = subprocess.run([avr_size, "-A", elf], check=True, capture_output=True, text=True).stdout
+    section = {}
+    for line in out.splitlines():
+        parts = line.split()
+        if len(parts) >= 2 and parts[0].startswith(".") and parts[1].isdigit():
+            section[parts[0]] = int(parts[1])
+    flash = section.get(".text", 0) + section.get(".data", 0)
+    ram = section.get(".data", 0) + section.get(".bss", 0) + section.get(".noinit", 0)
+    return flash, ram
+
+
+def isr_timing(path, trace, clock):
+    """(isr max us, isr avg us, entry jitter us) from a capture."""
+    timescale, signals, changes, _ = parse_vcd(path)
+    events = changes[find_signal(signals, trace)]
+    lengths = [l * timescale * 1e6 for _, l in pulses(events)]
+    lat = [l * timescale * 1e6 for l in latencies(changes[find_signal(signals, clock)], events)]
+    if not lengths or not lat:
+        sys.exit("%s: no isr pulses" % path)
+    return max(lengths), sum(lengths) / len(lengths), max(lat) - min(lat)
+
+
+def build(env, flags):
+    """pio run of one env with flags, the output of the previous build of the env is replaced."""
+    environ = dict(os.environ, PLATFORMIO_BUILD_FLAGS=flags + " -Wall")
+    subprocess.run(["pio", "run", "-d", PROJECT_DIR, "-e", env, "-t", "clean"], check=True, env=environ)
+    subprocess.run(["pio", "run", "-d", PROJECT_DIR, "-e", env], check=True, env=environ)
+
+
+def main():
+    ap = argparse.ArgumentParser(description="Arduino vs bare build comparison")
+    ap.add_argument("--no-build", action="store_true", help="do not run pio")
+    ap.add_argument("-D", dest="defines", action="append", default=[], metavar="NAME=VALUE",
+                    help="extra define of every build (MACRO_ENABLE=1, SPI_CALIBRATE=0)")
+    ap.add_argument("--vcd", action="append", default=[], metavar="BUILD=FILE", help="isr capture of a build")
+    ap.add_argument("-s", "--signal", default="PORTC4", help="trace pin signal name (default %(default)s)")
+    ap.add_argument("-l", "--latency", default="PORTD2", help="ps/2 clock signal name (default %(default)s)")
+    args = ap.parse_args()
+
+    if args.no_build:
+        builds = [(env, env, None) for env in ENVS]
+    else:
+        extra = "".join(" -D" + d for d in args.defines)
+        builds = [(name, env, flags + extra) for name, env, flags in BUILDS]
+
+    captures = dict(item.split("=", 1) for item in args.vcd)
+    for name in captures:
+        if name not in [b[0] for b in builds]:
+            sys.exit("unknown build %s" % name)
+
+    avr_size = find_avr_size()
+    rows = []
+    for name, env, flags in builds:
+        if flags is not None:
+            build(env, flags)
+        rows.append((name, env) + sizes(avr_size, env))
+
+    print("%-10s %-14s %8s %7s %6s %6s %12s %12s %12s" %
+          ("build", "env", "flash", "flash %", "ram", "ram %", "isr max us", "isr avg us", "jitter us"))
+    over = False
+    for name, env, flash, ram in rows:
+        timing = ("-", "-", "-")
+        if name in captures:
+            timing = ["%.2f" % v for v in isr_timing(captures[name], args.signal, args.latency)]
+        print("%-10s %-14s %8d %7.1f %6d %6.1f %12s %12s %12s" % (
+            name, env, flash, 100.0 * flash / FLASH_SIZE, ram, 100.0 * ram / RAM_SIZE, *timing))
+        over = over or flash > FLASH_SIZE or ram > RAM_SIZE
+    if over:
+        sys.exit("a build does not fit the ATmega8 (%d flash, %d ram)" % (FLASH_SIZE, RAM_SIZE))
+
+
+if __name__ == "__main__":
+    main()
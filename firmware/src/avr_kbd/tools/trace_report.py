@@ -0,0 +1,188 @@
+#!/usr/bin/env python3
+"""
+Per-function timing report from trace pin captures (see include/trace.h).
+
+Reads a VCD file (simavr trace, logic analyzer export) and measures every
+high pulse of the selected 1-bit signals: a pulse is one run of the traced function.
+
+  trace_report.py capture.vcd                        # all 1-bit signals
+  trace_report.py capture.vcd -s PORTC4=fill_matrix  # signal name -> trace name
+  trace_report.py capture.vcd -s D3=ps2_isr -s D4=transmit_matrix
+  trace_report.py capture.vcd -s C4=ps2_isr -l D2   # + entry latency after every falling D2 (ps/2 clock)
+
+With -l the report also shows the latency from every falling edge of the given
+signal to the start of the next pulse, max - min is the interrupt entry jitter.
+"""
+
+import argparse
+import sys
+
+TRACE_NAMES = {
+    0: "ps2_isr",
+    1: "fill_matrix",
+    2: "transmit_matrix",
+    3: "sega_read",
+}
+
+TIMESCALE_UNITS = {"s": 1.0, "ms": 1e-3, "us": 1e-6, "ns": 1e-9, "ps": 1e-12, "fs": 1e-15}
+
+
+def parse_timescale(text):
+    text = text.strip().replace(" ", "")
+    for unit in sorted(TIMESCALE_UNITS, key=len, reverse=True):
+        if text.endswith(unit):
+            return int(text[:-len(unit)] or "1") * TIMESCALE_UNITS[unit]
+    raise ValueError("bad timescale: %s" % text)
+
+
+def parse_vcd(path):
+    """Returns (timescale in seconds, {name: id}, {id: [(time, value)]}, capture end time)."""
+    timescale = 1e-9
+    signals = {}
+    changes = {}
+    scope = []
+    now = 0
+
+    with open(path) as f:
+        tokens = f.read().split()
+
+    i = 0
+    while i < len(tokens):
+        tok = tokens[i]
+        if tok == "$timescale":
+            j = tokens.index("$end", i)
+            timescale = parse_timescale("".join(tokens[i + 1:j]))
+            i = j
+        elif tok == "$scope":
+            scope.append(tokens[i + 2])
+            i = tokens.index("$end", i)
+        elif tok == "$upscope":
+            scope.pop()
+            i = tokens.index("$end", i)
+        elif tok == "$var":
+            # $var wire 1 ! name [range] $end
+            j = tokens.index("$end", i)
+            width, ident, name = int(tokens[i + 2]), tokens[i + 3], tokens[i + 4]
+            if width == 1:
+                signals[".".join(scope + [name])] = ident
+                changes.setdefault(ident, [])
+            i = j
+        elif tok in ("$comment", "$date", "$version"):
+            i = tokens.index("$end", i)
+        elif tok.startswith("$"):
+            pass  # $dumpvars, $end, $enddefinitions ...
+        elif tok.startswith("#"):
+            now = int(tok[1:])
+        elif tok[0] in "01xXzZ":
+            ident = tok[1:]
+            if ident in changes:
+                changes[ident].append((now, tok[0]))
+        elif tok[0] in "bBrR":
+            i += 1  # vector or real value, skip its identifier
+        i += 1
+
+    return timescale, signals, changes, now
+
+
+def pulses(events):
+    """High pulses as (start, length) pairs."""
+    result = []
+    start = None
+    for t, v in events:
+        if v == "1" and start is None:
+            start = t
+        elif v != "1" and start is not None:
+            result.append((start, t - start))
+            start = None
+    return result
+
+
+def latencies(ref_events, events):
+    """Time from every falling edge of ref to the start of the next high pulse."""
+    starts = [t for t, _ in pulses(events)]
+    result = []
+    i = 0
+    prev = None
+    for t, v in ref_events:
+        if prev == "1" and v == "0":
+            while i < len(starts) and starts[i] < t:
+                i += 1
+            if i < len(starts):
+                result.append(starts[i] - t)
+        prev = v
+    return result
+
+
+def find_signal(signals, name):
+    if name in signals:
+        return signals[name]
+    matches = [k for k in signals if k.split(".")[-1] == name or k.endswith("." + name)]
+    if len(matches) == 1:
+        return signals[matches[0]]
+    raise KeyError("signal %s %s" % (name, "is ambiguous" if matches else "not found"))
+
+
+def fmt_us(seconds):
+    return "%.2f" % (seconds * 1e6)
+
+
+def main():
+    ap = argparse.ArgumentParser(description="Trace pin timing report")
+    ap.add_argument("vcd", help="VCD capture")
+    ap.add_argument("-s", "--signal", action="append", default=[],
+                    help="SIGNAL[=TRACE], TRACE is a name or a trace id from trace.h")
+    ap.add_argument("-l", "--latency", metavar="SIGNAL",
+                    help="report the latency from the falling edges of SIGNAL to the trace pulses")
+    args = ap.parse_args()
+
+    timescale, signals, changes, end = parse_vcd(args.vcd)
+    if not signals:
+        sys.exit("no 1-bit signals in %s" % args.vcd)
+
+    selected = []
+    for item in args.signal or sorted(signals):
+        name, _, trace = item.partition("=")
+        if trace.isdigit():
+            trace = TRACE_NAMES.get(int(trace), trace)
+        try:
+            selected.append((trace or name, find_signal(signals, name)))
+        except KeyError as e:
+            sys.exit(str(e.args[0]))
+
+    span = end * timescale
+
+    print("%-20s %8s %10s %10s %10s %12s %8s %12s" %
+          ("trace", "count", "min us", "avg us", "max us", "total us", "load %", "min gap us"))
+    for trace, ident in selected:
+        p = pulses(changes[ident])
+        if not p:
+            print("%-20s %8d" % (trace, 0))
+            continue
+        lengths = [l * timescale for _, l in p]
+        gaps = [(b[0] - a[0]) * timescale for a, b in zip(p, p[1:])]
+        total = sum(lengths)
+        print("%-20s %8d %10s %10s %10s %12s %8.2f %12s" % (
+            trace, len(p),
+            fmt_us(min(lengths)), fmt_us(total / len(p)), fmt_us(max(lengths)),
+            fmt_us(total), (100.0 * total / span) if span else 0.0,
+            fmt_us(min(gaps)) if gaps else "-"))
+
+    if args.latency:
+        try:
+            ref = changes[find_signal(signals, args.latency)]
+        except KeyError as e:
+            sys.exit(str(e.args[0]))
+        print()
+        print("%-20s %8s %10s %10s %10s %10s" % ("latency", "count", "min us", "avg us", "max us", "jitter us"))
+        for trace, ident in selected:
+            lat = [l * timescale for l in latencies(ref, changes[ident])]
+            if not lat:
+                print("%-20s %8d" % (trace, 0))
+                continue
+            print("%-20s %8d %10s %10s %10s %10s" % (
+                trace, len(lat), fmt_us(min(lat)), fmt_us(sum(lat) / len(lat)),
+                fmt_us(max(lat)), fmt_us(max(lat) - min(lat))))
+
+
+if __name__ == "__main__":
+    main()
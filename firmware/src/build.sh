@@ -16,6 +16,11 @@ export PLATFORMIO_BUILD_FLAGS="-DJOY_TYPE=1 -Wall"
 pio run
 cp .pio/build/ATmega8/firmware.hex ../../release/avr_kbd_sega.hex
 
+pio run -t clean
+export PLATFORMIO_BUILD_FLAGS="-DJOY_TYPE=0 -DMOUSE_ENABLE=1 -Wall"
+pio run
+cp .pio/build/ATmega8/firmware.hex ../../release/avr_kbd_mouse.hex
+
 pio run -t clean
 
 echo "Done"
@@ -5,8 +5,12 @@ USE ieee.std_logic_unsigned.all;
 use IEEE.numeric_std.all;
 
 entity cpld_kbd is
+generic (
+	RESET_ACK_BIT : integer := 19 -- reset is acknowledged after 2^RESET_ACK_BIT clocks (~19 ms @ 28 MHz)
+);
 port (
 	CLK	     : in std_logic;
+	I_READY     : in std_logic := '1'; -- host is ready (rom loader finished)
 
 	A           : in std_logic_vector(15 downto 8); -- address bus for kbd
 	KB          : out std_logic_vector(4 downto 0) := "11111"; -- data bus for kbd
@@ -18,11 +22,18 @@ port (
 			
 	O_RESET		: out std_logic;
 	O_TURBO		: out std_logic_vector(1 downto 0);
+	O_AUTO_TURBO : out std_logic := '0'; -- dos code runs at full speed
 	O_MAGICK		: out std_logic;
 	O_WAIT 		: out std_logic;
 	
 	O_JOY 		: out std_logic_vector(7 downto 0);
-	O_BANK 		: out std_logic_vector(2 downto 0)
+	O_BANK 		: out std_logic_vector(2 downto 0);
+	O_BANK_VALID : out std_logic := '0'; -- O_BANK has been committed by the AVR at least once
+
+	-- kempston mouse
+	O_MOUSE_X 	: out std_logic_vector(7 downto 0); -- #FBDF
+	O_MOUSE_Y 	: out std_logic_vector(7 downto 0); -- #FFDF
+	O_MOUSE_BTN : out std_logic_vector(7 downto 0) -- #FADF
 );
 end cpld_kbd;
 
@@ -36,13 +47,84 @@ architecture RTL of cpld_kbd is
 	 signal turbo   : std_logic_vector(1 downto 0) := "00";
 	 signal magick  : std_logic := '0';
 	 signal waiting : std_logic := '0';
+	 signal auto_turbo : std_logic := '0';
 	 
 	 -- spi
 	 signal spi_do_valid : std_logic := '0';
+	 signal spi_do_valid_prev : std_logic := '0';
 	 signal spi_do : std_logic_vector(15 downto 0);
+	 signal spi_di : std_logic_vector(15 downto 0) := X"F000"; -- init request from fpga or loopback echo
+	 signal echo : std_logic := '0';
+	 signal echo_data : std_logic_vector(7 downto 0) := X"00";
+
+	 -- boot handshake
+	 signal status : std_logic_vector(7 downto 0); -- bit 0: host is busy, bit 1: reset acknowledged
+	 signal reset_cnt : std_logic_vector(RESET_ACK_BIT downto 0) := (others => '0');
 	 
 	 signal joy : std_logic_vector(11 downto 0) := "111111111111";
 	 signal bank : std_logic_vector(2 downto 0) := "000";
+	 signal bank_valid : std_logic := '0';
+
+	 -- mouse position is accumulated here, the AVR sends motion deltas
+	 signal mouse_x : std_logic_vector(7 downto 0) := (others => '0');
+	 signal mouse_y : std_logic_vector(7 downto 0) := (others => '0');
+	 signal mouse_btn : std_logic_vector(2 downto 0) := "000"; -- ps/2 order: middle, right, left
+
+	 -- shadow copy of the matrix frames, applied to the live state at once
+	 type frames_t is array (1 to 8) of std_logic_vector(7 downto 0);
+	 signal shadow : frames_t := (others => (others => '0'));
+	 signal dirty  : std_logic_vector(8 downto 1) := (others => '0'); -- frames received since last commit
+	 signal commit : std_logic := '0';
+
+	 -- raw PS/2 scancode decoder state
+	 signal sc_up     : std_logic := '0'; -- F0 (key released) prefix
+	 signal sc_e      : std_logic := '0'; -- E0 / E1 (extended) prefix
+	 signal sc_e1     : std_logic := '0'; -- E1 prefix
+	 signal sc_shift  : std_logic := '0'; -- shift is held
+	 signal sc_capsed : std_logic_vector(11 downto 0) := (others => '0'); -- held keys which press CS by themselves
+	 signal sc_mods   : std_logic_vector(3 downto 0) := "0000"; -- ctrl, alt, del, backspace are held (system combos)
+
+	 -- key positions in kb_data (same as ZX_K_* in avr_kbd/include/matrix.h)
+	 constant ZX_K_CS  : integer := 0;
+	 constant ZX_K_A   : integer := 1;
+	 constant ZX_K_Q   : integer := 2;
+	 constant ZX_K_1   : integer := 3;
+	 constant ZX_K_0   : integer := 4;
+	 constant ZX_K_P   : integer := 5;
+	 constant ZX_K_ENT : integer := 6;
+	 constant ZX_K_SP  : integer := 7;
+	 constant ZX_K_Z   : integer := 8;
+	 constant ZX_K_S   : integer := 9;
+	 constant ZX_K_W   : integer := 10;
+	 constant ZX_K_2   : integer := 11;
+	 constant ZX_K_9   : integer := 12;
+	 constant ZX_K_O   : integer := 13;
+	 constant ZX_K_L   : integer := 14;
+	 constant ZX_K_SS  : integer := 15;
+	 constant ZX_K_X   : integer := 16;
+	 constant ZX_K_D   : integer := 17;
+	 constant ZX_K_E   : integer := 18;
+	 constant ZX_K_3   : integer := 19;
+	 constant ZX_K_8   : integer := 20;
+	 constant ZX_K_I   : integer := 21;
+	 constant ZX_K_K   : integer := 22;
+	 constant ZX_K_M   : integer := 23;
+	 constant ZX_K_C   : integer := 24;
+	 constant ZX_K_F   : integer := 25;
+	 constant ZX_K_R   : integer := 26;
+	 constant ZX_K_4   : integer := 27;
+	 constant ZX_K_7   : integer := 28;
+	 constant ZX_K_U   : integer := 29;
+	 constant ZX_K_J   : integer := 30;
+	 constant ZX_K_N   : integer := 31;
+	 constant ZX_K_V   : integer := 32;
+	 constant ZX_K_G   : integer := 33;
+	 constant ZX_K_T   : integer := 34;
+	 constant ZX_K_5   : integer := 35;
+	 constant ZX_K_6   : integer := 36;
+	 constant ZX_K_Y   : integer := 37;
+	 constant ZX_K_H   : integer := 38;
+	 constant ZX_K_B   : integer := 39;
 
 begin
 
@@ -58,7 +140,7 @@ U_SPI: entity work.spi_slave
         spi_miso_o     => AVR_MISO,
 
         di_req_o       => open,
-        di_i           => x"F000", -- init requrst from fpga
+        di_i           => spi_di,
         wren_i         => '1',
         do_valid_o     => spi_do_valid,
         do_o           => spi_do,
@@ -73,47 +155,396 @@ U_SPI: entity work.spi_slave
 
 		  
 process (CLK, spi_do_valid, spi_do)
+	variable sc_key     : std_logic_vector(8 downto 0);
+	variable sc_make    : std_logic;
+	variable sc_ss_used : boolean;
+	variable sc_m       : std_logic_vector(3 downto 0);
 begin
 	if (rising_edge(CLK)) then
-		if spi_do_valid = '1' then
+		-- apply all the frames received since the last commit in one clock,
+		-- so the host never sees a matrix with a mix of old and new rows
+		if commit = '1' then
+			commit <= '0';
+			dirty <= (others => '0');
+			if dirty(1) = '1' then kb_data(7 downto 0) <= shadow(1); end if;
+			if dirty(2) = '1' then kb_data(15 downto 8) <= shadow(2); end if;
+			if dirty(3) = '1' then kb_data(23 downto 16) <= shadow(3); end if;
+			if dirty(4) = '1' then kb_data(31 downto 24) <= shadow(4); end if;
+			if dirty(5) = '1' then kb_data(39 downto 32) <= shadow(5); end if;
+			if dirty(6) = '1' then
+				reset <= shadow(6)(0);
+				-- turbo <= shadow(6)(1); -- outdated signal, now it's vector
+				magick <= shadow(6)(2);
+				joy(0) <= shadow(6)(7);
+				joy(1) <= shadow(6)(6);
+				joy(2) <= shadow(6)(5);
+				joy(3) <= shadow(6)(4);
+				joy(4) <= shadow(6)(3);
+			end if;
+			if dirty(7) = '1' then
+				bank <= shadow(7)(2 downto 0);
+				bank_valid <= '1';
+				joy(5) <= shadow(7)(3); -- fire2
+				joy(6) <= shadow(7)(4); -- fire3
+				waiting <= shadow(7)(5);
+				turbo <= shadow(7)(7 downto 6);
+			end if;
+			if dirty(8) = '1' then
+				joy(11 downto 7) <= shadow(8)(4 downto 0); -- start, x, y, z, mode
+				auto_turbo <= shadow(8)(5);
+				-- shadow(8)(7 downto 6) -- free pins
+			end if;
+		end if;
+
+		-- do_valid is 2 clocks long, take every frame once (scancodes are not idempotent)
+		spi_do_valid_prev <= spi_do_valid;
+		if spi_do_valid = '1' and spi_do_valid_prev = '0' then
+			-- answer to the next transfer
+			if spi_do(15 downto 8) = X"0A" then
+				echo <= '1';
+				echo_data <= spi_do(7 downto 0);
+			else
+				echo <= '0';
+			end if;
+
 			case spi_do(15 downto 8) is 
-				-- keyboard matrix
-				when X"01" => kb_data(7 downto 0) <= spi_do (7 downto 0);
-				when X"02" => kb_data(15 downto 8) <= spi_do (7 downto 0);
-				when X"03" => kb_data(23 downto 16) <= spi_do (7 downto 0);
-				when X"04" => kb_data(31 downto 24) <= spi_do (7 downto 0);
-				when X"05" => kb_data(39 downto 32) <= spi_do (7 downto 0);	
-				when X"06" => reset <= spi_do(0); 
-								  -- turbo <= spi_do(1); -- outdated signal, now it's vector
-								  magick <= spi_do(2); 
-								  joy(0) <= spi_do(7);
-								  joy(1) <= spi_do(6);
-								  joy(2) <= spi_do(5);
-								  joy(3) <= spi_do(4);
-								  joy(4) <= spi_do(3); 
-				when X"07" => bank <= spi_do(2 downto 0);
-								  joy(5) <= spi_do(3); -- fire2
-								  joy(6) <= spi_do(4); -- fire3
-								  waiting <= spi_do(5);
-								  turbo <= spi_do(7 downto 6);
-				when X"08" => joy(11 downto 7) <= spi_do(4 downto 0); -- start, x, y, z, mode
-							 	  -- spi(7 downto 5) -- free pins
+				-- keyboard matrix and special signals go to the shadow frames,
+				-- the last frame commits them
+				when X"01" | X"02" | X"03" | X"04" | X"05" | X"06" | X"07" =>
+					shadow(to_integer(unsigned(spi_do(11 downto 8)))) <= spi_do(7 downto 0);
+					dirty(to_integer(unsigned(spi_do(11 downto 8)))) <= '1';
+				when X"08" =>
+					shadow(8) <= spi_do(7 downto 0);
+					dirty(8) <= '1';
+					commit <= '1';
 
+				-- explicit commit of a partial update
+				when X"0B" => commit <= '1';
+
+				-- mouse X / Y motion (signed), buttons
+				when X"0C" => mouse_x <= mouse_x + spi_do(7 downto 0);
+				when X"0D" => mouse_y <= mouse_y + spi_do(7 downto 0);
+				when X"0E" => mouse_btn <= spi_do(2 downto 0);
+
+				-- joystick, applied at once without waiting for a matrix commit,
+				-- rows 6..8 carry the same bits on the next full transmit
+				when X"0F" => joy(7 downto 0) <= spi_do(7 downto 0);
+
+				-- raw PS/2 scancode, decoded with the same mapping as fill_kbd_matrix()
+				when X"09" =>
+					if spi_do(7 downto 0) = X"E0" then
+						sc_e <= '1';
+					elsif spi_do(7 downto 0) = X"E1" then
+						sc_e <= '1';
+						sc_e1 <= '1';
+					elsif spi_do(7 downto 0) = X"F0" and sc_up = '0' then
+						sc_up <= '1';
+					else
+						sc_key := sc_e & spi_do(7 downto 0);
+						sc_make := not(sc_up);
+						sc_ss_used := false;
+						sc_m := sc_mods;
+						case to_integer(unsigned(sc_key)) is
+							-- Shift -> CS
+							when 16#012# | 16#059# =>
+								kb_data(ZX_K_CS) <= sc_make;
+								sc_shift <= sc_make;
+							-- Ctrl -> SS
+							when 16#014# | 16#114# =>
+								kb_data(ZX_K_SS) <= sc_make;
+								sc_m(3) := sc_make;
+							-- Alt -> SS+CS
+							when 16#011# =>
+								kb_data(ZX_K_SS) <= sc_make;
+								kb_data(ZX_K_CS) <= sc_make;
+								sc_capsed(0) <= sc_make;
+								sc_m(2) := sc_make;
+							when 16#111# =>
+								kb_data(ZX_K_SS) <= sc_make;
+								kb_data(ZX_K_CS) <= sc_make;
+								sc_capsed(1) <= sc_make;
+								sc_m(2) := sc_make;
+							-- Del -> SS+C
+							when 16#171# =>
+								kb_data(ZX_K_SS) <= sc_make;
+								kb_data(ZX_K_C) <= sc_make;
+								sc_m(1) := sc_make;
+							-- Ins -> SS+A
+							when 16#170# =>
+								kb_data(ZX_K_SS) <= sc_make;
+								kb_data(ZX_K_A) <= sc_make;
+							-- Cursor -> CS + 5,6,7,8
+							when 16#175# =>
+								kb_data(ZX_K_CS) <= sc_make;
+								kb_data(ZX_K_7) <= sc_make;
+								sc_capsed(2) <= sc_make;
+							when 16#172# =>
+								kb_data(ZX_K_CS) <= sc_make;
+								kb_data(ZX_K_6) <= sc_make;
+								sc_capsed(3) <= sc_make;
+							when 16#16B# =>
+								kb_data(ZX_K_CS) <= sc_make;
+								kb_data(ZX_K_5) <= sc_make;
+								sc_capsed(4) <= sc_make;
+							when 16#174# =>
+								kb_data(ZX_K_CS) <= sc_make;
+								kb_data(ZX_K_8) <= sc_make;
+								sc_capsed(5) <= sc_make;
+							-- ESC -> CS+SPACE
+							when 16#076# =>
+								kb_data(ZX_K_CS) <= sc_make;
+								kb_data(ZX_K_SP) <= sc_make;
+								sc_capsed(6) <= sc_make;
+							-- Backspace -> CS+0
+							when 16#066# =>
+								kb_data(ZX_K_CS) <= sc_make;
+								kb_data(ZX_K_0) <= sc_make;
+								sc_capsed(7) <= sc_make;
+								sc_m(0) := sc_make;
+							-- Enter
+							when 16#05A# | 16#15A# =>
+								kb_data(ZX_K_ENT) <= sc_make;
+							-- Space
+							when 16#029# =>
+								kb_data(ZX_K_SP) <= sc_make;
+							-- Letters & numbers
+							when 16#01C# => kb_data(ZX_K_A) <= sc_make;
+							when 16#032# => kb_data(ZX_K_B) <= sc_make;
+							when 16#021# => kb_data(ZX_K_C) <= sc_make;
+							when 16#023# => kb_data(ZX_K_D) <= sc_make;
+							when 16#024# => kb_data(ZX_K_E) <= sc_make;
+							when 16#02B# => kb_data(ZX_K_F) <= sc_make;
+							when 16#034# => kb_data(ZX_K_G) <= sc_make;
+							when 16#033# => kb_data(ZX_K_H) <= sc_make;
+							when 16#043# => kb_data(ZX_K_I) <= sc_make;
+							when 16#03B# => kb_data(ZX_K_J) <= sc_make;
+							when 16#042# => kb_data(ZX_K_K) <= sc_make;
+							when 16#04B# => kb_data(ZX_K_L) <= sc_make;
+							when 16#03A# => kb_data(ZX_K_M) <= sc_make;
+							when 16#031# => kb_data(ZX_K_N) <= sc_make;
+							when 16#044# => kb_data(ZX_K_O) <= sc_make;
+							when 16#04D# => kb_data(ZX_K_P) <= sc_make;
+							when 16#015# => kb_data(ZX_K_Q) <= sc_make;
+							when 16#02D# => kb_data(ZX_K_R) <= sc_make;
+							when 16#01B# => kb_data(ZX_K_S) <= sc_make;
+							when 16#02C# => kb_data(ZX_K_T) <= sc_make;
+							when 16#03C# => kb_data(ZX_K_U) <= sc_make;
+							when 16#02A# => kb_data(ZX_K_V) <= sc_make;
+							when 16#01D# => kb_data(ZX_K_W) <= sc_make;
+							when 16#022# => kb_data(ZX_K_X) <= sc_make;
+							when 16#035# => kb_data(ZX_K_Y) <= sc_make;
+							when 16#01A# => kb_data(ZX_K_Z) <= sc_make;
+							when 16#045# | 16#070# => kb_data(ZX_K_0) <= sc_make;
+							when 16#016# | 16#069# => kb_data(ZX_K_1) <= sc_make;
+							when 16#01E# | 16#072# => kb_data(ZX_K_2) <= sc_make;
+							when 16#026# | 16#07A# => kb_data(ZX_K_3) <= sc_make;
+							when 16#025# | 16#06B# => kb_data(ZX_K_4) <= sc_make;
+							when 16#02E# | 16#073# => kb_data(ZX_K_5) <= sc_make;
+							when 16#036# | 16#074# => kb_data(ZX_K_6) <= sc_make;
+							when 16#03D# | 16#06C# => kb_data(ZX_K_7) <= sc_make;
+							when 16#03E# | 16#075# => kb_data(ZX_K_8) <= sc_make;
+							when 16#046# | 16#07D# => kb_data(ZX_K_9) <= sc_make;
+							-- '/" -> SS+7 / SS+P
+							when 16#052# =>
+								kb_data(ZX_K_SS) <= sc_make;
+								if sc_shift = '1' then
+									kb_data(ZX_K_P) <= sc_make;
+								else
+									kb_data(ZX_K_7) <= sc_make;
+								end if;
+								if sc_make = '0' then
+									kb_data(ZX_K_P) <= '0';
+									kb_data(ZX_K_7) <= '0';
+								end if;
+								sc_ss_used := sc_shift = '1';
+							-- ,/< -> SS+N / SS+R
+							when 16#041# =>
+								kb_data(ZX_K_SS) <= sc_make;
+								if sc_shift = '1' then
+									kb_data(ZX_K_R) <= sc_make;
+								else
+									kb_data(ZX_K_N) <= sc_make;
+								end if;
+								if sc_make = '0' then
+									kb_data(ZX_K_R) <= '0';
+									kb_data(ZX_K_N) <= '0';
+								end if;
+								sc_ss_used := sc_shift = '1';
+							-- ./> -> SS+M / SS+T
+							when 16#049# | 16#071# =>
+								kb_data(ZX_K_SS) <= sc_make;
+								if sc_shift = '1' then
+									kb_data(ZX_K_T) <= sc_make;
+								else
+									kb_data(ZX_K_M) <= sc_make;
+								end if;
+								if sc_make = '0' then
+									kb_data(ZX_K_T) <= '0';
+									kb_data(ZX_K_M) <= '0';
+								end if;
+								sc_ss_used := sc_shift = '1';
+							-- ;/: -> SS+O / SS+Z
+							when 16#04C# =>
+								kb_data(ZX_K_SS) <= sc_make;
+								if sc_shift = '1' then
+									kb_data(ZX_K_Z) <= sc_make;
+								else
+									kb_data(ZX_K_O) <= sc_make;
+								end if;
+								if sc_make = '0' then
+									kb_data(ZX_K_Z) <= '0';
+									kb_data(ZX_K_O) <= '0';
+								end if;
+								sc_ss_used := sc_shift = '1';
+							-- /,? -> SS+V / SS+C
+							when 16#04A# | 16#14A# =>
+								kb_data(ZX_K_SS) <= sc_make;
+								if sc_shift = '1' then
+									kb_data(ZX_K_C) <= sc_make;
+								else
+									kb_data(ZX_K_V) <= sc_make;
+								end if;
+								if sc_make = '0' then
+									kb_data(ZX_K_C) <= '0';
+									kb_data(ZX_K_V) <= '0';
+								end if;
+								sc_ss_used := sc_shift = '1';
+							-- =,+ -> SS+L / SS+K
+							when 16#055# =>
+								kb_data(ZX_K_SS) <= sc_make;
+								if sc_shift = '1' then
+									kb_data(ZX_K_K) <= sc_make;
+								else
+									kb_data(ZX_K_L) <= sc_make;
+								end if;
+								if sc_make = '0' then
+									kb_data(ZX_K_K) <= '0';
+									kb_data(ZX_K_L) <= '0';
+								end if;
+								sc_ss_used := sc_shift = '1';
+							-- -,_ -> SS+J / SS+0
+							when 16#04E# =>
+								kb_data(ZX_K_SS) <= sc_make;
+								if sc_shift = '1' then
+									kb_data(ZX_K_0) <= sc_make;
+								else
+									kb_data(ZX_K_J) <= sc_make;
+								end if;
+								if sc_make = '0' then
+									kb_data(ZX_K_0) <= '0';
+									kb_data(ZX_K_J) <= '0';
+								end if;
+								sc_ss_used := sc_shift = '1';
+							-- ` -> SS+X (~ is typed by the AVR macro)
+							when 16#00E# =>
+								if sc_shift = '0' then
+									kb_data(ZX_K_SS) <= sc_make;
+									kb_data(ZX_K_X) <= sc_make;
+								end if;
+							-- Keypad * -> SS+B
+							when 16#07C# =>
+								kb_data(ZX_K_SS) <= sc_make;
+								kb_data(ZX_K_B) <= sc_make;
+							-- Keypad - -> SS+J
+							when 16#07B# =>
+								kb_data(ZX_K_SS) <= sc_make;
+								kb_data(ZX_K_J) <= sc_make;
+							-- Keypad + -> SS+K
+							when 16#079# =>
+								kb_data(ZX_K_SS) <= sc_make;
+								kb_data(ZX_K_K) <= sc_make;
+							-- Tab -> CS+I
+							when 16#00D# =>
+								kb_data(ZX_K_CS) <= sc_make;
+								kb_data(ZX_K_I) <= sc_make;
+								sc_capsed(8) <= sc_make;
+							-- CapsLock -> SS+CS
+							when 16#058# =>
+								kb_data(ZX_K_SS) <= sc_make;
+								kb_data(ZX_K_CS) <= sc_make;
+								sc_capsed(9) <= sc_make;
+							-- PgUp -> CS+3
+							when 16#17D# =>
+								kb_data(ZX_K_CS) <= sc_make;
+								kb_data(ZX_K_3) <= sc_make;
+								sc_capsed(10) <= sc_make;
+							-- PgDn -> CS+4
+							when 16#17A# =>
+								kb_data(ZX_K_CS) <= sc_make;
+								kb_data(ZX_K_4) <= sc_make;
+								sc_capsed(11) <= sc_make;
+							-- F11 (reset is done by the AVR) drops modifiers
+							when 16#078# =>
+								if sc_make = '0' then
+									sc_shift <= '0';
+									sc_capsed <= (others => '0');
+									sc_m(3 downto 1) := "000";
+								end if;
+							-- system keys and macros are still handled by the AVR
+							when others => null;
+						end case;
+						if sc_ss_used and sc_capsed = "000000000000" then
+							kb_data(ZX_K_CS) <= '0';
+						end if;
+						-- Ctrl+Alt+Del (reset) and Ctrl+Alt+Bksp (reinit) are done by the AVR,
+						-- the modifiers are dropped here the same way
+						if sc_m(3) = '1' and sc_m(2) = '1' and sc_m(1) = '1' then
+							sc_shift <= '0';
+							sc_capsed <= (others => '0');
+							sc_m(3 downto 1) := "000";
+						end if;
+						if sc_m(3) = '1' and sc_m(2) = '1' and sc_m(0) = '1' then
+							sc_shift <= '0';
+							sc_capsed <= (others => '0');
+							sc_m(3 downto 2) := "00";
+							sc_m(0) := '0';
+						end if;
+						sc_mods <= sc_m;
+						-- clear flags
+						sc_up <= '0';
+						if sc_e1 = '1' then
+							sc_e1 <= '0';
+						else
+							sc_e <= '0';
+						end if;
+					end if;
+				
 				when others => null;
 			end case;
 		end if;
 	end if;
 end process;
 
-process (CLK, magick, waiting, turbo, joy, bank, reset)
+-- init request with status or loopback echo
+spi_di <= echo_data & not(echo_data) when echo = '1' else X"F0" & status;
+status <= "000000" & reset_cnt(RESET_ACK_BIT) & not(I_READY);
+
+-- how long the reset is held, the AVR keeps the reset pulse until it is acknowledged
+process (CLK, reset, reset_cnt)
+begin
+	if (rising_edge(CLK)) then
+		if reset = '0' then
+			reset_cnt <= (others => '0');
+		elsif reset_cnt(RESET_ACK_BIT) = '0' then
+			reset_cnt <= reset_cnt + 1;
+		end if;
+	end if;
+end process;
+
+process (CLK, magick, waiting, turbo, auto_turbo, joy, bank, bank_valid, reset, mouse_x, mouse_y, mouse_btn)
 begin
 	if (rising_edge(CLK)) then 
 		O_MAGICK <= not(magick);
 		O_WAIT <= not(waiting);
 		O_TURBO <= turbo;
+		O_AUTO_TURBO <= auto_turbo;
 		O_JOY <= not(joy(7 downto 0));
 		O_BANK <= bank;
+		O_BANK_VALID <= bank_valid;
 		O_RESET <= not(reset);
+		O_MOUSE_X <= mouse_x;
+		O_MOUSE_Y <= mouse_y;
+		O_MOUSE_BTN <= "11111" & not(mouse_btn(2)) & not(mouse_btn(0)) & not(mouse_btn(1)); -- middle, left, right
 	end if;
 end process;
 
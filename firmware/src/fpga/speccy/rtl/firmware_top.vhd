@@ -12,7 +12,9 @@ use IEEE.numeric_std.all;
 entity firmware_top is
 	generic(
 		use_turbosound : boolean := false;
-		use_psram : boolean := false
+		use_psram : boolean := false;
+		vga_line_lock : boolean := true; -- scandoubler outputs the second line of a pair from the line being written
+		auto_turbo_speed : std_logic_vector(1 downto 0) := "10" -- cpu speed of the dos code with auto turbo on, 14 MHz
 	);
 	port(
 		-- Clock
@@ -159,16 +161,36 @@ architecture rtl of firmware_top is
 	signal zc_sd_cs_n: std_logic;
 	signal zc_sd_di: std_logic;
 	signal zc_sd_clk: std_logic;
+
+	signal dma_act 	: std_logic := '0';
+	signal dma_do_bus	: std_logic_vector(7 downto 0);
+	signal dma_ram_a 	: std_logic_vector(20 downto 0);
+	signal dma_ram_do : std_logic_vector(7 downto 0);
+	signal dma_ram_wr : std_logic;
+	signal dma_sd_clk : std_logic;
+	signal dma_wait_n : std_logic := '1';
+
+	signal update_do_bus : std_logic_vector(7 downto 0);
+	signal update_ram_a : std_logic_vector(20 downto 0);
+	signal update_ram_rd : std_logic;
+	signal update_wait_n : std_logic := '1';
+	signal update_changed : std_logic_vector(7 downto 0);
 	
 	signal trdos	: std_logic :='1';
 	
 	signal kb : std_logic_vector(4 downto 0) := "11111";
 	signal joy : std_logic_vector(7 downto 0) := "00000000";
+	signal mouse_x : std_logic_vector(7 downto 0);
+	signal mouse_y : std_logic_vector(7 downto 0);
+	signal mouse_btn : std_logic_vector(7 downto 0);
 	signal nmi : std_logic;
 	signal areset : std_logic;
 	signal locked : std_logic;
 	signal reset : std_logic;
-	signal turbo : std_logic_vector(1 downto 0) := "00";
+	signal turbo : std_logic_vector(1 downto 0) := "00"; -- cpu speed
+	signal kb_turbo : std_logic_vector(1 downto 0) := "00"; -- speed selected by the user
+	signal auto_turbo : std_logic := '0';
+	signal dos_act : std_logic := '0';
 	
 	signal vga_red: std_logic_vector(1 downto 0);
 	signal vga_green: std_logic_vector(1 downto 0);
@@ -193,6 +215,7 @@ architecture rtl of firmware_top is
 	signal loader_flash_do : std_logic_vector(7 downto 0);
 	signal loader_flash_a : std_logic_vector(23 downto 0);
 	signal loader_flash_rd_n : std_logic;
+	signal loader_flash_stream : std_logic;
 	signal loader_flash_wr_n : std_logic;
 	signal loader_flash_busy : std_logic;
 	signal loader_flash_rdy : std_logic;
@@ -204,9 +227,13 @@ architecture rtl of firmware_top is
 	signal flash_wr_n : std_logic := '1';
 	signal flash_rd_n : std_logic := '1';
 	signal flash_er_n : std_logic := '1';
+	signal flash_stream : std_logic := '0';
 	signal flash_busy : std_logic := '1';
 	signal flash_rdy : std_logic := '0';
 	signal fw_update_mode : std_logic := '0';
+	signal update_reset : std_logic := '0'; -- a keyboard reset came during a rom bank update
+	signal update_reset_cnt : std_logic_vector(19 downto 0) := (others => '0');
+	signal host_reset : std_logic;
 	
 	-- SPI flash / SD
 	signal flash_ncs 		: std_logic;
@@ -220,8 +247,10 @@ architecture rtl of firmware_top is
 	signal host_flash_rd_n : std_logic := '1';
 	signal host_flash_wr_n : std_logic := '1';
 	signal host_flash_er_n : std_logic := '1';
+	signal host_flash_stream : std_logic := '0';
 	
 	signal ext_rombank : std_logic_vector(2 downto 0) := "000";
+	signal ext_rombank_valid : std_logic := '0';
 	
 	signal audio_l		: std_logic_vector(15 downto 0);
 	signal audio_r		: std_logic_vector(15 downto 0);
@@ -253,6 +282,10 @@ architecture rtl of firmware_top is
 	signal ram_do_bus : std_logic_vector(7 downto 0);
 	signal ram_rd_n 	: std_logic := '1';
 	signal ram_wr_n 	: std_logic := '1';
+	signal ram_busy 	: std_logic := '0';
+	signal ram_wait_n : std_logic := '1';
+	signal kb_wait_n 	: std_logic := '1';
+	signal mem_wait_n : std_logic := '1';
 	
 	component saa1099
 	port (
@@ -285,6 +318,7 @@ begin
 		CLK2X => CLK_28,
 		CLKX => CLK_14,
 		CLK_CPU  => clkcpu,
+		TURBO => turbo,
 		
 		enable_divmmc => divmmc_enable,
 		enable_zcontroller => zc_enable,
@@ -294,6 +328,17 @@ begin
 		loader_ram_a 	=> loader_ram_a,
 		loader_ram_do 	=> loader_ram_do,
 		loader_ram_wr 	=> loader_ram_wr,
+
+		-- sd dma signals
+		dma_act 			=> dma_act,
+		dma_ram_a 		=> dma_ram_a,
+		dma_ram_do 		=> dma_ram_do,
+		dma_ram_wr 		=> dma_ram_wr,
+
+		-- rom bank update signals
+		update_act 		=> fw_update_mode,
+		update_ram_a 	=> update_ram_a,
+		update_ram_rd 	=> update_ram_rd,
 		
 		-- cpu signals
 		A => A,
@@ -307,6 +352,7 @@ begin
 		-- ram 
 		MA => ram_a_bus,
 		MDI => ram_di_bus,
+		MDI_WAIT_N => ram_wait_n,
 		MDO => ram_do_bus,
 		N_MRD => ram_rd_n,
 		N_MWR => ram_wr_n,
@@ -314,6 +360,7 @@ begin
 		-- ram out to cpu
 		DO => ram_do,
 		N_OE => ram_oe_n,
+		N_WAIT => mem_wait_n,
 		
 		-- ram pages
 		RAM_BANK => port_7ffd(2 downto 0),
@@ -345,10 +392,13 @@ begin
 		CLK_BUS  => CLK_28,
 		
 		A => ram_a_bus,
-		DI => ram_di_bus,
-		DO => ram_do_bus,
+		DI => ram_do_bus,
+		DO => ram_di_bus,
 		N_RD => ram_rd_n,
 		N_WR => ram_wr_n,
+		N_MREQ => N_MREQ,
+		N_WAIT => ram_wait_n,
+		BUSY => ram_busy,
 		
 		SPI_SCLK => MA(10),
 		SPI_N_CS => MA(19),
@@ -366,6 +416,8 @@ begin
 		ram_di_bus <= MD;
 		N_MWR <= ram_wr_n;
 		N_MRD <= ram_rd_n;
+		ram_wait_n <= '1';
+		ram_busy <= '0';
 	end generate G_PRAM;
 	
 	-- divmmc interface
@@ -401,7 +453,7 @@ begin
 	U4: entity work.zcontroller 
 	port map(
 		RESET => not(N_RESET),
-		CLK => clkcpu,
+		CLK => CLK_28,
 		A => A(5),
 		DI => D,
 		DO => zc_do_bus,
@@ -415,10 +467,61 @@ begin
 		MISO => DATA0
 	);
 
+	-- SD to RAM DMA
+	U16: entity work.sd_dma
+	port map(
+		CLK => CLK_28,
+		RESET => not(N_RESET),
+		A => A,
+		DI => D,
+		DO => dma_do_bus,
+		N_IORQ => N_IORQ,
+		N_WR => N_WR,
+		N_M1 => N_M1,
+		N_WAIT => dma_wait_n,
+		DMA_ACTIVE => dma_act,
+		RAM_A => dma_ram_a,
+		RAM_DO => dma_ram_do,
+		RAM_WR => dma_ram_wr,
+		RAM_BUSY => ram_busy,
+		SCLK => dma_sd_clk,
+		MISO => DATA0
+	);
+
+	-- rom bank update in the spi flash
+	U17: entity work.flash_update
+	port map(
+		CLK => CLK_28,
+		RESET => areset, -- a started erase / program always runs to its end
+		A => A,
+		DI => D,
+		DO => update_do_bus,
+		N_IORQ => N_IORQ,
+		N_WR => N_WR,
+		N_M1 => N_M1,
+		N_WAIT => update_wait_n,
+		UPDATE_ACTIVE => fw_update_mode,
+		RAM_A => update_ram_a,
+		RAM_DI => ram_do,
+		RAM_RD => update_ram_rd,
+		RAM_WAIT_N => ram_wait_n,
+		FLASH_A => host_flash_a_bus,
+		FLASH_DI => host_flash_di_bus,
+		FLASH_DO => flash_do_bus,
+		FLASH_WR_N => host_flash_wr_n,
+		FLASH_RD_N => host_flash_rd_n,
+		FLASH_ER_N => host_flash_er_n,
+		FLASH_STREAM => host_flash_stream,
+		FLASH_BUSY => flash_busy,
+		FLASH_READY => flash_rdy,
+		BANK_CHANGED => update_changed
+	);
+
 	-- keyboard
 	U5: entity work.cpld_kbd 
 	port map (
 		CLK => CLK_28,
+		I_READY => not(loader_act),
 		A => A(15 downto 8),
 		KB => kb,
 		AVR_SCK => AVR_SCK,
@@ -427,11 +530,16 @@ begin
 		AVR_SS => AVR_NCS,
 		
 		O_RESET => reset,
-		O_TURBO => turbo,
+		O_TURBO => kb_turbo,
+		O_AUTO_TURBO => auto_turbo,
 		O_MAGICK => nmi,
 		O_JOY => joy,
 		O_BANK => ext_rombank,
-		O_WAIT => N_WAIT
+		O_BANK_VALID => ext_rombank_valid,
+		O_WAIT => kb_wait_n,
+		O_MOUSE_X => mouse_x,
+		O_MOUSE_Y => mouse_y,
+		O_MOUSE_BTN => mouse_btn
 	);
 	
 	-- video module
@@ -467,6 +575,9 @@ begin
 	
 	-- Scandoubler	
 	U7: entity work.vga_pal 
+	generic map (
+		line_lock 		=> vga_line_lock
+	)
 	port map (
 		RGB_IN 			=> video_r(0) & video_r(1) & video_g(0) & video_g(1) & video_b(0) & video_b(1),
 		KSI_IN 			=> vsync,
@@ -479,7 +590,8 @@ begin
 		RGB_O(3 downto 2)	=> VGA_G,
 		RGB_O(1 downto 0)	=> VGA_B,
 		VSYNC_VGA		=> VGA_VSYNC,
-		HSYNC_VGA		=> VGA_HSYNC
+		HSYNC_VGA		=> VGA_HSYNC,
+		LATENCY 			=> open
 	);	
 	
 	-- osd (debug)
@@ -494,7 +606,7 @@ begin
 --		BLINK 			=> blink,
 --		
 --		-- sensors
---		TURBO 			=> kb_turbo,
+--		TURBO 			=> turbo,
 --		SCANDOUBLER_EN => vid_scandoubler_enable,
 --		MODE60 			=> soft_sw(2),
 --		ROM_BANK 		=> ext_rom_bank,
@@ -516,6 +628,7 @@ port map(
 	WR_N 				=> flash_wr_n,
 	RD_N 				=> flash_rd_n,
 	ER_N 				=> flash_er_n,
+	STREAM 			=> flash_stream,
 
 	DATA0				=> DATA0,
 	NCSO				=> flash_ncs,
@@ -531,14 +644,21 @@ U10: entity work.loader
 port map(
 	CLK 				=> clk_28,
 	RESET 			=> areset,
+	BANK 				=> ext_rombank,
+	BANK_VALID 		=> ext_rombank_valid,
+	INVALIDATE 		=> update_changed,
+	UPDATE_ACTIVE 	=> fw_update_mode,
+	HOST_RESET 		=> host_reset,
 	
 	RAM_A 			=> loader_ram_a,
 	RAM_DO 			=> loader_ram_do,
 	RAM_WR 			=> loader_ram_wr,
+	RAM_BUSY 		=> ram_busy,
 	
 	FLASH_A 			=> loader_flash_a,
 	FLASH_DO 		=> flash_do_bus,
 	FLASH_RD_N 		=> loader_flash_rd_n,	
+	FLASH_STREAM 	=> loader_flash_stream,
 	FLASH_BUSY 		=> flash_busy,
 	FLASH_READY 	=> flash_rdy,
 	
@@ -623,22 +743,23 @@ port map (
 	
 -- --------------------------------------------------------------------------------------------------------------------------------
 
-SD_NCS	<= '1' when loader_act = '1' else divmmc_sd_cs_n 	when divmmc_enable = '1' else zc_sd_cs_n 		when zc_enable = '1' else '1';
-sd_clk 	<= '1' when loader_act = '1' else divmmc_sd_clk 	when divmmc_enable = '1' else zc_sd_clk	 	when zc_enable = '1' else '1';
-sd_si 	<= '1' when loader_act = '1' else divmmc_sd_di 		when divmmc_enable = '1' else zc_sd_di 		when zc_enable = '1' else '1';
+SD_NCS	<= '1' when loader_act = '1' or fw_update_mode = '1' else divmmc_sd_cs_n 	when divmmc_enable = '1' else zc_sd_cs_n 		when zc_enable = '1' else '1';
+sd_clk 	<= '1' when loader_act = '1' else dma_sd_clk when dma_act = '1' else divmmc_sd_clk 	when divmmc_enable = '1' else zc_sd_clk	 	when zc_enable = '1' else '1';
+sd_si 	<= '1' when loader_act = '1' or dma_act = '1' else divmmc_sd_di 		when divmmc_enable = '1' else zc_sd_di 		when zc_enable = '1' else '1';
 
 -- share SPI between flash and SD
-DCLK <= flash_clk when loader_act = '1' else sd_clk;
-ASDO <= flash_do when loader_act = '1' else sd_si;
-NCSO <= flash_ncs when loader_act = '1' else '1';
+DCLK <= flash_clk when loader_act = '1' or fw_update_mode = '1' else sd_clk;
+ASDO <= flash_do when loader_act = '1' or fw_update_mode = '1' else sd_si;
+NCSO <= flash_ncs when loader_act = '1' or fw_update_mode = '1' else '1';
 SD_DI <= sd_si;
 
 -- share flash between loader and host
-flash_a_bus <= loader_flash_a;
-flash_di_bus <= "00000000";
-flash_wr_n <= '1'; -- write
-flash_rd_n <= loader_flash_rd_n when loader_act = '1' else '1';
-flash_er_n <= '1'; -- erase
+flash_a_bus <= host_flash_a_bus when fw_update_mode = '1' else loader_flash_a;
+flash_di_bus <= host_flash_di_bus;
+flash_wr_n <= host_flash_wr_n when fw_update_mode = '1' else '1'; -- write
+flash_rd_n <= loader_flash_rd_n when loader_act = '1' else host_flash_rd_n when fw_update_mode = '1' else '1';
+flash_er_n <= host_flash_er_n when fw_update_mode = '1' else '1'; -- erase
+flash_stream <= loader_flash_stream when loader_act = '1' else host_flash_stream when fw_update_mode = '1' else '0';
 
 divmmc_rom <= '1' when (divmmc_disable_zxrom = '1' and divmmc_eeprom_cs_n = '0' and divmmc_enable = '1') else '0';
 divmmc_ram <= '1' when (divmmc_disable_zxrom = '1' and divmmc_sram_cs_n = '0' and divmmc_enable = '1') else '0';
@@ -648,8 +769,30 @@ AY_BC1 <= '1' when ay_port = '1' and A(14) = '1' and N_IORQ = '0' and (N_WR='0'
 AY_BDIR <= '1' when ay_port = '1' and N_IORQ = '0' and N_WR = '0' else '0';
 
 N_NMI <= '0' when nmi = '0' else '1';
+-- the psram wait comes through memory, which drops it on a rom cache hit
+N_WAIT <= '0' when kb_wait_n = '0' or mem_wait_n = '0' or dma_wait_n = '0' or update_wait_n = '0' else '1';
 areset <= not locked;
-N_RESET <= '0' when areset = '1' or reset = '0' or loader_reset = '1' or loader_act = '1' else 'Z';
+-- a reset from the keyboard during a rom bank update is kept and given when the update ends
+N_RESET <= '0' when areset = '1' or host_reset = '1' or loader_reset = '1' or loader_act = '1' else 'Z';
+host_reset <= '1' when (reset = '0' and fw_update_mode = '0') or update_reset = '1' else '0';
+
+process (clk_28)
+begin
+	if clk_28'event and clk_28 = '1' then
+		if fw_update_mode = '1' then
+			update_reset_cnt <= (others => '0');
+			if reset = '0' then
+				update_reset <= '1';
+			end if;
+		elsif update_reset = '1' then
+			-- as long as cpld_kbd holds a reset before it acknowledges it (~19 ms)
+			update_reset_cnt <= update_reset_cnt + 1;
+			if update_reset_cnt(19) = '1' then
+				update_reset <= '0';
+			end if;
+		end if;
+	end if;
+end process;
 
 --N_NMI <= '0' when nmi = '0' else '1';
 --N_RESET <= '0' when reset = '0' else 'Z';
@@ -680,8 +823,24 @@ ena_div8 <= ena_cnt(2) and ena_cnt(1) and ena_cnt(0);
 ena_div16 <= ena_cnt(3) and ena_cnt(2) and ena_cnt(1) and ena_cnt(0);
 ena_div32 <= ena_cnt(5) and ena_cnt(4) and ena_cnt(3) and ena_cnt(2) and ena_cnt(1) and ena_cnt(0);
 
+-- auto turbo: TR-DOS and divMMC code run at auto_turbo_speed, the user speed is back on return.
+-- The speed changes while clk_28 is low, so clkcpu never gets a runt pulse.
+dos_act <= '1' when (trdos = '1' and zc_enable = '1') or (divmmc_disable_zxrom = '1' and divmmc_enable = '1') else '0';
+
+process (clk_28)
+begin
+	if clk_28'event and clk_28 = '0' then
+		if auto_turbo = '1' and dos_act = '1' and kb_turbo < auto_turbo_speed then
+			turbo <= auto_turbo_speed;
+		else
+			turbo <= kb_turbo;
+		end if;
+	end if;
+end process;
+
 -- CPU clock 
-clkcpu <= clk_28 and ena_div2 when turbo = "10" else -- 14
+clkcpu <= clk_28 when turbo = "11" else -- 28, memory.vhd adds wait states
+			 clk_28 and ena_div2 when turbo = "10" else -- 14
 			 clk_28 and ena_div4 when turbo = "01" else -- 7
 			 clk_28 and ena_div8; -- 3.5
 CPU_CLK <= clkcpu;
@@ -696,8 +855,13 @@ D(7 downto 0) <=
 	"00000" & ram_ext when port_read = '1' and A = X"DFFD" and ram_ext_std = "10" else  -- #DFFD - system port 
 	'1' & TAPE_IN & '1' & kb(4 downto 0) when port_read = '1' and A(0) = '0' else -- #FE - keyboard 
 	joy when port_read = '1' and A(7 downto 0) = X"1F" else -- #1F - kempston joy
+	mouse_x when port_read = '1' and A(7 downto 0) = X"DF" and A(10 downto 8) = "011" else -- #FBDF - kempston mouse X
+	mouse_y when port_read = '1' and A(7 downto 0) = X"DF" and A(10 downto 8) = "111" else -- #FFDF - kempston mouse Y
+	mouse_btn when port_read = '1' and A(7 downto 0) = X"DF" and A(8) = '0' else -- #FADF - kempston mouse buttons
 	divmmc_do when divmmc_wr = '1' and divmmc_enable = '1' else 									 -- divMMC	
 	zc_do_bus when port_read = '1' and A(7 downto 6) = "01" and A(4 downto 0) = "10111" and zc_enable = '1' else -- Z-controller
+	dma_do_bus when port_read = '1' and A(7 downto 0) = X"AB" and A(15 downto 10) = "000000" else -- #00AB..#03AB - sd dma
+	update_do_bus when port_read = '1' and A(7 downto 0) = X"AB" and A(15 downto 10) = "000001" else -- #04AB..#07AB - rom bank update
 	ssg0_do_bus when use_turbosound and port_read = '1' and A = X"FFFD" and ssg_sel = '0' else -- Turbosound 	
 	ssg1_do_bus when use_turbosound and port_read = '1' and A = X"FFFD" and ssg_sel = '1' else
 	attr_r when port_read = '1' and A(7 downto 0) = x"FF" else -- #FF - attributes
@@ -23,7 +23,9 @@ generic (
 	SPI_CMD_STATUSREG   : std_logic_vector(7 downto 0) := X"05"; -- W25Q16 read status register command
 	SPI_CMD_WRITE_EN 	  : std_logic_vector(7 downto 0) := X"06"; -- W25Q16 write enable command
 	SPI_CMD_BLOCK_ERASE : std_logic_vector(7 downto 0) := X"D8"; -- W25Q16 64k block erase command
-	SPI_CMD_POWERON 	  : std_logic_vector(7 downto 0) := X"AB" -- W25Q16 power on command
+	SPI_CMD_POWERON 	  : std_logic_vector(7 downto 0) := X"AB"; -- W25Q16 power on command
+	SPI_CMD_STREAM 	  : std_logic_vector(7 downto 0) := X"03"; -- streaming read command, X"0B" for fast read
+	STREAM_DUMMY 		  : integer := 0 -- dummy bytes after the address: 0 for X"03", 1 for X"0B"
 );
 port (
 	-- bus clock 28 MHz
@@ -39,6 +41,8 @@ port (
 	WR_N				: in std_logic := '1';
 	RD_N				: in std_logic := '1';
 	ER_N 				: in std_logic := '1';
+	STREAM 			: in std_logic := '0'; -- RD_N starts a continuous read from A until RD_N is released,
+														-- WR_N a page program from A taking DI bytes until WR_N is released
 	
 	-- SPI FLASH physical interface (M25P16)
 	DATA0				: in std_logic;
@@ -48,7 +52,8 @@ port (
 
 	-- status
 	BUSY 				: out std_logic;
-	DATA_READY 		: out std_logic
+	DATA_READY 		: out std_logic -- level after a single read, a pulse per byte while streaming,
+												-- a pulse per DI byte taken during a page program
 );
 end flash;
 
@@ -77,10 +82,14 @@ type machine IS( --state machine datatype
 	init, 
 	idle, 
 	cmd_read, 	 
+	cmd_stream,
+	cmd_stream_stop,
 	cmd_wp_off, 
 	cmd_write_en,
 	cmd_erase_block,
 	cmd_write, 
+	cmd_write_page,
+	cmd_write_page_stop,
 	cmd_check_status, 
 	cmd_write_dis, 
 	cmd_wp_on
@@ -170,11 +179,17 @@ begin
 				prev_rd_n <= RD_N;
 				prev_er_n <= ER_N;
 				
-				if (RD_N = '0') then 
+				if (RD_N = '0' and STREAM = '1') then 
+					state <= cmd_stream;
+				elsif (RD_N = '0') then 
 					state <= cmd_read;
 				elsif (WR_N = '0' and prev_wr_n = '1') then 
 					state <= cmd_write_en;
-					next_state <= cmd_write;
+					if (STREAM = '1') then 
+						next_state <= cmd_write_page;
+					else
+						next_state <= cmd_write;
+					end if;
 				elsif (ER_N = '0' and prev_er_n = '1') then
 					state <= cmd_write_en;
 					next_state <= cmd_erase_block;
@@ -213,6 +228,49 @@ begin
 					when others => null;						
 				end case;
 				
+			when cmd_stream => -- one read command, then a byte every 8 spi clocks
+				is_busy <= '1';
+				is_ready <= '0';
+				spi_busy_prev <= spi_busy;
+				if (spi_busy_prev = '1' and spi_busy = '0') then 
+					if (count <= STREAM_DUMMY + 4) then 
+						count := count + 1; -- command, address and dummy bytes
+					end if;
+					if (count > STREAM_DUMMY + 4) then 
+						DO <= spi_do_bus;
+						is_ready <= '1';
+					end if;
+				end if;
+				case count is 
+					when 0 => 
+						if (spi_busy = '0') then 
+							spi_cont <= '1';
+							spi_ena <= '1';
+							spi_di_bus <= SPI_CMD_STREAM;
+						else
+							spi_di_bus <= A(23 downto 16);
+						end if;
+					when 1 => 
+						spi_ena <= '0';
+						spi_di_bus <= A(15 downto 8);
+					when 2 => 
+						spi_di_bus <= A(7 downto 0);
+					when others => 
+						spi_di_bus <= "00000000";
+				end case;
+				if (RD_N = '1') then 
+					spi_cont <= '0'; -- finish with the current byte
+					state <= cmd_stream_stop;
+				end if;
+
+			when cmd_stream_stop => 
+				is_ready <= '0';
+				spi_ena <= '0';
+				if (spi_busy = '0' and spi_ss_n(0) = '1') then 
+					count := 0;
+					state <= idle;
+				end if;
+
 			when cmd_write_en => -- write enable
 				is_busy <= '1';
 				is_ready <= '0';
@@ -291,6 +349,49 @@ begin
 					when others => null;						
 				end case;
 				
+			when cmd_write_page => -- page program command, then a DI byte every 8 spi clocks
+				is_ready <= '0';
+				spi_busy_prev <= spi_busy;
+				if (spi_busy_prev = '1' and spi_busy = '0') then 
+					if (count <= 3) then 
+						count := count + 1; -- command and address bytes
+					end if;
+					if (count > 3) then 
+						is_ready <= '1'; -- DI is in the shifter, the next byte can be set
+					end if;
+				end if;
+				case count is 
+					when 0 => 
+						if (spi_busy = '0') then 
+							spi_cont <= '1';
+							spi_ena <= '1';
+							spi_di_bus <= SPI_CMD_PAGEPRG;
+						else
+							spi_di_bus <= A(23 downto 16);
+						end if;
+					when 1 => 
+						spi_ena <= '0';
+						spi_di_bus <= A(15 downto 8);
+					when 2 => 
+						spi_di_bus <= A(7 downto 0);
+					when others => 
+						spi_di_bus <= DI;
+				end case;
+				-- the page wraps at 256 bytes, the host stops at the page end
+				if (WR_N = '1') then 
+					spi_cont <= '0'; -- finish with the current byte
+					state <= cmd_write_page_stop;
+				end if;
+
+			when cmd_write_page_stop => 
+				is_ready <= '0';
+				spi_ena <= '0';
+				if (spi_busy = '0' and spi_ss_n(0) = '1') then 
+					count := 0;
+					state <= cmd_check_status;
+					next_state <= cmd_write_dis;
+				end if;
+
 			when cmd_check_status => -- check status (after write or erase)
 				spi_busy_prev <= spi_busy;
 				if (spi_busy_prev = '1' and spi_busy = '0') then 
@@ -0,0 +1,307 @@
+-------------------------------------------------------------------------------
+-- ROM bank update
+--
+-- Writes one 64K ROM bank of the SPI flash (FLASH_ADDR_START + n * 64K, the
+-- area the loader reads the banks from) from RAM, without touching the FPGA
+-- bitstream: a 64K block erase, 256 page programs and a verify pass.
+-- The page program streams RAM bytes to the flash in one command per page,
+-- a byte the RAM can not deliver in time (psram miss) ends the burst and the
+-- page continues with a new command from that byte.
+-- The CPU is held with WAIT while the update owns the flash and the RAM bus:
+-- the OUT to #07AB which starts it blocks until the update has ended (the
+-- erase alone takes up to 2 s), there is no busy bit to poll.
+-- An update always runs to its end: RESET is the power on reset only, and
+-- while UPDATE_ACTIVE=1 the loader starts no bank load, a keyboard reset is
+-- kept by firmware_top and given when the update ends.
+--
+-- Ports:
+-- #04AB 	RAM address bits 7..0
+-- #05AB 	RAM address bits 15..8
+-- #06AB 	RAM address bits 20..16 (physical, 16K page N starts at N * #4000)
+-- #07AB 	Write: bit 7 = erase, bit 6 = program, bit 5 = verify, bits 2..0 = bank,
+--       	       the set operations run in this order, #E0 + bank is a full update
+--       	Read:  bit 7 = busy (always 0 for the CPU, it only runs again after the
+--       	       update), bit 6 = verify error of the last update
+-- The RAM address is not changed by the update.
+-- At the end BANK_CHANGED pulses for an erased or programmed bank, the loader
+-- then reloads it from the flash when it is selected, the running bank on the
+-- next reset.
+-------------------------------------------------------------------------------
+
+library IEEE;
+use IEEE.std_logic_1164.all;
+use IEEE.std_logic_unsigned.all;
+
+entity flash_update is
+generic (
+	FLASH_ADDR_START	: std_logic_vector(23 downto 0) := "000100000000000000000000"; -- 0x100000, same as the loader
+	BYTE_DEADLINE 		: integer := 8 -- clocks from a taken byte to the next one, the flash takes it 14 clocks later
+);
+port (
+	CLK 				: in std_logic; -- 28 MHz
+	RESET 			: in std_logic;
+
+	-- cpu ports
+	A 					: in std_logic_vector(15 downto 0);
+	DI 				: in std_logic_vector(7 downto 0);
+	DO 				: out std_logic_vector(7 downto 0);
+	N_IORQ 			: in std_logic;
+	N_WR 				: in std_logic;
+	N_M1 				: in std_logic;
+	N_WAIT 			: out std_logic;
+
+	-- RAM interface
+	UPDATE_ACTIVE 	: out std_logic;
+	RAM_A 			: out std_logic_vector(20 downto 0);
+	RAM_DI 			: in std_logic_vector(7 downto 0);
+	RAM_RD 			: out std_logic;
+	RAM_WAIT_N 		: in std_logic := '1'; -- psram read in progress
+
+	-- Parallel flash interface
+	FLASH_A 			: out std_logic_vector(23 downto 0);
+	FLASH_DI 		: out std_logic_vector(7 downto 0);
+	FLASH_DO 		: in std_logic_vector(7 downto 0);
+	FLASH_WR_N 		: out std_logic;
+	FLASH_RD_N 		: out std_logic;
+	FLASH_ER_N 		: out std_logic;
+	FLASH_STREAM 	: out std_logic;
+	FLASH_BUSY 		: in std_logic;
+	FLASH_READY 	: in std_logic;
+
+	-- bank rewritten, a pulse at the end of the update
+	BANK_CHANGED 	: out std_logic_vector(7 downto 0) := (others => '0')
+);
+end flash_update;
+
+architecture rtl of flash_update is
+
+	signal port_sel 	: std_logic;
+	signal port_wr 	: std_logic;
+	signal prev_wr 	: std_logic := '0';
+
+	signal ram_base 	: std_logic_vector(20 downto 0) := (others => '0');
+	signal bank 		: std_logic_vector(2 downto 0) := "000";
+	signal ops 			: std_logic_vector(2 downto 0) := "000"; -- erase, program, verify left to do
+	signal ofs 			: std_logic_vector(16 downto 0) := (others => '0'); -- byte of the bank, bit 16 = done
+	signal ram_q 		: std_logic_vector(7 downto 0);
+	signal rd_cnt 		: std_logic_vector(1 downto 0) := "00";
+	signal deadline 	: integer range 0 to BYTE_DEADLINE := 0;
+	signal changed 	: std_logic_vector(7 downto 0) := (others => '0');
+	signal verify_err : std_logic := '0';
+	signal act 			: std_logic := '0';
+
+	type machine is (idle, next_op,
+		erase, erase_wait,
+		fetch, fetch_wait,
+		prog_start, prog_burst, prog_next, prog_stop,
+		verify_start, verify_read, verify_next, verify_stop,
+		finish);
+	signal state 		: machine := idle;
+	signal fetch_ret 	: machine := idle; -- state after a ram byte is fetched
+
+begin
+
+	port_sel <= '1' when N_IORQ = '0' and N_M1 = '1' and A(7 downto 0) = X"AB" and A(15 downto 10) = "000001" else '0';
+	port_wr <= '1' when port_sel = '1' and N_WR = '0' else '0';
+
+	process (RESET, CLK)
+	begin
+		if RESET = '1' then
+			act <= '0';
+			RAM_RD <= '0';
+			FLASH_WR_N <= '1';
+			FLASH_RD_N <= '1';
+			FLASH_ER_N <= '1';
+			FLASH_STREAM <= '0';
+			BANK_CHANGED <= (others => '0');
+			changed <= (others => '0');
+			state <= idle;
+		elsif CLK'event and CLK = '1' then
+			prev_wr <= port_wr;
+			BANK_CHANGED <= (others => '0');
+
+			case state is
+
+				when idle =>
+					if port_wr = '1' then
+						case A(9 downto 8) is
+							when "00" => ram_base(7 downto 0) <= DI;
+							when "01" => ram_base(15 downto 8) <= DI;
+							when "10" => ram_base(20 downto 16) <= DI(4 downto 0);
+							when others =>
+								if prev_wr = '0' and DI(7 downto 5) /= "000" then
+									ops <= DI(7 downto 5);
+									bank <= DI(2 downto 0);
+									verify_err <= '0';
+									act <= '1';
+									state <= next_op;
+								end if;
+						end case;
+					end if;
+
+				-- erase, program, verify, the flash is idle here
+				when next_op =>
+					ofs <= (others => '0');
+					if FLASH_BUSY = '0' then
+						if ops(2) = '1' then
+							ops(2) <= '0';
+							changed(conv_integer(bank)) <= '1';
+							state <= erase;
+						elsif ops(1) = '1' then
+							ops(1) <= '0';
+							changed(conv_integer(bank)) <= '1';
+							fetch_ret <= prog_start;
+							state <= fetch;
+						elsif ops(0) = '1' then
+							ops(0) <= '0';
+							fetch_ret <= verify_start;
+							state <= fetch;
+						else
+							state <= finish;
+						end if;
+					end if;
+
+				-- 64K block erase, the flash polls its status until the erase is done
+				when erase =>
+					FLASH_ER_N <= '0';
+					if FLASH_BUSY = '1' then
+						FLASH_ER_N <= '1';
+						state <= erase_wait;
+					end if;
+				when erase_wait =>
+					if FLASH_BUSY = '0' then
+						state <= next_op;
+					end if;
+
+				-- ram byte at ofs
+				when fetch =>
+					RAM_RD <= '1';
+					rd_cnt <= "00";
+					state <= fetch_wait;
+				when fetch_wait =>
+					if rd_cnt /= "11" then
+						rd_cnt <= rd_cnt + 1;
+					elsif RAM_WAIT_N = '1' then
+						ram_q <= RAM_DI;
+						RAM_RD <= '0';
+						state <= fetch_ret;
+					end if;
+
+				-- page program from ofs to the page end
+				when prog_start =>
+					if FLASH_BUSY = '0' then
+						FLASH_DI <= ram_q;
+						FLASH_STREAM <= '1';
+						FLASH_WR_N <= '0';
+						state <= prog_burst;
+					end if;
+				when prog_burst =>
+					if FLASH_READY = '1' then -- FLASH_DI is taken
+						ofs <= ofs + 1;
+						if ofs(7 downto 0) = X"FF" then
+							FLASH_WR_N <= '1'; -- page end
+							state <= prog_stop;
+						else
+							RAM_RD <= '1';
+							rd_cnt <= "00";
+							deadline <= 0;
+							state <= prog_next;
+						end if;
+					end if;
+				when prog_next =>
+					if rd_cnt /= "11" then
+						rd_cnt <= rd_cnt + 1;
+					end if;
+					if rd_cnt = "11" and RAM_WAIT_N = '1' then
+						FLASH_DI <= RAM_DI;
+						RAM_RD <= '0';
+						state <= prog_burst;
+					elsif deadline = BYTE_DEADLINE then
+						RAM_RD <= '0';
+						FLASH_WR_N <= '1'; -- ram is slower than the flash, continue the page from this byte
+						state <= prog_stop;
+					else
+						deadline <= deadline + 1;
+					end if;
+				when prog_stop =>
+					FLASH_STREAM <= '0';
+					if FLASH_BUSY = '0' then
+						if ofs(16) = '1' then
+							state <= next_op;
+						else
+							fetch_ret <= prog_start;
+							state <= fetch;
+						end if;
+					end if;
+
+				-- read the bank back as a stream and compare with the ram
+				when verify_start =>
+					FLASH_STREAM <= '1';
+					FLASH_RD_N <= '0';
+					if FLASH_BUSY = '1' then
+						state <= verify_read;
+					end if;
+				when verify_read =>
+					if FLASH_READY = '1' then
+						if FLASH_DO /= ram_q then
+							verify_err <= '1';
+							ops <= "000";
+							FLASH_RD_N <= '1';
+							state <= verify_stop;
+						elsif ofs = X"FFFF" then
+							ofs <= ofs + 1;
+							FLASH_RD_N <= '1';
+							state <= verify_stop;
+						else
+							ofs <= ofs + 1;
+							RAM_RD <= '1';
+							rd_cnt <= "00";
+							state <= verify_next;
+						end if;
+					end if;
+				when verify_next =>
+					if rd_cnt /= "11" then
+						rd_cnt <= rd_cnt + 1;
+					end if;
+					if FLASH_READY = '1' then
+						RAM_RD <= '0';
+						FLASH_RD_N <= '1'; -- ram is slower than the stream, restart from this byte
+						state <= verify_stop;
+					elsif rd_cnt = "11" and RAM_WAIT_N = '1' then
+						ram_q <= RAM_DI;
+						RAM_RD <= '0';
+						state <= verify_read;
+					end if;
+				when verify_stop =>
+					if FLASH_BUSY = '0' then
+						FLASH_STREAM <= '0';
+						if ofs(16) = '1' or verify_err = '1' then
+							state <= next_op;
+						else
+							fetch_ret <= verify_start;
+							state <= fetch;
+						end if;
+					end if;
+
+				when finish =>
+					BANK_CHANGED <= changed;
+					changed <= (others => '0');
+					act <= '0';
+					state <= idle;
+
+			end case;
+		end if;
+	end process;
+
+	FLASH_A <= FLASH_ADDR_START + (bank & ofs(15 downto 0));
+	RAM_A <= ram_base + ofs(15 downto 0);
+
+	DO <= ram_base(7 downto 0) when A(9 downto 8) = "00" else
+			ram_base(15 downto 8) when A(9 downto 8) = "01" else
+			"000" & ram_base(20 downto 16) when A(9 downto 8) = "10" else
+			act & verify_err & "000000";
+
+	N_WAIT <= not act;
+	UPDATE_ACTIVE <= act;
+
+end rtl;
@@ -4,7 +4,17 @@
 -- Load data from SPI flash (W25Q16) into RAM on boot
 -- 1. Loader process initiates by RESET=1 (asynchronous)
 -- 2. Loader progress indicates via LOADER_ACTIVE=1
--- 3. At the end, a LOADER_RESET=1 pulse will be triggered to re-boot the host
+-- 3. ROM images are streamed with a single read command, the RAM address auto-increments
+--    Banks starting with "BRLE" are RLE packed (rom/pack_rom) and expanded on the fly
+-- 4. Only the ROM bank selected by BANK is loaded, other banks are loaded when selected.
+--    At power on the loader waits for BANK_VALID (the AVR has sent the saved bank),
+--    or takes BANK as is after 2^BANK_WAIT_BIT clocks without the AVR
+-- 5. At the end, a LOADER_RESET=1 pulse will be triggered to re-boot the host
+-- 6. Banks rewritten in the flash (INVALIDATE) are loaded again when selected,
+--    the running bank keeps its stale RAM copy until the next HOST_RESET
+--    (or until another bank has been selected and it is selected again)
+-- 7. No bank is loaded while UPDATE_ACTIVE=1 (the flash and the RAM bus belong
+--    to the update), a bank selected meanwhile is loaded after it
 --
 -- Copyright (c) 2019, 2020 Andy Karpov <andy.karpov@gmail.com>
 --
@@ -22,9 +32,13 @@ entity loader is
 generic (
 	FLASH_ADDR_START	: std_logic_vector(23 downto 0) := "000100000000000000000000"; -- 0x100000; -- 24bit address / ROM image start at
 	RAM_ADDR_START		: std_logic_vector(20 downto 0) := "100000000000000000000"; -- 21 bit address / RAM address to copy ROM image to
-	SIZE_TO_READ		: integer := 524288; -- count of bytes to read (8x 64KB rom) / count of bytes to read
+	BANK_SIZE			: integer := 65536; -- count of bytes to read per rom bank (8x 64KB rom)
 	CFG_ADDR 			: std_logic_vector(23 downto 0) := "000111110000000000000000"; -- 0x1F0000; -- 24bit address / config byte address
 	
+	PACK_MAGIC 			: std_logic_vector(31 downto 0) := X"42524C45"; -- "BRLE", packed bank header
+	PACK_RUN_BASE 		: integer := 4; -- shortest run of a repeat token
+	BANK_WAIT_BIT 		: integer := 25; -- power on wait for BANK_VALID, 2^25 clocks (~1.2 s @ 28 MHz)
+	
 	SPI_CMD_READ  		: std_logic_vector(7 downto 0) := X"03"; -- W25Q16 read command
 	SPI_CMD_POWERON 	: std_logic_vector(7 downto 0) := X"AB" -- W25Q16 power on command
 );
@@ -35,10 +49,18 @@ port (
 	-- global reset
 	RESET 			: in std_logic;
 	
+	-- selected rom bank
+	BANK 				: in std_logic_vector(2 downto 0) := "000";
+	BANK_VALID 		: in std_logic := '1'; -- BANK holds the selected bank, not the power on default
+	INVALIDATE 		: in std_logic_vector(7 downto 0) := (others => '0'); -- pulse, banks changed in the flash
+	UPDATE_ACTIVE 	: in std_logic := '0'; -- flash_update owns the flash
+	HOST_RESET 		: in std_logic := '0'; -- keyboard reset of the host, reloads a stale running bank
+	
 	-- RAM interface
 	RAM_A 			: out std_logic_vector(20 downto 0);
 	RAM_DO 			: out std_logic_vector(7 downto 0);
 	RAM_WR			: out std_logic;
+	RAM_BUSY 		: in std_logic := '0'; -- previous write is still in progress (psram)
 	
 	-- Config byte 
 	CFG 				: out std_logic_vector(7 downto 0) := "00000010";
@@ -47,6 +69,7 @@ port (
 	FLASH_A 			: out std_logic_vector(23 downto 0);
 	FLASH_DO 		: in std_logic_vector(7 downto 0);
 	FLASH_RD_N 		: out std_logic;
+	FLASH_STREAM 	: out std_logic; -- continuous read while FLASH_RD_N is low
 	FLASH_BUSY 		: in std_logic;
 	FLASH_READY 	: in std_logic;
 	
@@ -59,8 +82,8 @@ end loader;
 architecture rtl of loader is
 
 -- SPI
-signal spi_page_bus 	: std_logic_vector(15 downto 0);
-signal spi_a_bus 		: std_logic_vector(7 downto 0);
+signal flash_a_bus 	: std_logic_vector(23 downto 0);
+signal bank_a_bus 	: std_logic_vector(23 downto 0); -- flash address of the current bank
 
 -- RAM
 signal ram_a_bus 		: std_logic_vector(20 downto 0);
@@ -70,9 +93,24 @@ signal loader_act 	: std_logic := '1';
 signal reset_cnt  	: std_logic_vector(7 downto 0) := "00000000";
 signal read_cnt 		: std_logic_vector(20 downto 0) := (others => '0');
 signal clear_cnt 		: std_logic_vector(20 downto 0) := (others => '0');
+signal cur_bank 		: std_logic_vector(2 downto 0) := "000"; -- bank being loaded
+signal run_bank 		: std_logic_vector(2 downto 0) := "000"; -- bank the host runs
+signal loaded 			: std_logic_vector(7 downto 0) := (others => '0'); -- banks already in ram
+signal cfg_done 		: std_logic := '0';
+signal bank_wait_cnt : std_logic_vector(BANK_WAIT_BIT downto 0) := (others => '0');
+
+-- RLE unpacker
+type pack_mode is (probe, raw, packed);
+signal mode 			: pack_mode := probe;
+signal hdr_cnt 		: std_logic_vector(1 downto 0) := "00"; -- magic bytes matched so far
+signal hdr_byte 		: std_logic_vector(7 downto 0); -- next expected magic byte
+signal lit_cnt 		: std_logic_vector(7 downto 0) := (others => '0'); -- literal bytes left
+signal run_cnt 		: std_logic_vector(7 downto 0) := (others => '0'); -- repeat count
+signal run_val 		: std_logic := '0'; -- next byte is the repeated value
+signal run_byte 		: std_logic_vector(7 downto 0);
 
 type machine IS( 
-					 ready, cmd_read, do_read, do_next, finish, 
+					 wait_bank, start_bank, ready, cmd_read, do_read, do_next, do_run, do_run_next, finish, 
 					 cmd_read_cfg, do_read_cfg, finish_cfg,
 					 finish2
 );     --state machine datatype
@@ -88,36 +126,92 @@ VARIABLE spi_busy_cnt : INTEGER := 0;
 begin
 	if RESET = '1' then
 		loader_act <= '1';
-		spi_page_bus <= FLASH_ADDR_START(23 downto 8);
-		spi_a_bus <= FLASH_ADDR_START(7 downto 0);
-		ram_a_bus <= RAM_ADDR_START;
-		state <= ready;
-		read_cnt <= (others => '0');
+		loaded <= (others => '0');
+		cfg_done <= '0';
+		FLASH_STREAM <= '0';
+		bank_wait_cnt <= (others => '0');
+		state <= wait_bank;
 	elsif CLK'event and CLK = '1' then
 		
+		for i in 0 to 7 loop
+			if (INVALIDATE(i) = '1') then 
+				loaded(i) <= '0';
+			end if;
+		end loop;
+		
 		case state is 
 			
+			when wait_bank => -- power on, the AVR sends the saved bank with its first matrix
+				bank_wait_cnt <= bank_wait_cnt + 1;
+				if (BANK_VALID = '1' or bank_wait_cnt(BANK_WAIT_BIT) = '1') then 
+					state <= start_bank;
+				end if;
+			
+			when start_bank => -- set up flash and ram addresses of the selected bank
+				cur_bank <= BANK;
+				bank_a_bus <= FLASH_ADDR_START + (BANK & X"0000");
+				flash_a_bus <= FLASH_ADDR_START + (BANK & X"0000");
+				ram_a_bus <= RAM_ADDR_START + (BANK & X"0000");
+				read_cnt <= (others => '0');
+				mode <= probe;
+				hdr_cnt <= "00";
+				lit_cnt <= (others => '0');
+				run_val <= '0';
+				state <= ready;
+			
 			when ready => -- ready to begin / finish
 				if (flash_busy = '1') then 
 					state <= ready;
-				elsif (read_cnt < SIZE_TO_READ) then 
+				elsif (read_cnt < BANK_SIZE) then 
 					state <= cmd_read;
 				else 
 					state <= finish;
 				end if;
 			
-			when cmd_read => -- read command
+			when cmd_read => -- start streaming from the current address
+				FLASH_STREAM <= '1';
 				FLASH_RD_N <= '0';
 				if (flash_busy = '1') then 
 					state <= do_read;
 				end if;
 			
-			when do_read => -- wait for spi transfer
-				FLASH_RD_N <= '1';
+			when do_read => -- wait for the next byte of the stream
 				if (flash_ready = '1') then
-					RAM_WR <= '1'; -- begin ram write
-					RAM_DO <= FLASH_DO;
-					state <= do_next;
+					if (mode = probe) then -- bank header
+						if (FLASH_DO /= hdr_byte) then 
+							mode <= raw; -- not packed, copy the bank from its start
+							flash_a_bus <= bank_a_bus;
+							FLASH_RD_N <= '1';
+							state <= ready;
+						else
+							flash_a_bus <= flash_a_bus + 1;
+							hdr_cnt <= hdr_cnt + 1;
+							if (hdr_cnt = "11") then 
+								mode <= packed;
+							end if;
+						end if;
+					elsif (mode = packed and lit_cnt = 0 and run_val = '0') then -- token
+						flash_a_bus <= flash_a_bus + 1;
+						if (FLASH_DO(7) = '0') then 
+							lit_cnt <= FLASH_DO + 1;
+						else
+							run_cnt <= ('0' & FLASH_DO(6 downto 0)) + PACK_RUN_BASE;
+							run_val <= '1';
+						end if;
+					elsif (mode = packed and run_val = '1') then -- repeated byte
+						flash_a_bus <= flash_a_bus + 1;
+						run_byte <= FLASH_DO;
+						run_val <= '0';
+						FLASH_RD_N <= '1'; -- the run is longer than a byte time, continue the stream after it
+						state <= do_run;
+					elsif (RAM_BUSY = '0') then -- raw or literal byte
+						RAM_WR <= '1'; -- begin ram write
+						RAM_DO <= FLASH_DO;
+						state <= do_next;
+					else 
+						FLASH_RD_N <= '1'; -- ram is slower than the stream, restart from this byte
+						state <= ready;
+					end if;
 				else 
 					state <= do_read;
 				end if;
@@ -125,21 +219,49 @@ begin
 			when do_next => -- increment address / page
 				RAM_WR <= '0'; -- end ram write
 				read_cnt <= read_cnt + 1; -- increment read counter
-				if (spi_a_bus = X"FF") then -- increment flash page
-					spi_page_bus <= spi_page_bus + 1;
-				end if;
-				spi_a_bus <= spi_a_bus + 1; -- increment flash address 
+				flash_a_bus <= flash_a_bus + 1; -- increment flash address 
 				ram_a_bus <= ram_a_bus + 1; -- increment ram address
-				state <= ready;
+				if (mode = packed) then 
+					lit_cnt <= lit_cnt - 1;
+				end if;
+				if (read_cnt = BANK_SIZE - 1) then 
+					FLASH_RD_N <= '1'; -- stop the stream
+					state <= ready;
+				else
+					state <= do_read;
+				end if;
+			
+			when do_run => -- expand a repeat token, the stream is stopped
+				if (RAM_BUSY = '0') then 
+					RAM_WR <= '1';
+					RAM_DO <= run_byte;
+					state <= do_run_next;
+				end if;
+			
+			when do_run_next => 
+				RAM_WR <= '0';
+				read_cnt <= read_cnt + 1;
+				ram_a_bus <= ram_a_bus + 1;
+				run_cnt <= run_cnt - 1;
+				if (run_cnt = 1 or read_cnt = BANK_SIZE - 1) then 
+					state <= ready; -- restart the stream at the next token
+				else
+					state <= do_run;
+				end if;
 
-			when finish => -- finish of reading rom images fro flash to ram
-				state <= cmd_read_cfg;
+			when finish => -- finish of reading rom bank from flash to ram
+				loaded(conv_integer(cur_bank)) <= '1';
+				if (cfg_done = '0') then 
+					state <= cmd_read_cfg;
+				else
+					state <= finish2;
+				end if;
 			
 			-- read cfg byte from spi flash
 			when cmd_read_cfg => 
+				FLASH_STREAM <= '0';
 				FLASH_RD_N <= '0';
-				spi_page_bus <= CFG_ADDR(23 downto 8);
-				spi_a_bus <= CFG_ADDR(7 downto 0);
+				flash_a_bus <= CFG_ADDR;
 				if (flash_busy = '1') then
 					state <= do_read_cfg;
 				end if;
@@ -152,10 +274,18 @@ begin
 					state <= do_read_cfg;
 				end if;
 			when finish_cfg => 
+				cfg_done <= '1';
 				state <= finish2;			
 			when finish2 => -- read all the required data from SPI flash
-				state <= finish2; -- infinite loop here
 				loader_act <= '0'; -- loader finished
+				if (UPDATE_ACTIVE = '1') then 
+					state <= finish2; -- the flash is busy with the update, BANK is taken after it
+				elsif (loaded(conv_integer(BANK)) = '0' and (BANK /= run_bank or HOST_RESET = '1')) then 
+					loader_act <= '1'; -- host is held in reset while the new bank is loading
+					state <= start_bank;
+				else
+					run_bank <= BANK; -- a stale running bank is reloaded on the next host reset
+				end if;
 		end case;
 	
 	end if;
@@ -167,7 +297,9 @@ begin
 	if RESET = '1' then
 		reset_cnt <= (others => '0');
 	elsif CLK'event and CLK = '1' then
-		if (loader_act = '0' and reset_cnt /= "10000000") then 
+		if (loader_act = '1') then 
+			reset_cnt <= (others => '0');
+		elsif (reset_cnt /= "10000000") then 
 			reset_cnt <= reset_cnt + 1;
 		end if;
 	end if;
@@ -175,9 +307,15 @@ end process;
 
 -------------------------------------------------------------------------------
 
+with hdr_cnt select hdr_byte <= 
+	PACK_MAGIC(31 downto 24) when "00",
+	PACK_MAGIC(23 downto 16) when "01",
+	PACK_MAGIC(15 downto 8) when "10",
+	PACK_MAGIC(7 downto 0) when others;
+
 LOADER_ACTIVE <= loader_act;
 LOADER_RESET <= reset_cnt(6);
-FLASH_A <= spi_page_bus & spi_a_bus;
+FLASH_A <= flash_a_bus;
 RAM_A <= ram_a_bus;
 
 end rtl;
\ No newline at end of file
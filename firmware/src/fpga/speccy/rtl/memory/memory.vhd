@@ -8,6 +8,7 @@ port (
 	CLK2X 		: in std_logic;
 	CLKX	   	: in std_logic;
 	CLK_CPU 		: in std_logic;
+	TURBO 		: in std_logic_vector(1 downto 0) := "00";
 	
 	enable_divmmc : in std_logic := '0';
 	enable_zcontroller : in std_logic := '0';
@@ -16,6 +17,15 @@ port (
 	loader_ram_a: in std_logic_vector(20 downto 0);
 	loader_ram_do: in std_logic_vector(7 downto 0);
 	loader_ram_wr: in std_logic := '0';
+
+	dma_act 		: in std_logic := '0';
+	dma_ram_a	: in std_logic_vector(20 downto 0) := (others => '0');
+	dma_ram_do	: in std_logic_vector(7 downto 0) := (others => '1');
+	dma_ram_wr	: in std_logic := '0';
+
+	update_act 	: in std_logic := '0';
+	update_ram_a: in std_logic_vector(20 downto 0) := (others => '0');
+	update_ram_rd: in std_logic := '0';
 	
 	A           : in std_logic_vector(15 downto 0); -- address bus
 	D 				: in std_logic_vector(7 downto 0);
@@ -27,9 +37,11 @@ port (
 	
 	DO 			: out std_logic_vector(7 downto 0);
 	N_OE 			: out std_logic;
+	N_WAIT 		: out std_logic; -- wait state request at 28 MHz
 	
 	MA 			: out std_logic_vector(20 downto 0);
 	MDI 			: in std_logic_vector(7 downto 0);
+	MDI_WAIT_N 	: in std_logic := '1'; -- psram access in progress, passed on to N_WAIT
 	MDO 			: out std_logic_vector(7 downto 0);
 	N_MRD 		: out std_logic;
 	N_MWR 		: out std_logic;
@@ -62,6 +74,16 @@ architecture RTL of memory is
 
 	signal vid_wr 		: std_logic;
 	signal vid_scr 	: std_logic;
+	signal vid_a 		: std_logic_vector(13 downto 0);
+	signal vid_di 		: std_logic_vector(7 downto 0);
+	
+	signal wait_done 	: std_logic := '0';
+
+	signal rom_a 		: std_logic_vector(18 downto 0);
+	signal rom_rd 		: std_logic;
+	signal rom_flush 	: std_logic;
+	signal rom_hit 	: std_logic;
+	signal rom_do 		: std_logic_vector(7 downto 0);
 
 begin
 
@@ -69,21 +91,41 @@ begin
 	port map(
 		clock_a => CLK2X,
 		clock_b => CLK2X,
-		address_a => vid_scr & A(12 downto 0),
+		address_a => vid_a,
 		address_b => vid_page & VA(12 downto 0),
-		data_a => D,
+		data_a => vid_di,
 		data_b => "11111111",
 		q_a => open,
 		q_b => VID_DO,
 		wren_a => vid_wr,
 		wren_b => '0'
 	);
+
+	-- rom reads are kept in block ram, a hit needs no ram read and, seen at T2, no wait state
+	-- (hit rate and wait states: make rom-cache in sim)
+	U_ROM_CACHE: entity work.rom_cache
+	port map(
+		CLK => CLK2X,
+		FLUSH => rom_flush,
+		A => rom_a,
+		RD => rom_rd,
+		RAM_DI => MDI,
+		RAM_WAIT_N => MDI_WAIT_N,
+		DO => rom_do,
+		HIT => rom_hit
+	);
 	
 	is_rom <= '1' when N_MREQ = '0' and ((A(15 downto 14)  = "00" and (enable_divmmc = '0' or (IS_DIVMMC_ROM = '0' and IS_DIVMMC_RAM = '0'))) or (enable_divmmc = '1' and IS_DIVMMC_ROM = '1')) else '0';
 	is_ram <= '1' when N_MREQ = '0' and ((A(15 downto 14) /= "00" and (enable_divmmc = '0' or (IS_DIVMMC_ROM = '0' and IS_DIVMMC_RAM = '0'))) or (enable_divmmc = '1' and IS_DIVMMC_RAM = '1')) else '0';
 	
-	vid_wr <= '1' when N_MREQ = '0' and N_WR = '0' and (ram_page = "0000101" or ram_page = "0000111" ) and A(13) = '0' else '0';
-	vid_scr <= '1' when ram_page = "0000111" and A(13) = '0' else '0';
+	-- sd dma writes to the screen pages go to the vram as well
+	vid_wr <= dma_ram_wr when dma_act = '1' and (dma_ram_a(20 downto 14) = "0000101" or dma_ram_a(20 downto 14) = "0000111") and dma_ram_a(13) = '0' else
+				 '0' when dma_act = '1' else
+				 '1' when N_MREQ = '0' and N_WR = '0' and (ram_page = "0000101" or ram_page = "0000111" ) and A(13) = '0' else '0';
+	vid_scr <= dma_ram_a(15) when dma_act = '1' else
+				  '1' when ram_page = "0000111" and A(13) = '0' else '0';
+	vid_a <= vid_scr & dma_ram_a(12 downto 0) when dma_act = '1' else vid_scr & A(12 downto 0);
+	vid_di <= dma_ram_do when dma_act = '1' else D;
 	
 	-- 00 - bank 0, ESXDOS 0.8.7 or GLUK
 	-- 01 - bank 1, empty or TRDOS
@@ -93,16 +135,36 @@ begin
 		(not(TRDOS)) & ROM_BANK when enable_zcontroller = '1' else
 		'1' & ROM_BANK;
 		
-	N_MRD <= '1' when loader_act = '1' else 
+	N_MRD <= not update_ram_rd when update_act = '1' else -- rom bank update reads
+				'1' when loader_act = '1' or dma_act = '1' else 
+				'1' when rom_hit = '1' and rom_rd = '1' else -- served by the rom cache
 				'0' when (is_rom = '1' and N_RD = '0') or 
 							(N_RD = '0' and N_MREQ = '0') 
 					 else '1';  
 				
 	N_MWR <= not loader_ram_wr when loader_act = '1' else 
+				not dma_ram_wr when dma_act = '1' else 
+				'1' when update_act = '1' else 
 				'0' when is_ram = '1' and N_WR = '0'
 				 else '1';
 
-	DO <= MDI;
+	-- 28 MHz: one wait state for M1 fetches (1.5T access) and writes (1T write pulse),
+	-- other reads have 2T and are fine with the sram, rom cache hits need none.
+	-- The psram wait is dropped on a hit as well: its read may have started
+	-- before the hit was known, the byte comes from the cache anyway.
+	process (CLK_CPU, N_MREQ)
+	begin
+		if N_MREQ = '1' then 
+			wait_done <= '0';
+		elsif CLK_CPU'event and CLK_CPU = '0' then 
+			wait_done <= '1'; -- WAIT is sampled on the falling edge of T2
+		end if;
+	end process;
+	
+	N_WAIT <= '0' when TURBO = "11" and loader_act = '0' and N_MREQ = '0' and (N_M1 = '0' or N_RD = '1') and wait_done = '0' and rom_hit = '0' else
+				 '0' when MDI_WAIT_N = '0' and (rom_hit = '0' or rom_rd = '0') else '1';
+
+	DO <= rom_do when rom_hit = '1' else MDI;
 	N_OE <= '0' when (is_ram = '1' or is_rom = '1') and N_RD = '0' else '1';
 		
 	ram_page <=	
@@ -114,11 +176,20 @@ begin
 				"0" & RAM_EXT(2 downto 0) & RAM_BANK(2 downto 0);
 
 	MA(20 downto 0) <= loader_ram_a(20 downto 0) when loader_act = '1' else -- loader ram
+		dma_ram_a(20 downto 0) when dma_act = '1' else -- sd dma
+		update_ram_a(20 downto 0) when update_act = '1' else -- rom bank update
 		ram_page(6 downto 0) & DIVMMC_A(0) & A(12 downto 0) when enable_divmmc = '1' and (IS_DIVMMC_RAM = '1' or IS_DIVMMC_ROM = '1') else -- divmmc ram
 		ram_page(6 downto 0) & A(13 downto 0) when IS_DIVMMC_RAM = '0' and IS_DIVMMC_ROM = '0'; -- spectrum ram 
 	
+	-- rom cache: bank & page & offset as on MA, flushed when the rom area of the ram is written
+	rom_a <= EXT_ROM_BANK & rom_page & DIVMMC_A(0) & A(12 downto 0) when enable_divmmc = '1' and IS_DIVMMC_ROM = '1' else 
+		EXT_ROM_BANK & rom_page & A(13 downto 0);
+	rom_rd <= '1' when is_rom = '1' and N_RD = '0' and loader_act = '0' and dma_act = '0' and update_act = '0' else '0';
+	rom_flush <= '1' when loader_act = '1' or (dma_act = '1' and dma_ram_wr = '1' and dma_ram_a(20 downto 19) = "10") else '0';
+
 	MDO(7 downto 0) <= 
 		loader_ram_do when loader_act = '1' else -- loader DO
+		dma_ram_do when dma_act = '1' else -- sd dma DO
 		D(7 downto 0) when is_ram = '1' and N_WR = '0' else -- cpu DO
 		(others => 'Z');
 	
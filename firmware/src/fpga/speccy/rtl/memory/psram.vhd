@@ -1,9 +1,29 @@
+-------------------------------------------------------------------------------
+-- PSRAM controller (ESP-PSRAM64 / LY68L6400 in QPI mode)
+--
+-- Parallel RAM bus in front of a serial PSRAM:
+-- 1. Reads are served from a direct-mapped cache of 2^CACHE_INDEX_BITS lines x 8 bytes
+-- 2. A read miss fills the whole line with one quad burst, the next line is prefetched
+-- 3. Writes go through: the cached line is updated on hit, the PSRAM write is posted
+-- 4. N_WAIT holds the CPU on misses and when a write finds the previous one in flight
+--
+-- The bus side (cache, CPU handshake) runs on CLK_BUS, the QSPI engine runs on
+-- CLK_QSPI, requests and answers cross the domains with toggle handshakes.
+--
+-- The init starts with a quad exit QPI command: after an FPGA reconfiguration
+-- without a power cycle the PSRAM is still in QPI mode and would not decode
+-- the spi reset, a PSRAM in spi mode sees 2 clocks of a command and ignores it.
+-------------------------------------------------------------------------------
+
 library IEEE;
 use IEEE.std_logic_1164.all;
 use IEEE.std_logic_arith.conv_integer;
 use IEEE.numeric_std.all;
 
 entity psram is
+generic (
+	CACHE_INDEX_BITS : integer := 7 -- 128 lines x 8 bytes
+);
 port (
 	CLK_QSPI 	: in std_logic; -- high speed qspi clk
 	CLK_BUS 		: in std_logic; -- low speed spi clk
@@ -14,18 +34,25 @@ port (
 	DO 			: out std_logic_vector(7 downto 0);
 	N_WR 			: in std_logic := '1';
 	N_RD 			: in std_logic := '1';
+	N_MREQ 		: in std_logic := '1'; -- cpu mreq, to hold writes in time
+	N_WAIT 		: out std_logic := '1';
+	BUSY 			: out std_logic; -- write in flight, next write will wait
+
+	-- cache statistics
+	HITS 			: out std_logic_vector(31 downto 0);
+	MISSES 		: out std_logic_vector(31 downto 0);
 
 	-- PSRAM interface
 	SPI_SCLK 	: out std_logic;
 	SPI_N_CS 	: out std_logic;
 	SPI_SIO 		: inout std_logic_vector(3 downto 0) := "1111"
-	
+
 );
 end psram;
 
 architecture RTL of psram is
 
-component llqspi 
+component llqspi
 port (
 	i_clk : in std_logic;
 	i_wr : in std_logic;
@@ -43,10 +70,468 @@ port (
 	o_dat : out std_logic_vector(3 downto 0);
 	i_dat : in std_logic_vector(3 downto 0));
 end component;
-	
+
+	constant LINE_BITS : integer := 3; -- 8 bytes per line
+	constant IDX_HI : integer := LINE_BITS + CACHE_INDEX_BITS; -- lowest tag bit
+	constant TAG_BITS : integer := 21 - IDX_HI;
+
+	constant CMD_RESET_EN : std_logic_vector(7 downto 0) := X"66";
+	constant CMD_RESET 	 : std_logic_vector(7 downto 0) := X"99";
+	constant CMD_QPI_ON 	 : std_logic_vector(7 downto 0) := X"35";
+	constant CMD_QPI_OFF 	 : std_logic_vector(7 downto 0) := X"F5"; -- sent in quad
+	constant CMD_READ 	 : std_logic_vector(7 downto 0) := X"EB"; -- quad read, 6 wait cycles
+	constant CMD_WRITE 	 : std_logic_vector(7 downto 0) := X"38"; -- quad write
+
+	-- cache
+	type data_ram_t is array(0 to 2**IDX_HI-1) of std_logic_vector(7 downto 0);
+	type tag_ram_t is array(0 to 2**CACHE_INDEX_BITS-1) of std_logic_vector(TAG_BITS downto 0); -- valid & tag
+	signal data_ram 	: data_ram_t;
+	signal tag_ram 	: tag_ram_t := (others => (others => '0'));
+	signal data_q 		: std_logic_vector(7 downto 0);
+	signal tag_q 		: std_logic_vector(TAG_BITS downto 0);
+	signal ra 			: std_logic_vector(20 downto 0); -- cache read address
+	signal data_we 	: std_logic := '0';
+	signal data_wa 	: std_logic_vector(IDX_HI-1 downto 0) := (others => '0');
+	signal data_wd 	: std_logic_vector(7 downto 0) := (others => '0');
+	signal tag_we 		: std_logic := '0';
+	signal tag_wa 		: std_logic_vector(CACHE_INDEX_BITS-1 downto 0) := (others => '0');
+	signal tag_wd 		: std_logic_vector(TAG_BITS downto 0) := (others => '0');
+
+	-- bus side
+	type bus_machine is (b_idle, b_lookup, b_compare, b_wait_engine, b_fill, b_install, b_prefetch, b_pf_lookup, b_pf_compare, b_done);
+	signal st 			: bus_machine := b_idle;
+	signal inst_ret 	: bus_machine := b_idle; -- state to return after line install
+
+	signal rd_s 		: std_logic_vector(1 downto 0) := "00"; -- synchronized strobes of not yet served accesses
+	signal wr_s 		: std_logic_vector(1 downto 0) := "00";
+	signal mreq_s 		: std_logic_vector(1 downto 0) := "00";
+	signal a_p0, a_p1 : std_logic_vector(20 downto 0) := (others => '0'); -- address sampled along with the strobes
+	signal d_p0, d_p1 : std_logic_vector(7 downto 0) := (others => '0');
+	signal idle_q 		: std_logic := '0'; -- tag_q / data_q belong to a_p1
+	signal cmp_a 		: std_logic_vector(20 downto 0);
+	signal hit 			: std_logic;
+
+	signal lat_a 		: std_logic_vector(20 downto 0) := (others => '0'); -- current access
+	signal lat_d 		: std_logic_vector(7 downto 0) := (others => '0');
+	signal lat_wr 		: std_logic := '0';
+	signal lk_a 		: std_logic_vector(20 downto 0) := (others => '0'); -- lookup address
+	signal inst_a 		: std_logic_vector(20 downto 0) := (others => '0'); -- line being installed
+	signal inst_cnt 	: unsigned(LINE_BITS-1 downto 0) := (others => '0');
+	signal pf_a 		: std_logic_vector(20 downto 0) := (others => '0'); -- prefetched line
+	signal pf_pend 	: std_logic := '0'; -- prefetch in flight
+	signal pf_ready 	: std_logic := '0'; -- prefetched line waits for install
+
+	signal do_r 		: std_logic_vector(7 downto 0) := (others => '1');
+	signal ack 			: std_logic := '0';
+	signal ack_set 	: std_logic := '0';
+	signal done_cnt 	: unsigned(1 downto 0) := (others => '0');
+	signal busy_r 		: std_logic := '0';
+
+	signal hit_cnt 	: unsigned(31 downto 0) := (others => '0');
+	signal miss_cnt 	: unsigned(31 downto 0) := (others => '0');
+
+	-- bus -> engine requests
+	signal req_t 		: std_logic := '0'; -- toggles on every request
+	signal req_wr 		: std_logic := '0';
+	signal req_a 		: std_logic_vector(20 downto 0) := (others => '0');
+	signal req_d 		: std_logic_vector(7 downto 0) := (others => '0');
+	signal pend 		: std_logic := '0'; -- request in flight
+	signal done_s 		: std_logic_vector(1 downto 0) := "00";
+	signal done_seen 	: std_logic := '0';
+
+	-- engine
+	type engine_machine is (e_por, e_init, e_init_end, e_idle, e_fill, e_write, e_end);
+	signal es 			: engine_machine := e_por;
+	signal por_cnt 	: unsigned(12 downto 0) := (others => '0'); -- 150 us power up at 50 MHz
+	signal init_cnt 	: unsigned(1 downto 0) := (others => '0');
+	signal word_cnt 	: unsigned(1 downto 0) := (others => '0');
+	signal valid_cnt 	: unsigned(1 downto 0) := (others => '0');
+	signal req_s 		: std_logic_vector(1 downto 0) := "00";
+	signal req_seen 	: std_logic := '0';
+	signal done_t 		: std_logic := '0'; -- toggles on every finished request
+	signal fill_line 	: std_logic_vector(63 downto 0) := (others => '0'); -- last filled line
+
+	signal q_wr 		: std_logic := '0';
+	signal q_word 		: std_logic_vector(31 downto 0) := (others => '0');
+	signal q_len 		: std_logic_vector(1 downto 0) := "00";
+	signal q_spd 		: std_logic := '0';
+	signal q_dir 		: std_logic := '1';
+	signal q_oword 	: std_logic_vector(31 downto 0);
+	signal q_valid 	: std_logic;
+	signal q_busy 		: std_logic;
+	signal q_mod 		: std_logic_vector(1 downto 0);
+	signal q_dat 		: std_logic_vector(3 downto 0);
+
+	function line_byte(l : std_logic_vector(63 downto 0); n : unsigned) return std_logic_vector is
+		variable i : integer;
+	begin
+		i := to_integer(n);
+		return l(63 - i*8 downto 56 - i*8);
+	end function;
+
 begin
 
--- TODO
-	
-end RTL;
+-------------------------------------------------------------------------------
+-- cache memories
+
+process (CLK_BUS)
+begin
+	if rising_edge(CLK_BUS) then
+		if data_we = '1' then
+			data_ram(to_integer(unsigned(data_wa))) <= data_wd;
+		end if;
+		if tag_we = '1' then
+			tag_ram(to_integer(unsigned(tag_wa))) <= tag_wd;
+		end if;
+		data_q <= data_ram(to_integer(unsigned(ra(IDX_HI-1 downto 0))));
+		tag_q <= tag_ram(to_integer(unsigned(ra(IDX_HI-1 downto LINE_BITS))));
+	end if;
+end process;
+
+-- idle: look up every address on the bus, so a hit is known as soon as the strobe is seen
+ra <= a_p0 when st = b_idle else lk_a;
+cmp_a <= a_p1 when st = b_idle else lk_a;
+hit <= '1' when tag_q(TAG_BITS) = '1' and tag_q(TAG_BITS-1 downto 0) = cmp_a(20 downto IDX_HI) else '0';
+
+-------------------------------------------------------------------------------
+-- bus side
+
+process (CLK_BUS)
+
+	-- serve the access in lat_a / cmp_a, tag_q and data_q are valid for it
+	procedure serve(a : std_logic_vector(20 downto 0); d : std_logic_vector(7 downto 0); wr : std_logic) is
+	begin
+		if wr = '0' then
+			if hit = '1' then
+				do_r <= data_q;
+				ack_set <= '1';
+				hit_cnt <= hit_cnt + 1;
+				done_cnt <= (others => '0');
+				st <= b_done;
+			elsif pend = '0' and pf_ready = '0' then
+				req_wr <= '0';
+				req_a <= a(20 downto LINE_BITS) & "000";
+				req_t <= not(req_t);
+				pend <= '1';
+				miss_cnt <= miss_cnt + 1;
+				st <= b_fill;
+			else
+				st <= b_wait_engine;
+			end if;
+		else
+			if pend = '0' then
+				if hit = '1' then
+					data_we <= '1';
+					data_wa <= a(IDX_HI-1 downto 0);
+					data_wd <= d;
+				end if;
+				-- prefetched line is older than this write
+				if pf_ready = '1' and pf_a(20 downto LINE_BITS) = a(20 downto LINE_BITS) then
+					pf_ready <= '0';
+				end if;
+				req_wr <= '1';
+				req_a <= a;
+				req_d <= d;
+				req_t <= not(req_t);
+				pend <= '1';
+				ack_set <= '1';
+				done_cnt <= (others => '0');
+				st <= b_done;
+			else
+				st <= b_wait_engine;
+			end if;
+		end if;
+	end procedure;
+
+begin
+	if rising_edge(CLK_BUS) then
+
+		rd_s <= rd_s(0) & (not(N_RD) and not(ack));
+		wr_s <= wr_s(0) & (not(N_WR) and not(ack));
+		mreq_s <= mreq_s(0) & not(N_MREQ);
+		a_p0 <= A;
+		a_p1 <= a_p0;
+		d_p0 <= DI;
+		d_p1 <= d_p0;
+
+		ack_set <= '0';
+		data_we <= '0';
+		tag_we <= '0';
+
+		-- engine has finished a request
+		done_s <= done_s(0) & done_t;
+		if done_s(1) /= done_seen then
+			done_seen <= done_s(1);
+			pend <= '0';
+			if pf_pend = '1' then
+				pf_pend <= '0';
+				pf_ready <= '1';
+			end if;
+		end if;
+
+		if st = b_idle and data_we = '0' then
+			idle_q <= '1';
+		else
+			idle_q <= '0';
+		end if;
+
+		case st is
+
+			when b_idle =>
+				if rd_s(1) = '1' or wr_s(1) = '1' then
+					lat_a <= a_p1;
+					lat_d <= d_p1;
+					lat_wr <= wr_s(1);
+					if idle_q = '1' then
+						serve(a_p1, d_p1, wr_s(1));
+					else
+						lk_a <= a_p1;
+						st <= b_lookup;
+					end if;
+				elsif pf_ready = '1' and mreq_s(1) = '0' then
+					-- install the prefetched line while the bus is quiet
+					pf_ready <= '0';
+					inst_a <= pf_a;
+					inst_cnt <= (others => '0');
+					inst_ret <= b_idle;
+					st <= b_install;
+				end if;
+
+			when b_lookup =>
+				st <= b_compare;
 
+			when b_compare =>
+				serve(lat_a, lat_d, lat_wr);
+
+			when b_wait_engine =>
+				if pf_ready = '1' then
+					pf_ready <= '0';
+					inst_a <= pf_a;
+					inst_cnt <= (others => '0');
+					inst_ret <= b_wait_engine;
+					st <= b_install;
+				elsif pend = '0' then
+					lk_a <= lat_a;
+					st <= b_lookup;
+				end if;
+
+			when b_fill =>
+				if pend = '0' then
+					do_r <= line_byte(fill_line, unsigned(lat_a(LINE_BITS-1 downto 0)));
+					ack_set <= '1';
+					inst_a <= lat_a;
+					inst_cnt <= (others => '0');
+					inst_ret <= b_prefetch;
+					st <= b_install;
+				end if;
+
+			when b_install =>
+				if inst_cnt = 0 then
+					tag_we <= '1';
+					tag_wa <= inst_a(IDX_HI-1 downto LINE_BITS);
+					tag_wd <= '1' & inst_a(20 downto IDX_HI);
+				end if;
+				data_we <= '1';
+				data_wa <= inst_a(IDX_HI-1 downto LINE_BITS) & std_logic_vector(inst_cnt);
+				data_wd <= line_byte(fill_line, inst_cnt);
+				inst_cnt <= inst_cnt + 1;
+				if inst_cnt = 2**LINE_BITS-1 then
+					st <= inst_ret;
+				end if;
+
+			when b_prefetch =>
+				lk_a <= std_logic_vector(unsigned(lat_a(20 downto LINE_BITS)) + 1) & "000";
+				st <= b_pf_lookup;
+
+			when b_pf_lookup =>
+				st <= b_pf_compare;
+
+			when b_pf_compare =>
+				if hit = '0' and pend = '0' then
+					req_wr <= '0';
+					req_a <= lk_a;
+					req_t <= not(req_t);
+					pend <= '1';
+					pf_pend <= '1';
+					pf_a <= lk_a;
+				end if;
+				st <= b_idle;
+
+			-- wait for the acknowledge to pass the strobe synchronizers
+			when b_done =>
+				done_cnt <= done_cnt + 1;
+				if done_cnt = 2 then
+					st <= b_idle;
+				end if;
+
+		end case;
+
+		if st = b_idle and pend = '0' and pf_ready = '0' then
+			busy_r <= '0';
+		else
+			busy_r <= '1';
+		end if;
+
+	end if;
+end process;
+
+-- access acknowledge, cleared as soon as the strobes are released
+process (CLK_BUS, N_RD, N_WR)
+begin
+	if N_RD = '1' and N_WR = '1' then
+		ack <= '0';
+	elsif rising_edge(CLK_BUS) then
+		if ack_set = '1' then
+			ack <= '1';
+		end if;
+	end if;
+end process;
+
+-- reads wait until served, writes (mreq without rd) wait only while the previous write is in flight
+N_WAIT <= '0' when ack = '0' and (N_RD = '0' or (N_MREQ = '0' and busy_r = '1')) else '1';
+
+DO <= do_r;
+BUSY <= busy_r;
+HITS <= std_logic_vector(hit_cnt);
+MISSES <= std_logic_vector(miss_cnt);
+
+-------------------------------------------------------------------------------
+-- QSPI engine
+
+process (CLK_QSPI)
+begin
+	if rising_edge(CLK_QSPI) then
+
+		req_s <= req_s(0) & req_t;
+
+		case es is
+
+			-- power up delay
+			when e_por =>
+				por_cnt <= por_cnt + 1;
+				if por_cnt = 2**13-1 then
+					init_cnt <= (others => '0');
+					es <= e_init;
+				end if;
+
+			-- leave QPI mode, reset and switch to QPI mode, one command per transaction
+			when e_init =>
+				if q_wr = '0' then
+					q_wr <= '1';
+					q_spd <= '0';
+					q_dir <= '1';
+					q_len <= "00";
+					case init_cnt is
+						when "00" =>
+							q_word <= CMD_QPI_OFF & X"000000";
+							q_spd <= '1';
+						when "01" => q_word <= CMD_RESET_EN & X"000000";
+						when "10" => q_word <= CMD_RESET & X"000000";
+						when others => q_word <= CMD_QPI_ON & X"000000";
+					end case;
+				elsif q_busy = '0' then
+					q_wr <= '0';
+					es <= e_init_end;
+				end if;
+
+			when e_init_end =>
+				if q_busy = '0' then
+					init_cnt <= init_cnt + 1;
+					if init_cnt = 3 then
+						es <= e_idle;
+					else
+						es <= e_init;
+					end if;
+				end if;
+
+			when e_idle =>
+				if req_s(1) /= req_seen then
+					req_seen <= req_s(1);
+					word_cnt <= (others => '0');
+					valid_cnt <= (others => '0');
+					q_wr <= '1';
+					q_spd <= '1';
+					q_dir <= '1';
+					q_len <= "11";
+					if req_wr = '1' then
+						q_word <= CMD_WRITE & "000" & req_a;
+						es <= e_write;
+					else
+						q_word <= CMD_READ & "000" & req_a;
+						es <= e_fill;
+					end if;
+				end if;
+
+			-- command + address, 6 wait cycles, 8 bytes
+			when e_fill =>
+				if q_valid = '1' then
+					valid_cnt <= valid_cnt + 1;
+					if valid_cnt = 2 then
+						fill_line(63 downto 32) <= q_oword;
+					elsif valid_cnt = 3 then
+						fill_line(31 downto 0) <= q_oword;
+					end if;
+				end if;
+				if q_wr = '1' and q_busy = '0' then
+					word_cnt <= word_cnt + 1;
+					q_dir <= '0';
+					case word_cnt is
+						when "00" => q_len <= "10"; -- wait cycles
+						when "01" => q_len <= "11";
+						when "10" => q_len <= "11";
+						when others => q_wr <= '0';
+					end case;
+				end if;
+				if q_wr = '0' and q_busy = '0' then
+					es <= e_end;
+				end if;
+
+			-- command + address, 1 byte
+			when e_write =>
+				if q_wr = '1' and q_busy = '0' then
+					word_cnt <= word_cnt + 1;
+					if word_cnt = 0 then
+						q_len <= "00";
+						q_word <= req_d & X"000000";
+					else
+						q_wr <= '0';
+					end if;
+				end if;
+				if q_wr = '0' and q_busy = '0' then
+					es <= e_end;
+				end if;
+
+			when e_end =>
+				done_t <= not(done_t);
+				es <= e_idle;
+
+		end case;
+	end if;
+end process;
+
+U_QSPI: llqspi
+port map (
+	i_clk => CLK_QSPI,
+	i_wr => q_wr,
+	i_hold => '0',
+	i_word => q_word,
+	i_len => q_len,
+	i_spd => q_spd,
+	i_dir => q_dir,
+	o_word => q_oword,
+	o_valid => q_valid,
+	o_busy => q_busy,
+	o_sck => SPI_SCLK,
+	o_cs_n => SPI_N_CS,
+	o_mod => q_mod,
+	o_dat => q_dat,
+	i_dat => SPI_SIO
+);
+
+-- spi mode: SIO0 is MOSI, SIO1 is MISO, SIO2/SIO3 are held high; quad mode: all out or all in
+SPI_SIO(0) <= q_dat(0) when q_mod /= "11" else 'Z';
+SPI_SIO(1) <= q_dat(1) when q_mod = "10" else 'Z';
+SPI_SIO(2) <= q_dat(2) when q_mod /= "11" else 'Z';
+SPI_SIO(3) <= q_dat(3) when q_mod /= "11" else 'Z';
+
+end RTL;
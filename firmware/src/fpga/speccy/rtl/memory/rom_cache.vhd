@@ -0,0 +1,167 @@
+-------------------------------------------------------------------------------
+-- ROM cache
+--
+-- Keeps the ROM bytes the CPU reads from the external RAM in block RAM:
+-- 1. Direct-mapped, 2^CACHE_INDEX_BITS lines x 8 bytes, a valid bit per byte
+-- 2. A and RD come from the CPU pins without a synchronizer, so the lookup
+--    never uses them directly: A is sampled on the falling CLK edge (a_s),
+--    the block ram looks a_s up on the rising edge and A is sampled once more
+--    on that edge (a_r). HIT needs both samples to match and RD sampled on
+--    the same rising edge, it only changes on a rising edge.
+-- 3. At 28 MHz a lookup sampled at the falling edge of T1 gives HIT at the
+--    rising edge of T2, before the CPU samples WAIT on the falling edge of T2,
+--    DO is valid well before T3. The Z84C0020 is rated for 20 MHz, its address
+--    delay at 28 MHz is not specified: an address which is not stable at the
+--    falling edge of T1 makes the samples differ, the read misses and takes its
+--    wait state, the lookup of the next edges can still hit in the wait state.
+-- 4. A miss is read from the RAM as before, the byte on RAM_DI at the last
+--    falling edge of the read is stored when the read ends, if A was the same
+--    on the last two falling edges
+-- 5. FLUSH clears the cache, the sweep takes 2^CACHE_INDEX_BITS clocks and
+--    every read misses while it runs
+--
+-- A is the ROM bank, the 16K page and the offset, so bank and page switches
+-- need no flush. A whole page or bank does not fit in the EP4CE6 next to the
+-- 16K VRAM and the OSD font, the cache keeps the code the CPU runs.
+-------------------------------------------------------------------------------
+
+library IEEE;
+use IEEE.std_logic_1164.all;
+use IEEE.numeric_std.all;
+
+entity rom_cache is
+generic (
+	CACHE_INDEX_BITS : integer := 8 -- 256 lines x 8 bytes
+);
+port (
+	CLK 			: in std_logic; -- 28 MHz
+	FLUSH 		: in std_logic; -- the rom area of the ram is being written
+
+	A 				: in std_logic_vector(18 downto 0); -- rom bank & page & offset
+	RD 			: in std_logic; -- cpu rom read
+	RAM_DI 		: in std_logic_vector(7 downto 0);
+	RAM_WAIT_N 	: in std_logic := '1'; -- psram read in progress
+
+	DO 			: out std_logic_vector(7 downto 0);
+	HIT 			: out std_logic
+);
+end rom_cache;
+
+architecture RTL of rom_cache is
+
+	constant LINE_BITS : integer := 3; -- 8 bytes per line
+	constant IDX_HI : integer := LINE_BITS + CACHE_INDEX_BITS; -- lowest tag bit
+	constant TAG_BITS : integer := 19 - IDX_HI;
+
+	type data_ram_t is array(0 to 2**IDX_HI-1) of std_logic_vector(7 downto 0);
+	type tag_ram_t is array(0 to 2**CACHE_INDEX_BITS-1) of std_logic_vector(TAG_BITS+7 downto 0); -- byte valid bits & tag
+	signal data_ram 	: data_ram_t;
+	signal tag_ram 	: tag_ram_t := (others => (others => '0'));
+
+	signal a_s 			: std_logic_vector(18 downto 0) := (others => '0'); -- A on the falling edge, the lookup address
+	signal a_q 			: std_logic_vector(18 downto 0) := (others => '0'); -- address of tag_q / data_q
+	signal a_r 			: std_logic_vector(18 downto 0) := (others => '0'); -- A on the rising edge
+	signal rd_r 		: std_logic := '0'; -- RD on the rising edge
+	signal data_q 		: std_logic_vector(7 downto 0);
+	signal tag_q 		: std_logic_vector(TAG_BITS+7 downto 0) := (others => '0');
+	signal line_valid : std_logic_vector(7 downto 0); -- valid bytes of the line in a_q
+	signal lookup_hit : std_logic;
+
+	signal data_we 	: std_logic := '0';
+	signal data_wa 	: std_logic_vector(IDX_HI-1 downto 0) := (others => '0');
+	signal data_wd 	: std_logic_vector(7 downto 0) := (others => '0');
+	signal tag_we 		: std_logic := '0';
+	signal tag_wa 		: unsigned(CACHE_INDEX_BITS-1 downto 0) := (others => '0');
+	signal tag_wd 		: std_logic_vector(TAG_BITS+7 downto 0) := (others => '0');
+
+	signal rd_q 		: std_logic := '0';
+	signal fill_a 		: std_logic_vector(18 downto 0) := (others => '0');
+	signal fill_d 		: std_logic_vector(7 downto 0) := (others => '0');
+	signal fill_valid : std_logic_vector(7 downto 0) := (others => '0'); -- valid bytes of the line to keep
+	signal fill_ok 	: std_logic := '0'; -- the last byte on RAM_DI was a good miss read
+
+	signal flushing 	: std_logic := '0';
+	signal flush_cnt 	: unsigned(CACHE_INDEX_BITS-1 downto 0) := (others => '0');
+
+begin
+
+-- block ram, written and read on the rising edge, the read address is a register
+process (CLK)
+begin
+	if CLK'event and CLK = '1' then
+		if data_we = '1' then
+			data_ram(to_integer(unsigned(data_wa))) <= data_wd;
+		end if;
+		if tag_we = '1' then
+			tag_ram(to_integer(tag_wa)) <= tag_wd;
+		end if;
+		data_q <= data_ram(to_integer(unsigned(a_s(IDX_HI-1 downto 0))));
+		tag_q <= tag_ram(to_integer(unsigned(a_s(IDX_HI-1 downto LINE_BITS))));
+		a_q <= a_s;
+		a_r <= A;
+		rd_r <= RD;
+	end if;
+end process;
+
+line_valid <= tag_q(TAG_BITS+7 downto TAG_BITS) when tag_q(TAG_BITS-1 downto 0) = a_q(18 downto IDX_HI) else (others => '0');
+
+-- the lookup belongs to the address still on the bus, only registers in here
+lookup_hit <= '1' when flushing = '0' and rd_r = '1' and a_q = a_r and line_valid(to_integer(unsigned(a_q(LINE_BITS-1 downto 0)))) = '1' else '0';
+
+process (CLK)
+variable byte_bit : std_logic_vector(7 downto 0);
+begin
+	if CLK'event and CLK = '0' then
+		data_we <= '0';
+		tag_we <= '0';
+		a_s <= A;
+		rd_q <= RD;
+
+		if RD = '1' then
+			fill_a <= a_s;
+			fill_d <= RAM_DI;
+			-- a hit is served from here, RAM_DI is only good after a stable miss read
+			if a_s = A then
+				fill_ok <= RAM_WAIT_N and not lookup_hit;
+			else
+				fill_ok <= '0';
+			end if;
+			if a_q(18 downto LINE_BITS) = a_s(18 downto LINE_BITS) then
+				fill_valid <= line_valid;
+			else
+				fill_valid <= (others => '0'); -- unknown line, the new tag starts empty
+			end if;
+		end if;
+
+		if FLUSH = '1' then
+			flushing <= '1';
+			flush_cnt <= (others => '0');
+			fill_ok <= '0';
+		elsif flushing = '1' then
+			tag_we <= '1';
+			tag_wa <= flush_cnt;
+			tag_wd <= (others => '0');
+			flush_cnt <= flush_cnt + 1;
+			if flush_cnt = 2**CACHE_INDEX_BITS-1 then
+				flushing <= '0';
+			end if;
+			fill_ok <= '0';
+		elsif rd_q = '1' and RD = '0' and fill_ok = '1' then
+			-- the read is over, store its byte
+			byte_bit := (others => '0');
+			byte_bit(to_integer(unsigned(fill_a(LINE_BITS-1 downto 0)))) := '1';
+			data_we <= '1';
+			data_wa <= fill_a(IDX_HI-1 downto 0);
+			data_wd <= fill_d;
+			tag_we <= '1';
+			tag_wa <= unsigned(fill_a(IDX_HI-1 downto LINE_BITS));
+			tag_wd <= (fill_valid or byte_bit) & fill_a(18 downto IDX_HI);
+			fill_ok <= '0';
+		end if;
+	end if;
+end process;
+
+DO <= data_q;
+HIT <= lookup_hit;
+
+end RTL;
@@ -0,0 +1,225 @@
+-------------------------------------------------------------------------------
+-- SD to RAM DMA
+--
+-- Reads 512 byte sectors from the SD card straight into RAM.
+-- The software selects the card and sends CMD17 / CMD18 through the
+-- DivMMC or Z-Controller ports as usual, then starts the DMA, which waits for
+-- the data token, stores 512 bytes, skips the CRC and repeats for every sector.
+-- The CPU is held with WAIT while the DMA owns the RAM bus (like the loader does).
+--
+-- Ports:
+-- #00AB 	RAM address bits 7..0
+-- #01AB 	RAM address bits 15..8
+-- #02AB 	RAM address bits 20..16 (physical, 16K page N starts at N * #4000)
+-- #03AB 	Write: count of sectors to read, starts the transfer
+--       	Read:  bit 7 = busy, bit 6 = token timeout / data error
+-- The address advances with the transfer, so the next read continues after it.
+-------------------------------------------------------------------------------
+
+library IEEE;
+use IEEE.std_logic_1164.all;
+use IEEE.std_logic_unsigned.all;
+
+entity sd_dma is
+generic (
+	TOKEN_TIMEOUT 	: integer := 19 -- wait up to 2^TOKEN_TIMEOUT bytes for the data token (~150 ms)
+);
+port (
+	CLK 			: in std_logic; -- 28 MHz
+	RESET 		: in std_logic;
+
+	-- cpu ports
+	A 				: in std_logic_vector(15 downto 0);
+	DI 			: in std_logic_vector(7 downto 0);
+	DO 			: out std_logic_vector(7 downto 0);
+	N_IORQ 		: in std_logic;
+	N_WR 			: in std_logic;
+	N_M1 			: in std_logic;
+	N_WAIT 		: out std_logic;
+
+	-- RAM interface
+	DMA_ACTIVE 	: out std_logic;
+	RAM_A 		: out std_logic_vector(20 downto 0);
+	RAM_DO 		: out std_logic_vector(7 downto 0);
+	RAM_WR 		: out std_logic;
+	RAM_BUSY 	: in std_logic := '0'; -- previous write is still in progress (psram)
+
+	-- SD card, MOSI is held high while reading
+	SCLK 			: out std_logic;
+	MISO 			: in std_logic
+);
+end sd_dma;
+
+architecture rtl of sd_dma is
+
+	-- spi byte engine, same as in divmmc / zcontroller
+	signal cnt 			: std_logic_vector(3 downto 0) := "1000";
+	signal cnt_en 		: std_logic;
+	signal shift_in 	: std_logic_vector(7 downto 0);
+	signal spi_start 	: std_logic := '0';
+
+	signal port_sel 	: std_logic;
+	signal port_wr 	: std_logic;
+	signal prev_wr 	: std_logic := '0';
+
+	signal ram_a_bus 	: std_logic_vector(20 downto 0) := (others => '0');
+	signal sectors 	: std_logic_vector(7 downto 0) := (others => '0');
+	signal bytes 		: std_logic_vector(9 downto 0) := (others => '0'); -- bytes of the sector stored
+	signal timeout 	: std_logic_vector(TOKEN_TIMEOUT downto 0) := (others => '0');
+	signal dma_err 		: std_logic := '0';
+	signal act 			: std_logic := '0';
+	signal wr_cnt 		: std_logic_vector(1 downto 0) := "00";
+
+	type machine is (idle, token, token_wait, data, data_wait, data_store, crc, crc_wait, finish);
+	signal state 		: machine := idle;
+
+begin
+
+	port_sel <= '1' when N_IORQ = '0' and N_M1 = '1' and A(7 downto 0) = X"AB" and A(15 downto 10) = "000000" else '0';
+	port_wr <= '1' when port_sel = '1' and N_WR = '0' else '0';
+
+	process (RESET, CLK)
+	begin
+		if RESET = '1' then
+			act <= '0';
+			dma_err <= '0';
+			spi_start <= '0';
+			RAM_WR <= '0';
+			wr_cnt <= "00";
+			state <= idle;
+		elsif CLK'event and CLK = '1' then
+			prev_wr <= port_wr;
+			spi_start <= '0';
+
+			-- ram write pulse, the address advances at its end
+			if wr_cnt /= "00" then
+				wr_cnt <= wr_cnt - 1;
+				if wr_cnt = "01" then
+					RAM_WR <= '0';
+					ram_a_bus <= ram_a_bus + 1;
+				end if;
+			end if;
+
+			case state is
+
+				when idle =>
+					if port_wr = '1' then
+						case A(9 downto 8) is
+							when "00" => ram_a_bus(7 downto 0) <= DI;
+							when "01" => ram_a_bus(15 downto 8) <= DI;
+							when "10" => ram_a_bus(20 downto 16) <= DI(4 downto 0);
+							when others =>
+								if prev_wr = '0' and DI /= X"00" then
+									sectors <= DI;
+									dma_err <= '0';
+									act <= '1';
+									state <= token;
+								end if;
+						end case;
+					end if;
+
+				-- wait for the start block token
+				when token =>
+					timeout <= (others => '0');
+					spi_start <= '1';
+					state <= token_wait;
+				when token_wait =>
+					if cnt(3) = '1' then
+						if shift_in = X"FE" then
+							bytes <= (others => '0');
+							spi_start <= '1';
+							state <= data_wait;
+						elsif shift_in /= X"FF" or timeout(TOKEN_TIMEOUT) = '1' then
+							dma_err <= '1'; -- data error token or no answer
+							state <= finish;
+						else
+							timeout <= timeout + 1;
+							spi_start <= '1';
+						end if;
+					end if;
+
+				-- 512 data bytes, the next byte shifts in while the previous one is written
+				when data =>
+					spi_start <= '1';
+					state <= data_wait;
+				when data_wait =>
+					if cnt(3) = '1' then
+						state <= data_store;
+					end if;
+				when data_store =>
+					if wr_cnt = "00" and RAM_BUSY = '0' then
+						RAM_DO <= shift_in;
+						RAM_WR <= '1';
+						wr_cnt <= "10";
+						bytes <= bytes + 1;
+						if bytes = "1111111111" then
+							state <= crc;
+						else
+							-- shift_in is kept until the first falling edge after the start, 9 clocks per byte
+							spi_start <= '1';
+							state <= data_wait;
+						end if;
+					end if;
+
+				-- skip 2 crc bytes
+				when crc =>
+					bytes <= (others => '0');
+					spi_start <= '1';
+					state <= crc_wait;
+				when crc_wait =>
+					if cnt(3) = '1' then
+						if bytes(0) = '0' then
+							bytes(0) <= '1';
+							spi_start <= '1';
+						elsif sectors = X"01" then
+							state <= finish;
+						else
+							sectors <= sectors - 1;
+							state <= token;
+						end if;
+					end if;
+
+				when finish =>
+					if wr_cnt = "00" then
+						act <= '0';
+						state <= idle;
+					end if;
+
+			end case;
+		end if;
+	end process;
+
+	cnt_en <= not cnt(3) or cnt(2) or cnt(1) or cnt(0);
+
+	process (CLK)
+	begin
+		if (CLK'event and CLK = '0') then
+			if spi_start = '1' then
+				cnt <= "0000";
+			elsif cnt_en = '1' then
+				cnt <= cnt + 1;
+			end if;
+		end if;
+	end process;
+
+	process (CLK)
+	begin
+		if (CLK'event and CLK = '0') then
+			if cnt(3) = '0' then
+				shift_in <= shift_in(6 downto 0) & MISO;
+			end if;
+		end if;
+	end process;
+
+	SCLK <= CLK and not cnt(3);
+
+	DO <= ram_a_bus(7 downto 0) when A(9 downto 8) = "00" else
+			ram_a_bus(15 downto 8) when A(9 downto 8) = "01" else
+			"000" & ram_a_bus(20 downto 16) when A(9 downto 8) = "10" else
+			act & dma_err & "000000";
+
+	N_WAIT <= not act;
+	DMA_ACTIVE <= act;
+	RAM_A <= ram_a_bus;
+
+end rtl;
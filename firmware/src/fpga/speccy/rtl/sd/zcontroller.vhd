@@ -16,6 +16,7 @@
 --
 -- Data port 57h
 -- Read/write port to exchange data by SPI.
+-- CLK is the fixed 28 MHz clock, the SD clock does not follow the CPU turbo.
 
 library IEEE;
 use IEEE.std_logic_1164.all;
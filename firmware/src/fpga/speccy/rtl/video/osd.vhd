@@ -15,7 +15,7 @@ entity osd is
 		BLINK 	: in std_logic;
 		
 		-- sensors
-		TURBO 			: in std_logic := '0';
+		TURBO 			: in std_logic_vector(1 downto 0) := "00";
 		SCANDOUBLER_EN : in std_logic := '0';
 		MODE60 			: in std_logic := '0';
 		ROM_BANK 		: in std_logic_vector := "00";
@@ -55,6 +55,10 @@ architecture rtl of osd is
 	
 	-- Define messages displayed
 	constant message_turbo: 	lcd_line_type 	:= "TURBO   ";
+	constant message_3mhz: 		lcd_line_type 	:= "3.5 MHz ";
+	constant message_7mhz: 		lcd_line_type 	:= "7 MHz   ";
+	constant message_14mhz: 	lcd_line_type 	:= "14 MHz  ";
+	constant message_28mhz: 	lcd_line_type 	:= "28 MHz  ";
 	constant message_vga: 		lcd_line_type 	:= "VGA     ";
 	constant message_rgb: 		lcd_line_type 	:= "RGB     ";
 	constant message_on:	 		lcd_line_type 	:= "ON      ";
@@ -81,7 +85,7 @@ architecture rtl of osd is
 	signal line1 : lcd_line_type := message_empty;
 	signal line2 : lcd_line_type := message_empty;
 	
-	signal last_turbo : std_logic := '0';
+	signal last_turbo : std_logic_vector(1 downto 0) := "00";
 	signal last_scandoubler_en : std_logic := '0';
 	signal last_mode60 : std_logic := '0';
 	signal last_rom_bank : std_logic_vector(1 downto 0) := "00";
@@ -181,11 +185,12 @@ begin
 				last_turbo <= TURBO;
 				cnt <= "0000";
 				line1 <= message_turbo;
-				if (turbo = '0') then 
-					line2 <= message_on;
-				else 
-					line2 <= message_off;
-				end if;
+				case TURBO is 
+					when "00" => line2 <= message_3mhz;
+					when "01" => line2 <= message_7mhz;
+					when "10" => line2 <= message_14mhz;
+					when others => line2 <= message_28mhz;
+				end case;
 			end if;
 			
 			-- vga/rgb 50/60 hz switches
@@ -10,17 +10,16 @@
 --------------------------------------------------------------------------------
 
 library IEEE;
-library altera; 
 use IEEE.std_logic_1164.all;
 use IEEE.std_logic_unsigned.all;
-use altera.altera_primitives_components.all;
 
 entity VGA_PAL is
 	generic 
 	(
 		inverse_ksi 		 : boolean := false;
 		inverse_ssi 		 : boolean := false;
-		inverse_f 			 : boolean := false
+		inverse_f 			 : boolean := false;
+		line_lock 			 : boolean := false  -- второй VGA-строкой выводить текущую строку VIDEO
 	);
 	port
 	(
@@ -43,7 +42,10 @@ EN 			: in std_logic := '1'; -- включен ли даблер или отда
 
 RGB_O 	  : out std_logic_vector(5 downto 0) := (others => '0'); -- VGA RGB
 VSYNC_VGA  : out std_logic := '1'; -- кадровые синхроимпульсы
-HSYNC_VGA  : out std_logic := '1' -- строчные синхроимпульсы
+HSYNC_VGA  : out std_logic := '1'; -- строчные синхроимпульсы
+
+-- задержка кадрового СИ VGA от кадрового СИ VIDEO, в тактах CLK
+LATENCY    : out std_logic_vector(19 downto 0) := (others => '0')
 
 );
     end VGA_PAL;
@@ -76,7 +78,7 @@ signal SSI_2  : std_logic; -- задержанные строчные синхр
 -- строчная развертка VGA:
 
 signal VGA_H_CLK     : std_logic; -- сигнал увеличения счетчика тактов в строке
-signal VGA_H         : std_logic_vector(8 downto 0); -- счетчик тактов в строке
+signal VGA_H         : std_logic_vector(8 downto 0) := (others => '0'); -- счетчик тактов в строке
 signal VGA_H_MIN     : std_logic_vector(8 downto 0); -- мин. знач.счетч. тактов
 signal VGA_H_MAX     : std_logic_vector(8 downto 0); -- макс.знач.счетч. тактов
 signal VGA_SSI1_BGN   : std_logic_vector(9 downto 0); -- начало строчного СИ
@@ -91,7 +93,7 @@ signal VGA_SGI2_END   : std_logic_vector(9 downto 0); -- конец  строч
 -- кадровая развертка VGA:
 
 signal VGA_V_CLK     : std_logic; -- сигнал увеличения счетчика строк в кадре
-signal VGA_V         : std_logic_vector(9 downto 0); -- счетчик строк в кадре
+signal VGA_V         : std_logic_vector(9 downto 0) := (others => '0'); -- счетчик строк в кадре
 signal VGA_V_MIN     : std_logic_vector(9 downto 0); -- мин. знач.счетчика строк
 signal VGA_V_MAX     : std_logic_vector(9 downto 0); -- макс.знач.счетчика строк
 signal VGA_KSI_BGN   : std_logic_vector(9 downto 0); -- начало кадрового СИ
@@ -102,7 +104,7 @@ signal VGA_KGI2_BGN  : std_logic_vector(9 downto 0); -- начало кадро
 -- строчная развертка VIDEO:
 
 signal VIDEO_H_CLK   : std_logic; -- сигнал увеличения счетчика тактов в строке
-signal VIDEO_H       : std_logic_vector(9 downto 0); -- счетчик тактов в строке
+signal VIDEO_H       : std_logic_vector(9 downto 0) := (others => '0'); -- счетчик тактов в строке
 signal VIDEO_H_MAX   : std_logic_vector(9 downto 0); -- макс.знач. счетч. тактов
 signal VIDEO_SSI_BGN : std_logic_vector(9 downto 0); -- начало строчного СИ
 signal VIDEO_SSI_END : std_logic_vector(9 downto 0); -- конец  строчного СИ
@@ -112,7 +114,7 @@ signal VIDEO_SGI_END : std_logic_vector(9 downto 0); -- конец  строчн
 -- кадровая развертка VIDEO:
 
 signal VIDEO_V_CLK   : std_logic;  --сигнал увеличения счетчика строк в кадре
-signal VIDEO_V       : std_logic_vector(8 downto 0); -- счетчик строк в кадре
+signal VIDEO_V       : std_logic_vector(8 downto 0) := (others => '0'); -- счетчик строк в кадре
 signal VIDEO_V_MAX   : std_logic_vector(8 downto 0); -- макс.знач. счетч. тактов
 signal VIDEO_KSI_BGN : std_logic_vector(8 downto 0); -- начало кадрового СИ
 signal VIDEO_KSI_END : std_logic_vector(8 downto 0); -- конец  кадрового СИ
@@ -158,6 +160,19 @@ signal VIDEO_BLANK  : std_logic; -- гасящие импульсы для VIDEO
 
 signal RD_REG       : std_logic_vector(5 downto 0);
 
+--------------------------------------------------------------------------------
+--                 ЧТЕНИЕ БЕЗ ЗАДЕРЖКИ НА СТРОКУ (line_lock)                  --
+--------------------------------------------------------------------------------
+
+signal VGA_H2       : std_logic; -- вторая строка VGA в строке VIDEO
+signal RD_BANK      : std_logic; -- половина буфера для чтения
+signal VGA_VL       : std_logic_vector(9 downto 0); -- счетчик строк VGA для СИ/ГИ
+
+signal KSI_N        : std_logic; -- нормализованный входной кадровый СИ
+signal KSI_N_1      : std_logic;
+signal VGA_KSI_1    : std_logic;
+signal LAT_CNT      : std_logic_vector(19 downto 0) := (others => '0');
+
 begin
 
 --------------------------------------------------------------------------------
@@ -369,12 +384,12 @@ VGA_SGI  <= '0' when (VGA_H <= VGA_SGI1_END)
 --                   ФОРМИРОВАНИЕ КАДРОВЫХ ИМПУЛЬСОВ VGA              091223  --
 --------------------------------------------------------------------------------
 -- кадровые синхроимпульсы для VIDEO
-VGA_KSI  <= '0' when (VGA_V >= VGA_KSI_BGN) 
-                 and (VGA_V <= VGA_KSI_END) 
+VGA_KSI  <= '0' when (VGA_VL >= VGA_KSI_BGN) 
+                 and (VGA_VL <= VGA_KSI_END) 
                 else '1';
 -- кадровые гасящие импульсы для VIDEO
-VGA_KGI  <= '0' when (VGA_V <= VGA_KGI1_END) 
-                  or (VGA_V >= VGA_KGI2_BGN )  
+VGA_KGI  <= '0' when (VGA_VL <= VGA_KGI1_END) 
+                  or (VGA_VL >= VGA_KGI2_BGN )  
                 else '1';
                   
 --------------------------------------------------------------------------------
@@ -427,6 +442,17 @@ VIDEO_BLANK <= VIDEO_KGI and VIDEO_SGI;
 --------------------------------------------------------------------------------
 --                     VIDEO ОЗУ                										--
 --------------------------------------------------------------------------------
+-- строка VIDEO пишется в половину VIDEO_V(0), за время строки VIDEO выводятся
+-- две строки VGA с удвоенной скоростью. обычно обе читают предыдущую строку
+-- (задержка на строку VIDEO, 64 мкс).
+-- line_lock: вторая строка VGA начинается, когда половина строки VIDEO уже
+-- записана, и читает текущую строку - чтение всегда отстает от записи.
+-- каждая строка выводится по-прежнему дважды, но на полстроки раньше (32 мкс),
+-- кадровые СИ и ГИ VGA сдвинуты на строку VGA раньше, картинка стоит на месте.
+
+VGA_H2  <= '1' when VIDEO_H > VGA_H_MAX else '0';
+RD_BANK <= VIDEO_V(0) when line_lock and VGA_H2 = '1' else not VIDEO_V(0);
+VGA_VL  <= VGA_V + 1 when line_lock else VGA_V;
 
 LINEBUF: entity work.linebuf
 port map (
@@ -436,7 +462,7 @@ port map (
 	wren_a 	 => '1',
 	q_a 		 => open,
 	
-	address_b => (not VIDEO_V(0)) & VGA_H(8 downto 0) & CLK,
+	address_b => RD_BANK & VGA_H(8 downto 0) & CLK,
 	clock_b 	 => VGA_RBGI_CLK,
 	data_b 	 => (others => '1'),
 	wren_b 	 => '0',
@@ -462,6 +488,29 @@ if (rising_edge(CLK)) then  -- если фронт тактового импул
   end if;
 end process;
 
+--------------------------------------------------------------------------------
+-- задержка от спада входного кадрового СИ до спада кадрового СИ VGA
+
+KSI_N <= not KSI_IN when inverse_ksi else KSI_IN;
+
+process (CLK)
+begin
+  if (rising_edge(CLK)) then
+    KSI_N_1   <= KSI_N;
+    VGA_KSI_1 <= VGA_KSI;
+    if (KSI_N_1 = '1' and KSI_N = '0') then
+      LAT_CNT <= (others => '0');
+    else
+      if (VGA_KSI_1 = '1' and VGA_KSI = '0') then
+        LATENCY <= LAT_CNT;
+      end if;
+      if (LAT_CNT /= x"FFFFF") then
+        LAT_CNT <= LAT_CNT + 1;
+      end if;
+    end if;
+  end if;
+end process;
+
 -- удвоение частоты с помощью задержанного сигнала
 VGA_RBGI_CLK <= CLK2; 
       
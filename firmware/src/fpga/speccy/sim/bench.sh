@@ -0,0 +1,55 @@
+#!/bin/sh
+#
+# SCK sweep of the AVR <-> cpld_kbd SPI link, run by "make bench"
+#
+# Replays every frame file at each rate and prints the errors and the
+# frame-to-output latency in 28 MHz clocks. The fastest reliable rate is the
+# last one before the first failure.
+#
+# RATES="..." GAP=ns BYTE_GAP=ns ./bench.sh frames/*.frm
+
+GHDL=${GHDL:-ghdl}
+GHDL_FLAGS=${GHDL_FLAGS:-"--std=08 -fsynopsys --workdir=work"}
+RATES=${RATES:-"1000000 2000000 4000000 8000000 10000000 12000000 14000000 16000000 20000000 28000000"}
+GAP=${GAP:-1000}
+BYTE_GAP=${BYTE_GAP:-0}
+TOP=tb_cpld_kbd
+
+field() {
+	echo "$1" | sed -n "s/.* $2=\([0-9]*\).*/\1/p"
+}
+
+best=0
+failed=0
+lat_max=0
+
+printf "%10s  %-22s %7s %7s %7s %7s %7s\n" "sck_hz" "frames" "errors" "lat_min" "lat_avg" "lat_max" ""
+for sck in $RATES; do
+	ok=1
+	for f in "$@"; do
+		res=$($GHDL -r $GHDL_FLAGS $TOP -gFRAMES="$f" -gSCK_HZ="$sck" -gGAP_NS="$GAP" -gBYTE_GAP_NS="$BYTE_GAP" 2>&1 | grep RESULT)
+		errors=$(field "$res" errors)
+		if [ -z "$errors" ]; then
+			errors="crash"
+		fi
+		status="ok"
+		if [ "$errors" != "0" ]; then
+			status="FAIL"
+			ok=0
+		fi
+		printf "%10s  %-22s %7s %7s %7s %7s %7s\n" "$sck" "$(basename "$f")" "$errors" \
+			"$(field "$res" latency_min)" "$(field "$res" latency_avg)" "$(field "$res" latency_max)" "$status"
+		if [ "$status" = "ok" ] && [ "$(field "$res" latency_max)" -gt "$lat_max" ]; then
+			lat_max=$(field "$res" latency_max)
+		fi
+	done
+	if [ $ok = 1 ] && [ $failed = 0 ]; then
+		best=$sck
+	else
+		failed=1
+	fi
+done
+
+echo
+echo "max reliable SCK: $best Hz (SS gap $GAP ns, byte gap $BYTE_GAP ns)"
+echo "worst frame-to-output latency: $lat_max clocks @ 28 MHz"
@@ -0,0 +1,113 @@
+#!/bin/sh
+#
+# Keyboard chain co-simulation, run by "make cosim"
+#
+# Builds the AVR firmware for the host (avr_kbd/cosim), turns every trace of
+# avr_kbd/cosim/traces into a frame file on the firmware timeline and replays
+# it in tb_cpld_kbd at the SCK the firmware calibrated to. The two do not run in
+# lockstep: the host run of the firmware writes all the frame files first (its
+# SPI answers come from the cpld_kbd model in cosim.cpp), GHDL replays them
+# afterwards and nothing of the GHDL run goes back to the firmware.
+# Prints the keystroke to KB latency in 28 MHz clocks, firmware only (avr) and
+# end to end (key), and fails when a run has errors, loses key events, has no
+# avr baseline or is slower than a recorded baseline value by more than
+# TOLERANCE percent. A "-" in the baseline is not checked (key_* until
+# "make cosim-baseline" has been run with GHDL).
+#
+# ./cosim.sh                      check against cosim_baseline.txt
+# UPDATE=1 ./cosim.sh             record the current latencies as the baseline
+# COSTS="-i 0" ./cosim.sh         other firmware costs (cosim.cpp), e.g. env:ATmega8_bare pin access
+
+GHDL=${GHDL:-ghdl}
+GHDL_FLAGS=${GHDL_FLAGS:-"--std=08 -fsynopsys --workdir=work"}
+TOLERANCE=${TOLERANCE:-5}
+BASELINE=${BASELINE:-cosim_baseline.txt}
+COSIM=../../../avr_kbd/cosim
+OUT=$(pwd)/work/cosim
+TOP=tb_cpld_kbd
+
+field() {
+	echo "$1" | sed -n "s/.* $2=\([0-9]*\).*/\1/p"
+}
+
+# a baseline value is missing or not recorded yet ("-")
+unset_base() {
+	case "$1" in
+		''|*[!0-9]*) return 0 ;;
+	esac
+	return 1
+}
+
+# the run is slower than the baseline value, an unset value is not checked
+worse() {
+	! unset_base "$2" && [ "$1" -gt $(($2 + $2 * TOLERANCE / 100)) ]
+}
+
+rm -rf "$OUT"
+mkdir -p "$OUT"
+make -s -C $COSIM frames OUT="$OUT" COSTS="$COSTS" > "$OUT/avr.txt" || exit 1
+
+failed=0
+broken=0
+unchecked=0
+new=""
+printf "%-12s %6s %6s %8s %8s %8s %8s %7s\n" "run" "keys" "errors" "avr_avg" "avr_max" "key_avg" "key_max" ""
+for frm in "$OUT"/*.frm; do
+	run=$(basename "$frm" .frm)
+	trace=${run%_*}
+	decode=${run##*_}
+	avr=$(grep "trace=$trace.ps2 decode=$decode " "$OUT/avr.txt")
+	sck=$(sed -n "s/^# sck_hz=\([0-9]*\).*/\1/p" "$frm")
+	res=$($GHDL -r $GHDL_FLAGS $TOP -gFRAMES="$frm" -gSCK_HZ="$sck" -gGAP_NS=0 2>&1 | grep RESULT)
+
+	keys=$(field "$avr" keys)
+	avr_avg=$(field "$avr" avr_latency_avg)
+	avr_max=$(field "$avr" avr_latency_max)
+	key_avg=$(field "$res" key_latency_avg)
+	key_max=$(field "$res" key_latency_max)
+	errors=$(field "$res" errors)
+	status="ok"
+	if [ -z "$errors" ]; then
+		errors="crash"
+		status="FAIL"
+		broken=1
+	elif [ "$errors" != "0" ] || [ "$(field "$res" keys)" != "$keys" ]; then
+		status="FAIL"
+		broken=1
+	else
+		set -- $(grep "^$run " "$BASELINE" 2>/dev/null)
+		if unset_base "$2" || unset_base "$3"; then
+			status="NOBASE" # a new trace, record it with "make cosim-baseline"
+		elif worse "$avr_avg" "$2" || worse "$avr_max" "$3" || worse "$key_avg" "$4" || worse "$key_max" "$5"; then
+			status="SLOWER"
+		elif unset_base "$4" || unset_base "$5"; then
+			status="ok*"
+			unchecked=1
+		fi
+	fi
+	if [ "$status" != "ok" ] && [ "$status" != "ok*" ]; then
+		failed=1
+	fi
+	printf "%-12s %6s %6s %8s %8s %8s %8s %7s\n" "$run" "$(field "$res" keys)/$keys" "$errors" \
+		"$avr_avg" "$avr_max" "$key_avg" "$key_max" "$status"
+	new="$new$(printf "%-10s %7s %7s %7s %7s" "$run" "$avr_avg" "$avr_max" "$key_avg" "$key_max")
+"
+done
+if [ $unchecked = 1 ]; then
+	echo "ok*: key_avg/key_max have no baseline in $BASELINE and are not checked"
+fi
+
+if [ -n "$UPDATE" ]; then
+	if [ $broken = 1 ]; then
+		echo "not updating $BASELINE, a run failed"
+		exit 1
+	fi
+	{
+		sed -n '/^#/p' "$BASELINE"
+		printf "%s" "$new"
+	} > "$BASELINE.new" && mv "$BASELINE.new" "$BASELINE"
+	echo "baseline recorded in $BASELINE"
+	exit 0
+fi
+
+exit $failed
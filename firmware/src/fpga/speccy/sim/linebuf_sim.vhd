@@ -0,0 +1,57 @@
+-------------------------------------------------------------------------------
+-- linebuf behavioural model for simulation
+--
+-- Same ports as the altsyncram megafunction in rtl/video/linebuf.vhd:
+-- 2048 x 6, registered address and registered output on both ports.
+-- Only port a writes, the scandoubler reads through port b.
+-------------------------------------------------------------------------------
+
+library IEEE;
+use IEEE.std_logic_1164.all;
+use IEEE.numeric_std.all;
+
+entity linebuf is
+port (
+	address_a 	: in std_logic_vector(10 downto 0);
+	address_b 	: in std_logic_vector(10 downto 0);
+	clock_a 		: in std_logic := '1';
+	clock_b 		: in std_logic;
+	data_a 		: in std_logic_vector(5 downto 0);
+	data_b 		: in std_logic_vector(5 downto 0);
+	wren_a 		: in std_logic := '0';
+	wren_b 		: in std_logic := '0';
+	q_a 			: out std_logic_vector(5 downto 0);
+	q_b 			: out std_logic_vector(5 downto 0)
+);
+end linebuf;
+
+architecture sim of linebuf is
+
+	type mem_t is array (0 to 2047) of std_logic_vector(5 downto 0);
+	signal mem 		: mem_t := (others => (others => '0'));
+
+	signal rd_a 	: std_logic_vector(5 downto 0);
+	signal rd_b 	: std_logic_vector(5 downto 0);
+
+begin
+
+	process (clock_a)
+	begin
+		if rising_edge(clock_a) then
+			rd_a <= mem(to_integer(unsigned(address_a)));
+			if wren_a = '1' then
+				mem(to_integer(unsigned(address_a))) <= data_a;
+			end if;
+			q_a <= rd_a;
+		end if;
+	end process;
+
+	process (clock_b)
+	begin
+		if rising_edge(clock_b) then
+			rd_b <= mem(to_integer(unsigned(address_b)));
+			q_b <= rd_b;
+		end if;
+	end process;
+
+end sim;
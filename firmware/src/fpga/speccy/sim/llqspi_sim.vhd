@@ -0,0 +1,226 @@
+-------------------------------------------------------------------------------
+-- llqspi behavioural model for simulation
+--
+-- VHDL translation of the state machine in rtl/memory/llqspi.v (the verilog
+-- core can not be elaborated by GHDL), same ports and the same cycle timing:
+-- SCK idles high, every SCK half period is one i_clk, o_dat changes on the
+-- falling SCK edge and i_dat is sampled when SCK goes low again.
+-------------------------------------------------------------------------------
+
+library IEEE;
+use IEEE.std_logic_1164.all;
+use IEEE.numeric_std.all;
+
+entity llqspi is
+port (
+	i_clk 	: in std_logic;
+	i_wr 		: in std_logic;
+	i_hold 	: in std_logic;
+	i_word 	: in std_logic_vector(31 downto 0);
+	i_len 	: in std_logic_vector(1 downto 0); -- 0 => 8 bits ... 3 => 32 bits
+	i_spd 	: in std_logic; -- 0: spi, 1: quad
+	i_dir 	: in std_logic; -- 0: read, 1: write
+	o_word 	: out std_logic_vector(31 downto 0);
+	o_valid 	: out std_logic;
+	o_busy 	: out std_logic;
+	o_sck 	: out std_logic;
+	o_cs_n 	: out std_logic;
+	o_mod 	: out std_logic_vector(1 downto 0);
+	o_dat 	: out std_logic_vector(3 downto 0);
+	i_dat 	: in std_logic_vector(3 downto 0)
+);
+end llqspi;
+
+architecture sim of llqspi is
+
+	type state_t is (s_idle, s_start, s_bits, s_ready, s_holding, s_stop, s_stop_b);
+	signal state 	: state_t := s_idle;
+
+	signal sck 		: std_logic := '1';
+	signal cs_n 	: std_logic := '1';
+	signal busy 	: std_logic := '0';
+	signal valid 	: std_logic := '0';
+	signal md 		: std_logic_vector(1 downto 0) := "00";
+	signal dat 		: std_logic_vector(3 downto 0) := "1101";
+	signal word 	: std_logic_vector(31 downto 0) := (others => '0');
+
+	signal r_spd 	: std_logic := '0';
+	signal r_dir 	: std_logic := '0';
+	signal spi_len : unsigned(5 downto 0) := (others => '0');
+	signal r_word 	: std_logic_vector(31 downto 0) := (others => '0');
+	signal r_input : std_logic_vector(30 downto 0) := (others => '0');
+
+	function bits(len : std_logic_vector(1 downto 0)) return unsigned is
+	begin
+		return unsigned('0' & len & "000") + 8;
+	end function;
+
+	function mode(spd, dir : std_logic) return std_logic_vector is
+	begin
+		if spd = '1' then
+			return '1' & dir;
+		end if;
+		return "00";
+	end function;
+
+	function first(w : std_logic_vector(31 downto 0); spd : std_logic) return std_logic_vector is
+	begin
+		if spd = '1' then
+			return w(31 downto 28);
+		end if;
+		return "110" & w(31);
+	end function;
+
+	function shifted(w : std_logic_vector(31 downto 0); spd : std_logic) return std_logic_vector is
+	begin
+		if spd = '1' then
+			return w(27 downto 0) & "0000";
+		end if;
+		return w(30 downto 0) & '0';
+	end function;
+
+begin
+
+process (i_clk)
+begin
+	if rising_edge(i_clk) then
+		if state = s_idle and sck = '1' then
+			cs_n <= '1';
+			valid <= '0';
+			busy <= '0';
+			md <= "00";
+			r_word <= i_word;
+			r_spd <= i_spd;
+			r_dir <= i_dir;
+			if i_wr = '1' and busy = '0' then
+				state <= s_start;
+				spi_len <= bits(i_len);
+				cs_n <= '0';
+				busy <= '1';
+			end if;
+
+		elsif state = s_start then
+			-- entered with SCK high, stays until SCK is low
+			sck <= '0';
+			if sck = '0' then
+				state <= s_bits;
+				if r_spd = '1' then
+					spi_len <= spi_len - 4;
+				else
+					spi_len <= spi_len - 1;
+				end if;
+				r_word <= shifted(r_word, r_spd);
+			end if;
+			md <= mode(r_spd, r_dir);
+			cs_n <= '0';
+			busy <= '1';
+			valid <= '0';
+			dat <= first(r_word, r_spd);
+
+		elsif sck = '0' then
+			sck <= '1';
+			if state /= s_ready or i_wr = '0' then
+				busy <= '1';
+			else
+				busy <= '0';
+			end if;
+			valid <= '0';
+
+		elsif state = s_bits then
+			sck <= '0';
+			busy <= '1';
+			dat <= first(r_word, r_spd);
+			r_word <= shifted(r_word, r_spd);
+			if r_spd = '1' then
+				spi_len <= spi_len - 4;
+				if spi_len = 4 then
+					state <= s_ready;
+				end if;
+			else
+				spi_len <= spi_len - 1;
+				if spi_len = 1 then
+					state <= s_ready;
+				end if;
+			end if;
+			valid <= '0';
+			if md(1) = '0' then
+				r_input <= r_input(29 downto 0) & i_dat(1);
+			else
+				r_input <= r_input(26 downto 0) & i_dat;
+			end if;
+
+		elsif state = s_ready or state = s_holding then
+			valid <= '0';
+			cs_n <= '0';
+			busy <= '1';
+			r_spd <= i_spd;
+			r_dir <= i_dir;
+			r_word <= shifted(i_word, i_spd);
+			if state = s_ready then
+				if i_spd = '1' then
+					spi_len <= bits(i_len) - 4;
+				else
+					spi_len <= bits(i_len) - 1;
+				end if;
+			else
+				busy <= '0';
+				if i_spd = '1' then
+					spi_len <= unsigned('0' & i_len & "100");
+				else
+					spi_len <= unsigned('0' & i_len & "111");
+				end if;
+			end if;
+			if busy = '0' and i_wr = '1' then
+				-- next word without a gap
+				state <= s_bits;
+				busy <= '1';
+				sck <= '0';
+				md <= mode(i_spd, i_dir);
+				dat <= first(i_word, i_spd);
+			else
+				sck <= '1';
+				if i_hold = '1' then
+					state <= s_holding;
+				else
+					state <= s_stop;
+				end if;
+				busy <= not(i_hold);
+			end if;
+			if state = s_ready then
+				valid <= '1';
+				if md(1) = '0' then
+					r_input <= r_input(29 downto 0) & i_dat(1);
+					word <= r_input & i_dat(1);
+				else
+					r_input <= r_input(26 downto 0) & i_dat;
+					word <= r_input(27 downto 0) & i_dat;
+				end if;
+			end if;
+
+		elsif state = s_stop then
+			sck <= '1';
+			valid <= '0';
+			busy <= '1';
+			state <= s_stop_b;
+			md <= "00";
+
+		else -- s_stop_b
+			cs_n <= '1';
+			sck <= '1';
+			state <= s_idle;
+			valid <= '0';
+			busy <= '1';
+			md <= "00";
+		end if;
+	end if;
+end process;
+
+o_sck <= sck;
+o_cs_n <= cs_n;
+o_busy <= busy;
+o_valid <= valid;
+o_mod <= md;
+o_dat <= dat;
+o_word <= word;
+
+end sim;
@@ -0,0 +1,317 @@
+-------------------------------------------------------------------------------
+-- cpld_kbd testbench
+--
+-- Replays an AVR frame sequence over SPI at SCK_HZ against the 28 MHz CLK
+-- and checks KB / O_JOY / O_BANK / O_TURBO / O_MOUSE_* and the MISO replies.
+-- Frame-to-output latency is counted in CLK cycles from SS going high
+-- to the first expected output after the frame, key latency from a P mark
+-- to the first expected output after it (avr_kbd/cosim frame files).
+--
+-- Frame file, one item per line, values in hex, '#' starts a comment:
+--   F cc dd     send a frame (command, data)
+--   R hhhh      reply received during the last frame
+--   K aa kk     KB for A(15 downto 8) = aa
+--   J jj        O_JOY
+--   B bb        O_BANK
+--   T tt        O_TURBO
+--   X xx        O_MOUSE_X
+--   Y yy        O_MOUSE_Y
+--   M mm        O_MOUSE_BTN
+--   S K|J|B|T|X|Y|M   the value must hold for LATENCY_MAX clocks (no torn state)
+--   D n         wait n clocks (decimal)
+--   @ n         wait until clock n since the start (decimal)
+--   P n         a key event arrived at clock n (decimal), may be in the past
+--
+-- Prints one line at the end:
+--   RESULT file=... sck_hz=... frames=... checks=... errors=... latency_min=... latency_avg=... latency_max=...
+--          keys=... key_latency_min=... key_latency_avg=... key_latency_max=...
+-------------------------------------------------------------------------------
+
+library IEEE;
+use IEEE.std_logic_1164.all;
+use IEEE.numeric_std.all;
+use std.textio.all;
+
+entity tb_cpld_kbd is
+generic (
+	FRAMES 		: string := "frames/matrix.frm"; -- frame sequence to replay
+	SCK_HZ 		: integer := 4000000; -- spi clock
+	GAP_NS 		: integer := 1000; -- SS high time between frames
+	BYTE_GAP_NS : integer := 0; -- pause between the command and the data byte
+	LATENCY_MAX : integer := 64 -- clocks to wait for an expected output
+);
+end tb_cpld_kbd;
+
+architecture sim of tb_cpld_kbd is
+
+	constant CLK_PERIOD : time := 35714 ps; -- 28 MHz
+
+	signal clk 		: std_logic := '0';
+	signal cycles 	: natural := 0;
+	signal done 	: boolean := false;
+
+	signal a 		: std_logic_vector(15 downto 8) := (others => '1');
+	signal kb 		: std_logic_vector(4 downto 0);
+
+	signal sck 		: std_logic := '0';
+	signal ss 		: std_logic := '1';
+	signal mosi 	: std_logic := '0';
+	signal miso 	: std_logic;
+
+	signal o_reset : std_logic;
+	signal o_turbo : std_logic_vector(1 downto 0);
+	signal o_magick : std_logic;
+	signal o_wait 	: std_logic;
+	signal o_joy 	: std_logic_vector(7 downto 0);
+	signal o_bank 	: std_logic_vector(2 downto 0);
+	signal o_mouse_x : std_logic_vector(7 downto 0);
+	signal o_mouse_y : std_logic_vector(7 downto 0);
+	signal o_mouse_btn : std_logic_vector(7 downto 0);
+
+begin
+
+	clk <= not clk after CLK_PERIOD / 2 when not done;
+
+	process (clk)
+	begin
+		if rising_edge(clk) then
+			cycles <= cycles + 1;
+		end if;
+	end process;
+
+	U_DUT: entity work.cpld_kbd
+	generic map (
+		RESET_ACK_BIT => 4
+	)
+	port map (
+		CLK => clk,
+		I_READY => '1',
+		A => a,
+		KB => kb,
+		AVR_MOSI => mosi,
+		AVR_MISO => miso,
+		AVR_SCK => sck,
+		AVR_SS => ss,
+		O_RESET => o_reset,
+		O_TURBO => o_turbo,
+		O_MAGICK => o_magick,
+		O_WAIT => o_wait,
+		O_JOY => o_joy,
+		O_BANK => o_bank,
+		O_MOUSE_X => o_mouse_x,
+		O_MOUSE_Y => o_mouse_y,
+		O_MOUSE_BTN => o_mouse_btn
+	);
+
+	process
+		constant HALF : time := 1 sec / (2 * SCK_HZ);
+
+		file f 				: text open read_mode is FRAMES;
+		variable l 			: line;
+		variable op 		: character;
+		variable hold 		: boolean;
+		variable cmd 		: std_logic_vector(7 downto 0);
+		variable data 		: std_logic_vector(7 downto 0);
+		variable addr 		: std_logic_vector(7 downto 0);
+		variable value 	: std_logic_vector(7 downto 0);
+		variable reply 	: std_logic_vector(15 downto 0) := (others => '0');
+		variable expect 	: std_logic_vector(15 downto 0);
+		variable n 			: integer;
+		variable line_no 	: natural := 0;
+		variable frame_cnt : natural := 0;
+		variable check_cnt : natural := 0;
+		variable errors 	: natural := 0;
+		variable frame_end : natural := 0;
+		variable lat_open 	: boolean := false; -- no output checked since the last frame
+		variable lat_min 	: natural := natural'high;
+		variable lat_max 	: natural := 0;
+		variable lat_sum 	: natural := 0;
+		variable lat_cnt 	: natural := 0;
+		variable key_mark 	: natural := 0;
+		variable key_open 	: boolean := false; -- no output checked since the P mark
+		variable key_min 	: natural := natural'high;
+		variable key_max 	: natural := 0;
+		variable key_sum 	: natural := 0;
+		variable key_cnt 	: natural := 0;
+
+		-- next non blank character, NUL at the end of the line
+		procedure read_op(c : out character) is
+			variable ch : character;
+		begin
+			c := NUL;
+			while l'length > 0 loop
+				read(l, ch);
+				if ch /= ' ' and ch /= HT then
+					c := ch;
+					return;
+				end if;
+			end loop;
+		end procedure;
+
+		procedure read_hex(v : out std_logic_vector) is
+			variable good : boolean;
+		begin
+			hread(l, v, good);
+			assert good report FRAMES & ":" & integer'image(line_no) & ": bad hex value" severity failure;
+		end procedure;
+
+		procedure fail(msg : string) is
+		begin
+			errors := errors + 1;
+			report FRAMES & ":" & integer'image(line_no) & ": " & msg severity error;
+		end procedure;
+
+		-- mode 0 transfer, MSB first, as the AVR SPI does it
+		procedure transfer(tx : std_logic_vector(15 downto 0)) is
+		begin
+			ss <= '0';
+			for i in 15 downto 0 loop
+				mosi <= tx(i);
+				wait for HALF;
+				sck <= '1';
+				reply(i) := miso;
+				wait for HALF;
+				sck <= '0';
+				if i = 8 and BYTE_GAP_NS > 0 then
+					wait for BYTE_GAP_NS * 1 ns;
+				end if;
+			end loop;
+			wait for HALF;
+			ss <= '1';
+			frame_end := cycles;
+			lat_open := true;
+			frame_cnt := frame_cnt + 1;
+		end procedure;
+
+		impure function sample(kind : character) return std_logic_vector is
+		begin
+			case kind is
+				when 'K' => return "000" & kb;
+				when 'J' => return o_joy;
+				when 'B' => return "00000" & o_bank;
+				when 'X' => return o_mouse_x;
+				when 'Y' => return o_mouse_y;
+				when 'M' => return o_mouse_btn;
+				when others => return "000000" & o_turbo;
+			end case;
+		end function;
+
+		-- wait for the expected output, or check that it holds
+		procedure check(kind : character; expected : std_logic_vector(7 downto 0)) is
+			variable got : std_logic_vector(7 downto 0);
+			variable latency : natural;
+		begin
+			check_cnt := check_cnt + 1;
+			if kind = 'K' and a /= addr then
+				a <= addr; -- KB is registered, give it a clock
+				wait until rising_edge(clk);
+				wait until rising_edge(clk);
+			end if;
+			for i in 0 to LATENCY_MAX loop
+				wait until rising_edge(clk);
+				got := sample(kind);
+				if hold and got /= expected then
+					fail(kind & " changed to " & to_hstring(got) & " before the commit, expected " & to_hstring(expected));
+					return;
+				elsif not hold and got = expected then
+					if lat_open then
+						latency := cycles - frame_end;
+						lat_sum := lat_sum + latency;
+						lat_cnt := lat_cnt + 1;
+						if latency < lat_min then lat_min := latency; end if;
+						if latency > lat_max then lat_max := latency; end if;
+						lat_open := false;
+					end if;
+					if key_open then
+						latency := cycles - key_mark;
+						key_sum := key_sum + latency;
+						key_cnt := key_cnt + 1;
+						if latency < key_min then key_min := latency; end if;
+						if latency > key_max then key_max := latency; end if;
+						key_open := false;
+					end if;
+					return;
+				end if;
+			end loop;
+			if not hold then
+				fail(kind & " is " & to_hstring(got) & ", expected " & to_hstring(expected));
+			end if;
+		end procedure;
+
+	begin
+		wait for 10 * CLK_PERIOD;
+
+		while not endfile(f) loop
+			readline(f, l);
+			line_no := line_no + 1;
+			read_op(op);
+			hold := op = 'S';
+			if hold then
+				read_op(op);
+			end if;
+
+			case op is
+				when 'F' =>
+					read_hex(cmd);
+					read_hex(data);
+					wait for GAP_NS * 1 ns;
+					transfer(cmd & data);
+				when 'R' =>
+					read_hex(expect);
+					check_cnt := check_cnt + 1;
+					if reply /= expect then
+						fail("reply " & to_hstring(reply) & ", expected " & to_hstring(expect));
+					end if;
+				when 'K' =>
+					read_hex(addr);
+					read_hex(value);
+					check('K', value);
+				when 'J' | 'B' | 'T' | 'X' | 'Y' | 'M' =>
+					read_hex(value);
+					check(op, value);
+				when 'D' =>
+					read(l, n);
+					for i in 1 to n loop
+						wait until rising_edge(clk);
+					end loop;
+				when '@' =>
+					read(l, n);
+					while cycles < n loop
+						wait until rising_edge(clk);
+					end loop;
+				when 'P' =>
+					read(l, n);
+					key_mark := n;
+					key_open := true;
+				when NUL | '#' => null;
+				when others =>
+					fail("unknown item " & op);
+			end case;
+		end loop;
+
+		if lat_cnt = 0 then
+			lat_min := 0;
+			lat_cnt := 1;
+		end if;
+		if key_cnt = 0 then
+			key_min := 0;
+		end if;
+
+		report "RESULT file=" & FRAMES &
+			" sck_hz=" & integer'image(SCK_HZ) &
+			" frames=" & integer'image(frame_cnt) &
+			" checks=" & integer'image(check_cnt) &
+			" errors=" & integer'image(errors) &
+			" latency_min=" & integer'image(lat_min) &
+			" latency_avg=" & integer'image(lat_sum / lat_cnt) &
+			" latency_max=" & integer'image(lat_max) &
+			" keys=" & integer'image(key_cnt) &
+			" key_latency_min=" & integer'image(key_min) &
+			" key_latency_avg=" & integer'image(key_sum / maximum(key_cnt, 1)) &
+			" key_latency_max=" & integer'image(key_max);
+
+		done <= true;
+		wait;
+	end process;
+
+end sim;
@@ -0,0 +1,456 @@
+-------------------------------------------------------------------------------
+-- rom bank update testbench
+--
+-- rtl/flash/flash_update.vhd writes a bank through rtl/flash/flash.vhd into an
+-- SPI flash model, the bank is read from a ram model:
+--   flash     bit level W25Q16 subset: AB, 06, 04, 05, 03, 02, D8. A page
+--             program is taken when CS rises on a byte boundary, it ANDs the
+--             bytes into the cells like the real flash. Erase and program set
+--             the busy bit for ERASE_NS / PROG_NS (shortened).
+--   ram       a read hits after HIT_CLKS clocks, a read of every MISS_EVERY-th
+--             address misses and holds RAM_WAIT_N low for MISS_CLKS clocks,
+--             longer than BYTE_DEADLINE and a stream byte: in the middle of a
+--             page the burst of prog_next and the stream of verify_next restart
+--             at that byte. A read of the address that missed last hits.
+--             MISS_EVERY = 0: no misses.
+--   full      #E0 + BANK_N: the bank is erased, programmed and verified, the
+--             flash has to hold the ram bytes, the verify error bit stays 0 and
+--             BANK_CHANGED pulses for the bank. The OUT holds N_WAIT low until
+--             the update has ended.
+--   verify    one ram byte changed, #20 + BANK_N: the verify error bit is set,
+--             BANK_CHANGED does not pulse.
+-- The page program and read commands the flash gets are compared with the
+-- ones the misses cause: one 02 per page and one per restarted burst, one 03
+-- for the verify pass and one per restarted stream.
+--
+-- Prints one line at the end:
+--   RESULT miss_every=... misses=... prog_cmds=... prog_restarts=... read_cmds=... verify_restarts=... update_us=... errors=...
+-------------------------------------------------------------------------------
+
+library IEEE;
+use IEEE.std_logic_1164.all;
+use IEEE.numeric_std.all;
+
+entity tb_flash_update is
+generic (
+	BANK_N 		: integer := 5;
+	RAM_BASE 	: integer := 16#44000#; -- #04AB..#06AB, 16K page 17
+	MISS_EVERY 	: integer := 97; -- every 97th ram address misses
+	MISS_CLKS 	: integer := 40;
+	HIT_CLKS 	: integer := 2;
+	ERASE_NS 	: integer := 20000;
+	PROG_NS 		: integer := 2000;
+	ERR_OFS 		: integer := 40000 -- byte changed for the verify error
+);
+end tb_flash_update;
+
+architecture sim of tb_flash_update is
+
+	constant CLK_PERIOD 	: time := 35714 ps; -- 28 MHz
+	constant WIN 			: integer := 16#100000# + BANK_N * 65536; -- flash address of the bank
+
+	type mem_t is array(0 to 65535) of std_logic_vector(7 downto 0);
+	type page_t is array(0 to 255) of std_logic_vector(7 downto 0);
+
+	signal clk 			: std_logic := '0';
+	signal done 		: boolean := false;
+	signal reset 		: std_logic := '1';
+
+	-- cpu ports
+	signal a 			: std_logic_vector(15 downto 0) := (others => '1');
+	signal d 			: std_logic_vector(7 downto 0) := (others => '1');
+	signal n_iorq 		: std_logic := '1';
+	signal n_wr 		: std_logic := '1';
+	signal n_wait 		: std_logic;
+	signal do 			: std_logic_vector(7 downto 0);
+	signal bank_changed : std_logic_vector(7 downto 0);
+	signal changed_cnt : integer := 0;
+
+	-- ram
+	signal ram_a 		: std_logic_vector(20 downto 0);
+	signal ram_rd 		: std_logic;
+	signal ram_di 		: std_logic_vector(7 downto 0) := (others => 'X');
+	signal ram_wait_n : std_logic := '1';
+	signal gen 			: integer := 0; -- ram content, 1 changes the byte at ERR_OFS
+	signal ram_misses : integer := 0;
+
+	-- parallel flash
+	signal flash_a 	: std_logic_vector(23 downto 0);
+	signal flash_di 	: std_logic_vector(7 downto 0);
+	signal flash_do 	: std_logic_vector(7 downto 0);
+	signal flash_wr_n : std_logic;
+	signal flash_rd_n : std_logic;
+	signal flash_er_n : std_logic;
+	signal flash_stream : std_logic;
+	signal flash_busy : std_logic;
+	signal flash_ready : std_logic;
+
+	-- spi flash
+	signal ncs 			: std_logic;
+	signal sclk 		: std_logic;
+	signal mosi 		: std_logic;
+	signal miso 		: std_logic := '1';
+	signal mem 			: mem_t := (others => X"00"); -- an old bank, the erase has to clear it
+	signal prog_cmds 	: integer := 0;
+	signal read_cmds 	: integer := 0;
+	signal model_errors : integer := 0;
+
+	function ram_byte(addr, g : integer) return std_logic_vector is
+		variable v : integer := (addr * 13 + addr / 256 + 5) mod 256;
+	begin
+		if g = 1 and addr = RAM_BASE + ERR_OFS then
+			v := (v + 1) mod 256;
+		end if;
+		return std_logic_vector(to_unsigned(v, 8));
+	end function;
+
+begin
+
+	clk <= not clk after CLK_PERIOD / 2 when not done;
+
+	U_FLASH: entity work.flash
+	port map (
+		CLK => clk,
+		RESET => reset,
+		A => flash_a,
+		DI => flash_di,
+		DO => flash_do,
+		WR_N => flash_wr_n,
+		RD_N => flash_rd_n,
+		ER_N => flash_er_n,
+		STREAM => flash_stream,
+		DATA0 => miso,
+		NCSO => ncs,
+		DCLK => sclk,
+		ASDO => mosi,
+		BUSY => flash_busy,
+		DATA_READY => flash_ready
+	);
+
+	U_DUT: entity work.flash_update
+	port map (
+		CLK => clk,
+		RESET => reset,
+		A => a,
+		DI => d,
+		DO => do,
+		N_IORQ => n_iorq,
+		N_WR => n_wr,
+		N_M1 => '1',
+		N_WAIT => n_wait,
+		UPDATE_ACTIVE => open,
+		RAM_A => ram_a,
+		RAM_DI => ram_di,
+		RAM_RD => ram_rd,
+		RAM_WAIT_N => ram_wait_n,
+		FLASH_A => flash_a,
+		FLASH_DI => flash_di,
+		FLASH_DO => flash_do,
+		FLASH_WR_N => flash_wr_n,
+		FLASH_RD_N => flash_rd_n,
+		FLASH_ER_N => flash_er_n,
+		FLASH_STREAM => flash_stream,
+		FLASH_BUSY => flash_busy,
+		FLASH_READY => flash_ready,
+		BANK_CHANGED => bank_changed
+	);
+
+	process (clk)
+	begin
+		if rising_edge(clk) and bank_changed(BANK_N) = '1' then
+			changed_cnt <= changed_cnt + 1;
+		end if;
+	end process;
+
+	-- ram: a read starts with RAM_RD, the byte is on RAM_DI when RAM_WAIT_N is high again
+	process (clk)
+		variable prev_rd 	: std_logic := '0';
+		variable cnt 		: integer := 0;
+		variable addr 		: integer := 0;
+		variable last_miss : integer := -1;
+		variable misses 	: integer := 0;
+	begin
+		if rising_edge(clk) then
+			if ram_rd = '1' and prev_rd = '0' then
+				addr := to_integer(unsigned(ram_a));
+				if MISS_EVERY > 0 and addr mod MISS_EVERY = MISS_EVERY - 1 and addr /= last_miss then
+					cnt := MISS_CLKS;
+					last_miss := addr;
+					misses := misses + 1;
+				else
+					cnt := HIT_CLKS;
+				end if;
+				ram_wait_n <= '0';
+				ram_di <= (others => 'X');
+			elsif cnt > 1 then
+				cnt := cnt - 1;
+			elsif cnt = 1 then
+				cnt := 0;
+				ram_wait_n <= '1';
+				ram_di <= ram_byte(addr, gen);
+			end if;
+			prev_rd := ram_rd;
+			ram_misses <= misses;
+		end if;
+	end process;
+
+	-- spi flash, mode 0: MOSI is taken on the rising SCLK, MISO changes on the falling one
+	process (ncs, sclk)
+		variable bits 		: integer := 0;
+		variable nbyte 	: integer := 0;
+		variable sr 		: std_logic_vector(7 downto 0);
+		variable out_sr 	: std_logic_vector(7 downto 0) := X"FF";
+		variable cmd 		: std_logic_vector(7 downto 0) := X"00";
+		variable addr 		: integer := 0;
+		variable page 		: page_t;
+		variable npage 	: integer := 0;
+		variable wel 		: boolean := false;
+		variable busy_until : time := 0 ns;
+		variable errors 	: integer := 0;
+		variable progs 	: integer := 0;
+		variable reads 	: integer := 0;
+		variable cell 		: integer;
+
+		impure function status return std_logic_vector is
+			variable s : std_logic_vector(7 downto 0) := X"00";
+		begin
+			if now < busy_until then
+				s(0) := '1';
+			end if;
+			if wel then
+				s(1) := '1';
+			end if;
+			return s;
+		end function;
+
+		impure function read_byte(fa : integer) return std_logic_vector is
+		begin
+			if fa >= WIN and fa < WIN + 65536 then
+				return mem(fa - WIN);
+			end if;
+			return X"FF";
+		end function;
+
+		procedure fail(what : string) is
+		begin
+			errors := errors + 1;
+			report "flash: " & what severity error;
+		end procedure;
+
+	begin
+		if falling_edge(ncs) then
+			bits := 0;
+			nbyte := 0;
+			addr := 0;
+			npage := 0;
+
+		elsif rising_edge(ncs) and nbyte > 0 then
+			-- end of a command
+			if cmd = X"06" then
+				wel := true;
+			elsif cmd = X"04" then
+				wel := false;
+			elsif cmd = X"02" then
+				if bits /= 0 then
+					fail("page program ended in a byte, ignored");
+				elsif nbyte < 4 then
+					fail("page program without an address");
+				elsif not wel then
+					fail("page program without write enable");
+				else
+					for i in 0 to npage - 1 loop
+						cell := (addr / 256) * 256 + (addr + i) mod 256;
+						if cell < WIN or cell >= WIN + 65536 then
+							fail("page program outside the bank at " & integer'image(cell));
+						else
+							if mem(cell - WIN) /= X"FF" then
+								fail("byte " & integer'image(cell - WIN) & " programmed twice");
+							end if;
+							mem(cell - WIN) <= mem(cell - WIN) and page(i);
+						end if;
+					end loop;
+					busy_until := now + PROG_NS * 1 ns;
+				end if;
+				wel := false;
+			elsif cmd = X"D8" then
+				if bits /= 0 or nbyte /= 4 or not wel then
+					fail("block erase ignored");
+				elsif (addr / 65536) * 65536 /= WIN then
+					fail("block erase outside the bank at " & integer'image(addr));
+				else
+					mem <= (others => X"FF");
+					busy_until := now + ERASE_NS * 1 ns;
+				end if;
+				wel := false;
+			end if;
+
+		elsif rising_edge(sclk) and ncs = '0' then
+			sr := sr(6 downto 0) & mosi;
+			bits := bits + 1;
+			if bits = 8 then
+				bits := 0;
+				if nbyte = 0 then
+					cmd := sr;
+					if now < busy_until and cmd /= X"05" then
+						fail("command " & to_hstring(cmd) & " while busy");
+					end if;
+					if cmd = X"02" then
+						progs := progs + 1;
+					elsif cmd = X"03" then
+						reads := reads + 1;
+					elsif cmd = X"05" then
+						out_sr := status;
+					end if;
+				elsif nbyte <= 3 then
+					addr := addr * 256 + to_integer(unsigned(sr));
+					if nbyte = 3 and cmd = X"03" then
+						out_sr := read_byte(addr);
+						addr := addr + 1;
+					end if;
+				elsif cmd = X"03" then
+					out_sr := read_byte(addr);
+					addr := addr + 1;
+				elsif cmd = X"05" then
+					out_sr := status;
+				elsif cmd = X"02" then
+					if npage = 256 then
+						fail("page program longer than a page");
+					else
+						page(npage) := sr;
+						npage := npage + 1;
+					end if;
+				end if;
+				nbyte := nbyte + 1;
+			end if;
+
+		elsif falling_edge(sclk) and ncs = '0' then
+			miso <= out_sr(7);
+			out_sr := out_sr(6 downto 0) & '1';
+		end if;
+
+		model_errors <= errors;
+		prog_cmds <= progs;
+		read_cmds <= reads;
+	end process;
+
+	process
+		variable errors 	: natural := 0;
+		variable exp_prog : natural := 0;
+		variable exp_verify : natural := 0;
+		variable held 		: boolean;
+		variable t_start 	: time;
+		variable t_update : time;
+		variable t_full 	: time;
+		variable progs 	: integer;
+		variable reads 	: integer;
+
+		procedure expect(what : string; got, want : integer) is
+		begin
+			if got /= want then
+				errors := errors + 1;
+				report what & ": " & integer'image(got) & ", expected " & integer'image(want) severity error;
+			end if;
+		end procedure;
+
+		-- OUT (port),value: IORQ and WR for 3 clocks, then the bus is released
+		procedure out_port(port_a : integer; value : integer) is
+		begin
+			wait until rising_edge(clk);
+			a <= std_logic_vector(to_unsigned(port_a, 16));
+			d <= std_logic_vector(to_unsigned(value, 8));
+			n_iorq <= '0';
+			n_wr <= '0';
+			for i in 1 to 3 loop
+				wait until rising_edge(clk);
+			end loop;
+			n_iorq <= '1';
+			n_wr <= '1';
+		end procedure;
+
+		-- an update started by an OUT to #07AB, the cpu waits until N_WAIT is released
+		procedure update(value : integer) is
+		begin
+			t_start := now;
+			out_port(16#07AB#, value);
+			held := false;
+			for i in 1 to 4 loop
+				wait until rising_edge(clk);
+				if n_wait = '0' then
+					held := true;
+				end if;
+			end loop;
+			if not held then
+				errors := errors + 1;
+				report "the OUT to #07AB did not hold the cpu" severity error;
+			end if;
+			while n_wait = '0' loop
+				wait until rising_edge(clk);
+			end loop;
+			t_update := now - t_start;
+			a <= X"07AB";
+			wait until rising_edge(clk);
+		end procedure;
+
+	begin
+		for i in 1 to 4 loop
+			wait until rising_edge(clk);
+		end loop;
+		reset <= '0';
+		for i in 1 to 100 loop
+			wait until rising_edge(clk);
+		end loop;
+
+		for o in 0 to 65535 loop
+			if MISS_EVERY > 0 and (RAM_BASE + o) mod MISS_EVERY = MISS_EVERY - 1 then
+				if o mod 256 /= 0 then
+					exp_prog := exp_prog + 1; -- the first byte of a page is fetched before the burst
+				end if;
+				if o /= 0 then
+					exp_verify := exp_verify + 1;
+				end if;
+			end if;
+		end loop;
+
+		out_port(16#04AB#, RAM_BASE mod 256);
+		out_port(16#05AB#, (RAM_BASE / 256) mod 256);
+		out_port(16#06AB#, RAM_BASE / 65536);
+
+		-- full
+		update(16#E0# + BANK_N);
+		t_full := t_update;
+		expect("status after the update", to_integer(unsigned(do)), 0);
+		expect("bank changed pulses", changed_cnt, 1);
+		for o in 0 to 65535 loop
+			if mem(o) /= ram_byte(RAM_BASE + o, 0) then
+				errors := errors + 1;
+				if errors < 10 then
+					report "flash byte " & integer'image(o) & " is " & to_hstring(mem(o)) &
+						", expected " & to_hstring(ram_byte(RAM_BASE + o, 0)) severity error;
+				end if;
+			end if;
+		end loop;
+		progs := prog_cmds;
+		reads := read_cmds;
+		expect("page programs", progs, 256 + exp_prog);
+		expect("stream reads", reads, 1 + exp_verify);
+
+		-- verify
+		gen <= 1;
+		update(16#20# + BANK_N);
+		expect("verify error bit", to_integer(unsigned(do)), 16#40#);
+		expect("bank changed pulses after a verify", changed_cnt, 1);
+
+		report "RESULT miss_every=" & integer'image(MISS_EVERY) &
+			" misses=" & integer'image(ram_misses) &
+			" prog_cmds=" & integer'image(progs) &
+			" prog_restarts=" & integer'image(progs - 256) &
+			" read_cmds=" & integer'image(reads) &
+			" verify_restarts=" & integer'image(reads - 1) &
+			" update_us=" & integer'image(t_full / 1 us) &
+			" errors=" & integer'image(errors + model_errors);
+
+		done <= true;
+		wait;
+	end process;
+
+end sim;
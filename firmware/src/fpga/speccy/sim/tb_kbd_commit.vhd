@@ -0,0 +1,246 @@
+-------------------------------------------------------------------------------
+-- cpld_kbd commit testbench
+--
+-- Sends UPDATES random matrix updates over SPI and checks on every clock that
+-- the outputs show either the last committed state or, once the commit frame
+-- has been sent, the new one, but never a mix of the two.
+--
+-- An update inverts a random set of frames, so every KB bit, O_JOY, O_BANK,
+-- O_TURBO, O_MAGICK, O_WAIT and O_AUTO_TURBO of a changed frame differs
+-- between the old and the new state and a torn state matches neither.
+-- Full updates send frames 1..8 (frame 8 commits), partial updates send
+-- some of the frames 1..7 and the explicit commit 0x0B.
+-- KB is scanned over all 8 half-rows, one per clock.
+--
+-- Prints one line at the end:
+--   RESULT updates=... samples=... torn=... errors=...
+-------------------------------------------------------------------------------
+
+library IEEE;
+use IEEE.std_logic_1164.all;
+use IEEE.numeric_std.all;
+use IEEE.math_real.all;
+
+entity tb_kbd_commit is
+generic (
+	UPDATES 		: integer := 200; -- random updates to send
+	SCK_HZ 		: integer := 4000000; -- spi clock
+	GAP_MAX_NS 	: integer := 3000; -- random SS high time between frames, up to
+	LATENCY_MAX : integer := 64; -- clocks for a commit to reach the outputs
+	SEED 			: integer := 1
+);
+end tb_kbd_commit;
+
+architecture sim of tb_kbd_commit is
+
+	constant CLK_PERIOD : time := 35714 ps; -- 28 MHz
+
+	type frames_t is array (1 to 8) of std_logic_vector(7 downto 0);
+
+	signal clk 		: std_logic := '0';
+	signal done 	: boolean := false;
+
+	signal a 		: std_logic_vector(15 downto 8) := (others => '1');
+	signal kb 		: std_logic_vector(4 downto 0);
+
+	signal sck 		: std_logic := '0';
+	signal ss 		: std_logic := '1';
+	signal mosi 	: std_logic := '0';
+	signal miso 	: std_logic;
+
+	signal o_reset : std_logic;
+	signal o_turbo : std_logic_vector(1 downto 0);
+	signal o_auto_turbo : std_logic;
+	signal o_magick : std_logic;
+	signal o_wait 	: std_logic;
+	signal o_joy 	: std_logic_vector(7 downto 0);
+	signal o_bank 	: std_logic_vector(2 downto 0);
+
+	-- written by the sender, checked by the monitor
+	signal st_old 		: frames_t := (others => (others => '0'));
+	signal st_new 		: frames_t := (others => (others => '0'));
+	signal allow_new 	: boolean := false; -- the commit frame has been sent
+	signal upd 			: natural := 0; -- update in flight
+	signal checking 	: boolean := false;
+
+	-- written by the monitor
+	signal seen_upd 	: natural := 0; -- last update seen on the outputs
+	signal samples 	: natural := 0;
+	signal torn 		: natural := 0;
+
+	-- outputs of a state for half-row h: KB, O_JOY, O_BANK, O_TURBO, O_MAGICK, O_WAIT, O_AUTO_TURBO
+	function outputs(st : frames_t; h : integer) return std_logic_vector is
+		variable kb_v 	: std_logic_vector(4 downto 0);
+		variable joy 	: std_logic_vector(7 downto 0);
+	begin
+		for b in 0 to 4 loop
+			kb_v(b) := not st(b + 1)(h);
+		end loop;
+		joy := st(8)(0) & st(7)(4) & st(7)(3) & st(6)(3) & st(6)(4) & st(6)(5) & st(6)(6) & st(6)(7);
+		return kb_v & not(joy) & st(7)(2 downto 0) & st(7)(7 downto 6) & not(st(6)(2)) & not(st(7)(5)) & st(8)(5);
+	end function;
+
+begin
+
+	clk <= not clk after CLK_PERIOD / 2 when not done;
+
+	U_DUT: entity work.cpld_kbd
+	generic map (
+		RESET_ACK_BIT => 4
+	)
+	port map (
+		CLK => clk,
+		I_READY => '1',
+		A => a,
+		KB => kb,
+		AVR_MOSI => mosi,
+		AVR_MISO => miso,
+		AVR_SCK => sck,
+		AVR_SS => ss,
+		O_RESET => o_reset,
+		O_TURBO => o_turbo,
+		O_AUTO_TURBO => o_auto_turbo,
+		O_MAGICK => o_magick,
+		O_WAIT => o_wait,
+		O_JOY => o_joy,
+		O_BANK => o_bank,
+		O_MOUSE_X => open,
+		O_MOUSE_Y => open,
+		O_MOUSE_BTN => open
+	);
+
+	-- the outputs registered on a rising edge are sampled on the next falling edge,
+	-- KB belongs to the half-row selected before that rising edge
+	process (clk)
+		variable h 		: integer range 0 to 7 := 0;
+		variable got 	: std_logic_vector(17 downto 0);
+		variable is_old : boolean;
+		variable is_new : boolean;
+	begin
+		if falling_edge(clk) then
+			if checking then
+				got := kb & o_joy & o_bank & o_turbo & o_magick & o_wait & o_auto_turbo;
+				is_old := got = outputs(st_old, h);
+				is_new := got = outputs(st_new, h);
+				samples <= samples + 1;
+				if is_new and not is_old then
+					seen_upd <= upd;
+				end if;
+				if not is_old and not (allow_new and is_new) then
+					torn <= torn + 1;
+					report "torn state at half-row " & integer'image(h) & ": " & to_hstring(got) &
+						", old " & to_hstring(outputs(st_old, h)) & ", new " & to_hstring(outputs(st_new, h)) severity error;
+				end if;
+			end if;
+			h := (h + 1) mod 8;
+			a <= (others => '1');
+			a(8 + h) <= '0';
+		end if;
+	end process;
+
+	process
+		constant HALF : time := 1 sec / (2 * SCK_HZ);
+
+		variable seed1 	: positive := SEED;
+		variable seed2 	: positive := 7919;
+		variable rnd 		: real;
+		variable st 		: frames_t := (others => (others => '0'));
+		variable changed 	: std_logic_vector(8 downto 1);
+		variable full 		: boolean;
+		variable errors 	: natural := 0;
+
+		impure function random(n : integer) return integer is
+		begin
+			uniform(seed1, seed2, rnd);
+			return integer(floor(rnd * real(n)));
+		end function;
+
+		procedure transfer(tx : std_logic_vector(15 downto 0)) is
+		begin
+			wait for (100 + random(GAP_MAX_NS)) * 1 ns;
+			ss <= '0';
+			for i in 15 downto 0 loop
+				mosi <= tx(i);
+				wait for HALF;
+				sck <= '1';
+				wait for HALF;
+				sck <= '0';
+			end loop;
+			wait for HALF;
+			ss <= '1';
+		end procedure;
+
+	begin
+		-- initial state: everything released
+		st(6) := X"F8";
+		st(7) := X"18";
+		st(8) := X"1F";
+		for i in 1 to 8 loop
+			transfer(std_logic_vector(to_unsigned(i, 8)) & st(i));
+		end loop;
+		st_old <= st;
+		st_new <= st;
+		for i in 1 to LATENCY_MAX loop
+			wait until rising_edge(clk);
+		end loop;
+		checking <= true;
+
+		for u in 1 to UPDATES loop
+			full := random(2) = 1;
+			changed := (others => '0');
+			while changed = "00000000" loop
+				for i in 1 to 8 loop
+					if random(2) = 1 and (full or i /= 8) then
+						changed(i) := '1';
+					end if;
+				end loop;
+			end loop;
+			for i in 1 to 8 loop
+				if changed(i) = '1' then
+					st(i) := not st(i);
+				end if;
+			end loop;
+			st(6)(0) := '0'; -- not a reset
+			st_new <= st;
+			upd <= u;
+
+			for i in 1 to 8 loop
+				if full or changed(i) = '1' then
+					if i = 8 then
+						allow_new <= true; -- frame 8 commits at its end
+					end if;
+					transfer(std_logic_vector(to_unsigned(i, 8)) & st(i));
+				end if;
+			end loop;
+			if not full then
+				allow_new <= true;
+				transfer(X"0B00");
+			end if;
+
+			-- the commit has to reach the outputs
+			for i in 1 to LATENCY_MAX loop
+				wait until falling_edge(clk);
+				exit when seen_upd = u;
+			end loop;
+			wait until falling_edge(clk);
+			if seen_upd /= u then
+				errors := errors + 1;
+				report "update " & integer'image(u) & " was not applied" severity error;
+			end if;
+			st_old <= st;
+			allow_new <= false;
+			wait until falling_edge(clk);
+		end loop;
+
+		checking <= false;
+		wait until falling_edge(clk);
+		report "RESULT updates=" & integer'image(UPDATES) &
+			" samples=" & integer'image(samples) &
+			" torn=" & integer'image(torn) &
+			" errors=" & integer'image(errors + torn);
+
+		done <= true;
+		wait;
+	end process;
+
+end sim;
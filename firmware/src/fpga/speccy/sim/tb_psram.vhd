@@ -0,0 +1,302 @@
+-------------------------------------------------------------------------------
+-- psram controller testbench
+--
+-- Runs a Z80-like access stream at CPU_HZ through rtl/memory/psram.vhd
+-- (llqspi_sim.vhd as the QSPI core) against a QPI PSRAM model, checks every
+-- byte read against a copy of the memory and measures the line cache:
+--   code     opcode fetches with hot loops, data reads and stack pushes / pops
+--   seq      sequential reads (block copy, prefetch case)
+--   random   random reads over the 2 MB (every read misses)
+-- An access is 2 T-states plus the wait states the controller inserts,
+-- followed by 2 T-states off the bus (refresh / decode of an M1 cycle).
+-- WARM=true starts the PSRAM model in QPI mode, like after an FPGA
+-- reconfiguration without a power cycle.
+--
+-- Prints one line at the end:
+--   RESULT pattern=... warm=... cpu_hz=... reads=... writes=... hits=... misses=...
+--          hit_rate=...% wait_t=... access_clk=... errors=...
+-- wait_t is the average count of wait states per access, access_clk the
+-- average access length in 28 MHz clocks (strobe to strobe release).
+-------------------------------------------------------------------------------
+
+library IEEE;
+use IEEE.std_logic_1164.all;
+use IEEE.numeric_std.all;
+use IEEE.math_real.all;
+
+entity tb_psram is
+generic (
+	PATTERN 		: string := "code";
+	CPU_HZ 		: integer := 3500000;
+	ACCESSES 	: integer := 20000;
+	WARM 			: boolean := false;
+	SEED 			: integer := 1
+);
+end tb_psram;
+
+architecture sim of tb_psram is
+
+	constant BUS_PERIOD 	: time := 35714 ps; -- 28 MHz
+	constant QSPI_PERIOD : time := 20 ns; -- 50 MHz
+	constant CPU_DIV 		: integer := 28000000 / CPU_HZ; -- bus clocks per T-state
+
+	constant CMD_READ 	: std_logic_vector(7 downto 0) := X"EB";
+	constant CMD_WRITE 	: std_logic_vector(7 downto 0) := X"38";
+	constant CMD_QPI_ON 	: std_logic_vector(7 downto 0) := X"35";
+	constant CMD_QPI_OFF : std_logic_vector(7 downto 0) := X"F5";
+	constant READ_WAIT 	: integer := 6; -- wait clocks of the quad read
+
+	type mem_t is array (0 to 2**21-1) of integer range 0 to 255;
+
+	signal clk_bus 	: std_logic := '0';
+	signal clk_qspi 	: std_logic := '0';
+	signal done 		: boolean := false;
+
+	signal a 			: std_logic_vector(20 downto 0) := (others => '0');
+	signal di 			: std_logic_vector(7 downto 0) := (others => '0');
+	signal do 			: std_logic_vector(7 downto 0);
+	signal n_rd 		: std_logic := '1';
+	signal n_wr 		: std_logic := '1';
+	signal n_mreq 		: std_logic := '1';
+	signal n_wait 		: std_logic;
+	signal busy 		: std_logic;
+	signal hits 		: std_logic_vector(31 downto 0);
+	signal misses 		: std_logic_vector(31 downto 0);
+
+	signal sclk 		: std_logic;
+	signal n_cs 		: std_logic;
+	signal sio 			: std_logic_vector(3 downto 0);
+
+	-- power on content of the psram
+	function init_byte(addr : integer) return integer is
+	begin
+		return (addr * 7 + addr / 256) mod 256;
+	end function;
+
+	-- fixed point x / 100 with two decimals
+	function fixed2(x100 : integer) return string is
+		variable frac : integer := x100 mod 100;
+	begin
+		if frac < 10 then
+			return integer'image(x100 / 100) & ".0" & integer'image(frac);
+		end if;
+		return integer'image(x100 / 100) & "." & integer'image(frac);
+	end function;
+
+begin
+
+	clk_bus <= not clk_bus after BUS_PERIOD / 2 when not done;
+	clk_qspi <= not clk_qspi after QSPI_PERIOD / 2 when not done;
+
+	U_DUT: entity work.psram
+	port map (
+		CLK_QSPI => clk_qspi,
+		CLK_BUS => clk_bus,
+		A => a,
+		DI => di,
+		DO => do,
+		N_WR => n_wr,
+		N_RD => n_rd,
+		N_MREQ => n_mreq,
+		N_WAIT => n_wait,
+		BUSY => busy,
+		HITS => hits,
+		MISSES => misses,
+		SPI_SCLK => sclk,
+		SPI_N_CS => n_cs,
+		SPI_SIO => sio
+	);
+
+	-- QPI PSRAM: spi commands until QPI_ON, then quad read (EB, 6 wait clocks), quad write (38)
+	-- and QPI_OFF, inputs are taken on the rising SCK edge, read data is driven after the falling edge
+	process (sclk, n_cs)
+		variable mem 		: mem_t;
+		variable init 		: boolean := false;
+		variable qpi 		: boolean := WARM;
+		variable cnt 		: natural := 0; -- SCK clocks of the transaction
+		variable cmd 		: std_logic_vector(7 downto 0);
+		variable addr 		: std_logic_vector(23 downto 0);
+		variable wbyte 	: std_logic_vector(7 downto 0);
+		variable rd_n 		: integer;
+		variable rbyte 	: std_logic_vector(7 downto 0);
+	begin
+		if not init then
+			for i in mem'range loop
+				mem(i) := init_byte(i);
+			end loop;
+			init := true;
+		end if;
+		if n_cs = '1' then
+			cnt := 0;
+			sio <= "ZZZZ";
+		elsif rising_edge(sclk) then
+			cnt := cnt + 1;
+			if not qpi then
+				cmd := cmd(6 downto 0) & sio(0);
+				if cnt = 8 and cmd = CMD_QPI_ON then
+					qpi := true;
+				end if;
+			elsif cnt <= 2 then
+				cmd := cmd(3 downto 0) & sio;
+				if cnt = 2 and cmd = CMD_QPI_OFF then
+					qpi := false;
+				end if;
+			elsif cnt <= 8 then
+				addr := addr(19 downto 0) & sio;
+			elsif cmd = CMD_WRITE then
+				wbyte := wbyte(3 downto 0) & sio;
+				if cnt mod 2 = 0 then
+					mem(to_integer(unsigned(addr(20 downto 0)))) := to_integer(unsigned(wbyte));
+					addr := std_logic_vector(unsigned(addr) + 1);
+				end if;
+			end if;
+		elsif falling_edge(sclk) and qpi and cmd = CMD_READ and cnt >= 8 + READ_WAIT then
+			rd_n := cnt - 8 - READ_WAIT; -- nibble
+			rbyte := std_logic_vector(to_unsigned(mem((to_integer(unsigned(addr(20 downto 0))) + rd_n / 2) mod 2**21), 8));
+			if rd_n mod 2 = 0 then
+				sio <= rbyte(7 downto 4);
+			else
+				sio <= rbyte(3 downto 0);
+			end if;
+		end if;
+	end process;
+
+	process
+		variable mem 		: mem_t;
+		variable seed1 	: positive := SEED;
+		variable seed2 	: positive := 104729;
+		variable rnd 		: real;
+		variable reads 	: natural := 0;
+		variable writes 	: natural := 0;
+		variable waits 	: natural := 0;
+		variable clocks 	: natural := 0;
+		variable errors 	: natural := 0;
+		variable pc 		: integer := 16#100000#;
+		variable sp 		: integer := 16#00FF00#;
+		variable dp 		: integer := 16#008000#;
+		variable seq_a 	: integer := 16#040000#;
+		type loops_t is array (0 to 15) of integer;
+		variable loops 	: loops_t;
+		variable r 			: integer;
+		variable total 	: integer;
+
+		impure function random(n : integer) return integer is
+		begin
+			uniform(seed1, seed2, rnd);
+			return integer(floor(rnd * real(n)));
+		end function;
+
+		-- one T-state is CPU_DIV bus clocks, strobes change on the falling bus clock edge
+		procedure t_states(n : integer) is
+		begin
+			for i in 1 to n * CPU_DIV loop
+				wait until falling_edge(clk_bus);
+			end loop;
+		end procedure;
+
+		procedure access(addr : integer; wr : boolean; data : integer) is
+			variable got : integer;
+			variable len : natural := 0;
+		begin
+			a <= std_logic_vector(to_unsigned(addr, 21));
+			di <= std_logic_vector(to_unsigned(data, 8));
+			n_mreq <= '0';
+			if wr then
+				n_wr <= '0';
+			else
+				n_rd <= '0';
+			end if;
+			-- WAIT is sampled at the end of T2 and of every wait state
+			t_states(2);
+			len := 2;
+			while n_wait = '0' loop
+				t_states(1);
+				len := len + 1;
+				waits := waits + 1;
+			end loop;
+			clocks := clocks + len * CPU_DIV;
+			if wr then
+				writes := writes + 1;
+				mem(addr) := data;
+			else
+				reads := reads + 1;
+				got := to_integer(unsigned(do));
+				if got /= mem(addr) then
+					errors := errors + 1;
+					report "read " & integer'image(addr) & ": " & integer'image(got) &
+						", expected " & integer'image(mem(addr)) severity error;
+				end if;
+			end if;
+			n_mreq <= '1';
+			n_rd <= '1';
+			n_wr <= '1';
+			t_states(2);
+		end procedure;
+
+	begin
+		for i in mem'range loop
+			mem(i) := init_byte(i);
+		end loop;
+		for i in loops'range loop
+			loops(i) := 16#100000# + random(16384);
+		end loop;
+
+		-- psram power up and QPI init
+		wait for 250 us;
+		wait until falling_edge(clk_bus);
+
+		for n in 1 to ACCESSES loop
+			if PATTERN = "seq" then
+				access(seq_a, false, 0);
+				seq_a := seq_a + 1;
+			elsif PATTERN = "random" then
+				access(random(2**21), false, 0);
+			else
+				r := random(100);
+				if r < 60 then
+					-- opcode fetch, a jump every 6 opcodes, mostly back into a hot loop
+					access(pc, false, 0);
+					pc := pc + 1;
+					if random(6) = 0 then
+						if random(10) = 0 then
+							pc := 16#100000# + random(16384);
+						else
+							pc := loops(random(16));
+						end if;
+					end if;
+				elsif r < 80 then
+					-- data, mostly the next byte of a table
+					if random(4) = 0 then
+						dp := 16#008000# + random(16384);
+					end if;
+					access(dp, false, 0);
+					dp := dp + 1;
+				elsif r < 90 then
+					sp := sp - 1;
+					access(sp, true, random(256));
+				else
+					access(sp, false, 0);
+					sp := sp + 1;
+				end if;
+			end if;
+		end loop;
+
+		wait until falling_edge(clk_bus);
+		total := to_integer(unsigned(hits)) + to_integer(unsigned(misses));
+		report "RESULT pattern=" & PATTERN &
+			" warm=" & boolean'image(WARM) &
+			" cpu_hz=" & integer'image(CPU_HZ) &
+			" reads=" & integer'image(reads) &
+			" writes=" & integer'image(writes) &
+			" hits=" & integer'image(to_integer(unsigned(hits))) &
+			" misses=" & integer'image(to_integer(unsigned(misses))) &
+			" hit_rate=" & fixed2(to_integer(unsigned(hits)) * 10000 / maximum(total, 1)) & "%" &
+			" wait_t=" & fixed2(waits * 100 / ACCESSES) &
+			" access_clk=" & fixed2(clocks * 100 / ACCESSES) &
+			" errors=" & integer'image(errors);
+
+		done <= true;
+		wait;
+	end process;
+
+end sim;
@@ -0,0 +1,231 @@
+-------------------------------------------------------------------------------
+-- rom cache testbench
+--
+-- Runs Z80 M1 fetches at 28 MHz through rtl/memory/rom_cache.vhd against a
+-- rom model on RAM_DI and checks every opcode the CPU takes at T3 (DO on a
+-- hit, RAM_DI otherwise). A hit seen when WAIT is sampled (falling edge of
+-- T2) saves the wait state, a miss gets one like in memory.vhd.
+-- The address changes ADDR_NS after the rising edge of T1 and shows another
+-- cached address before that, RD falls RD_NS after the falling edge of T1.
+--   fill      LINES lines read twice: the first pass misses, the second hits
+--   late      the address settles after the falling edge of T1: no hit at T2,
+--             the cached byte is served in the wait state
+--   conflict  a line with the same index and another tag evicts the line
+--   flush     the rom content changes with FLUSH: a read while the sweep runs
+--             misses, then every byte is read again from RAM_DI
+--   loop      LOOP_BYTES of code run LOOP_TIMES times from a cold cache, the
+--             steady state of a rom loop: only the first time misses
+--
+-- Prints one line at the end:
+--   RESULT reads=... hits=... misses=... late_hits=... wait_states=...
+--          loop_fetches=... loop_hit_pct=... loop_wait_states=... errors=...
+-- hits / misses are counted at T2, late_hits are late reads served by DO,
+-- wait_states are the TW states inserted (without the cache every fetch takes one).
+-------------------------------------------------------------------------------
+
+library IEEE;
+use IEEE.std_logic_1164.all;
+use IEEE.numeric_std.all;
+
+entity tb_rom_cache is
+generic (
+	INDEX_BITS 	: integer := 4; -- 16 lines x 8 bytes
+	LINES 		: integer := 8; -- lines of the fill pass
+	ADDR_NS 		: integer := 10; -- address valid after the rising edge of T1
+	LATE_NS 		: integer := 25; -- same, late pass (after the falling edge of T1)
+	RD_NS 		: integer := 5; -- RD after the falling edge of T1, released after T3
+	RAM_NS 		: integer := 10; -- RAM_DI valid after RD
+	LOOP_BYTES 	: integer := 40; -- code of the loop pass, fits in the cache
+	LOOP_TIMES 	: integer := 50
+);
+end tb_rom_cache;
+
+architecture sim of tb_rom_cache is
+
+	constant CLK_PERIOD 	: time := 35714 ps; -- 28 MHz
+	constant BASE 			: integer := 16#1A340#; -- first address of the fill pass, line aligned
+	constant WAY 			: integer := 2**(INDEX_BITS + 3); -- same index, next tag
+	constant LOOP_BASE 	: integer := BASE + 16#4000# + 3; -- never read before, not line aligned
+
+	signal clk 		: std_logic := '0';
+	signal done 	: boolean := false;
+
+	signal a 		: std_logic_vector(18 downto 0) := (others => '0');
+	signal rd 		: std_logic := '0';
+	signal flush 	: std_logic := '0';
+	signal ram_di 	: std_logic_vector(7 downto 0);
+	signal do 		: std_logic_vector(7 downto 0);
+	signal hit 		: std_logic;
+
+	signal gen 		: integer := 0; -- rom content, changed along with a flush
+
+	function rom_byte(addr, g : integer) return integer is
+	begin
+		return (addr * 13 + addr / 256 + g * 101) mod 256;
+	end function;
+
+begin
+
+	clk <= not clk after CLK_PERIOD / 2 when not done;
+
+	U_DUT: entity work.rom_cache
+	generic map (
+		CACHE_INDEX_BITS => INDEX_BITS
+	)
+	port map (
+		CLK => clk,
+		FLUSH => flush,
+		A => a,
+		RD => rd,
+		RAM_DI => ram_di,
+		RAM_WAIT_N => '1',
+		DO => do,
+		HIT => hit
+	);
+
+	-- asynchronous rom in the ram
+	ram_di <= std_logic_vector(to_unsigned(rom_byte(to_integer(unsigned(a)), gen), 8)) after RAM_NS * 1 ns when rd = '1' else
+				 (others => 'X');
+
+	process
+		variable reads 	: natural := 0;
+		variable hits 		: natural := 0;
+		variable misses 	: natural := 0;
+		variable late_hits : natural := 0;
+		variable waits 	: natural := 0;
+		variable errors 	: natural := 0;
+		variable h 			: natural;
+		variable m 			: natural;
+
+		-- one M1 fetch: T1, T2, a wait state on a miss, T3 takes the opcode, T4 refresh
+		procedure fetch(addr : integer; glitch : integer; delay : integer) is
+			variable t2_hit 	: boolean;
+			variable got 		: integer;
+		begin
+			wait until rising_edge(clk); -- T1
+			a <= std_logic_vector(to_unsigned(glitch, 19)), std_logic_vector(to_unsigned(addr, 19)) after delay * 1 ns;
+			wait until falling_edge(clk);
+			rd <= '1' after RD_NS * 1 ns;
+			wait until rising_edge(clk); -- T2
+			wait until falling_edge(clk); -- WAIT
+			t2_hit := hit = '1';
+			if t2_hit then
+				hits := hits + 1;
+			else
+				misses := misses + 1;
+				waits := waits + 1;
+				wait until rising_edge(clk); -- TW
+				wait until falling_edge(clk);
+			end if;
+			wait until rising_edge(clk); -- T3
+			if hit = '1' then
+				got := to_integer(unsigned(do));
+				if not t2_hit then
+					late_hits := late_hits + 1;
+				end if;
+			else
+				got := to_integer(unsigned(ram_di));
+			end if;
+			reads := reads + 1;
+			if got /= rom_byte(addr, gen) then
+				errors := errors + 1;
+				report "fetch " & integer'image(addr) & ": " & integer'image(got) &
+					", expected " & integer'image(rom_byte(addr, gen)) severity error;
+			end if;
+			rd <= '0' after RD_NS * 1 ns;
+			wait until falling_edge(clk);
+			wait until rising_edge(clk); -- T4
+			wait until falling_edge(clk);
+		end procedure;
+
+		-- reads of the fill pass, the address before each one is another cached byte
+		procedure pass(delay : integer) is
+		begin
+			for i in 0 to LINES * 8 - 1 loop
+				fetch(BASE + i, BASE + (i + 29) mod (LINES * 8), delay);
+			end loop;
+		end procedure;
+
+		procedure expect(what : string; got, want : integer) is
+		begin
+			if got /= want then
+				errors := errors + 1;
+				report what & ": " & integer'image(got) & ", expected " & integer'image(want) severity error;
+			end if;
+		end procedure;
+
+	begin
+		wait for 10 * CLK_PERIOD;
+
+		-- fill
+		m := misses;
+		pass(ADDR_NS);
+		expect("fill misses", misses - m, LINES * 8);
+		h := hits;
+		pass(ADDR_NS);
+		expect("fill hits", hits - h, LINES * 8);
+
+		-- late address
+		h := hits;
+		m := late_hits;
+		pass(LATE_NS);
+		expect("late hits at T2", hits - h, 0);
+		expect("late hits in the wait state", late_hits - m, LINES * 8);
+
+		-- conflict
+		m := misses;
+		fetch(BASE + WAY, BASE, ADDR_NS);
+		fetch(BASE, BASE + WAY, ADDR_NS);
+		fetch(BASE + 1, BASE, ADDR_NS);
+		expect("conflict misses", misses - m, 3);
+		h := hits;
+		fetch(BASE + 1, BASE, ADDR_NS);
+		fetch(BASE + 8, BASE, ADDR_NS); -- next line, not evicted
+		expect("conflict hits", hits - h, 2);
+
+		-- flush
+		wait until falling_edge(clk);
+		gen <= 1;
+		flush <= '1';
+		wait until falling_edge(clk);
+		flush <= '0';
+		m := misses;
+		fetch(BASE + 8, BASE, ADDR_NS); -- the sweep is still running
+		expect("miss while flushing", misses - m, 1);
+		for i in 1 to 2**INDEX_BITS loop
+			wait until rising_edge(clk);
+		end loop;
+		m := misses;
+		pass(ADDR_NS);
+		expect("misses after the flush", misses - m, LINES * 8);
+		h := hits;
+		pass(ADDR_NS);
+		expect("hits after the flush", hits - h, LINES * 8);
+
+		-- loop, the address before each fetch is the previous one
+		h := hits;
+		m := waits;
+		for t in 1 to LOOP_TIMES loop
+			for i in 0 to LOOP_BYTES - 1 loop
+				fetch(LOOP_BASE + i, LOOP_BASE + (i + LOOP_BYTES - 1) mod LOOP_BYTES, ADDR_NS);
+			end loop;
+		end loop;
+		h := hits - h;
+		m := waits - m;
+		expect("loop wait states", m, LOOP_BYTES);
+
+		report "RESULT reads=" & integer'image(reads) &
+			" hits=" & integer'image(hits) &
+			" misses=" & integer'image(misses) &
+			" late_hits=" & integer'image(late_hits) &
+			" wait_states=" & integer'image(waits) &
+			" loop_fetches=" & integer'image(LOOP_BYTES * LOOP_TIMES) &
+			" loop_hit_pct=" & integer'image(h * 100 / (LOOP_BYTES * LOOP_TIMES)) &
+			" loop_wait_states=" & integer'image(m) &
+			" errors=" & integer'image(errors);
+
+		done <= true;
+		wait;
+	end process;
+
+end sim;
@@ -0,0 +1,210 @@
+-------------------------------------------------------------------------------
+-- SD DMA benchmark
+--
+-- The CPU at CPU_HZ programs the DMA (#00AB..#02AB address, #03AB sector count)
+-- and is held with WAIT on its next instruction fetch until the transfer ends.
+-- The SD card model sends LEAD busy bytes, the data token, 512 bytes of a
+-- running counter and 2 crc bytes for every sector, the RAM model checks every
+-- write against the counter and the address.
+--
+-- Prints one line at the end, same fields as tb_sd_read:
+--   RESULT device=dma engine=28mhz cpu_hz=... bytes=... errors=... waits=... time_ns=... kbyte_s=... spi_ns_per_byte=...
+-- spi_ns_per_byte is measured from the first to the last RAM write.
+-------------------------------------------------------------------------------
+
+library IEEE;
+use IEEE.std_logic_1164.all;
+use IEEE.numeric_std.all;
+
+entity tb_sd_dma is
+generic (
+	CPU_HZ 		: integer := 3500000;
+	SECTORS 		: integer := 1;
+	LEAD 			: integer := 4 -- 0xFF bytes before the data token
+);
+end tb_sd_dma;
+
+architecture sim of tb_sd_dma is
+
+	constant CLK_PERIOD : time := 35714 ps; -- 28 MHz
+	constant CPU_PERIOD : time := 1 sec / CPU_HZ;
+	constant SECTOR_LEN : integer := LEAD + 1 + 512 + 2;
+	constant BASE 		: integer := 16#8000#;
+
+	signal clk_28 		: std_logic := '0';
+	signal cpu_clk 	: std_logic := '0';
+	signal done 		: boolean := false;
+
+	-- cpu bus
+	signal a 			: std_logic_vector(15 downto 0) := (others => '1');
+	signal d 			: std_logic_vector(7 downto 0) := (others => '1');
+	signal iorq_n 		: std_logic := '1';
+	signal wr_n 		: std_logic := '1';
+	signal wait_n 		: std_logic;
+
+	-- ram
+	signal ram_a 		: std_logic_vector(20 downto 0);
+	signal ram_do 		: std_logic_vector(7 downto 0);
+	signal ram_wr 		: std_logic;
+	signal written 	: natural := 0;
+	signal t_first 	: time := 0 ns; -- first and last ram write
+	signal t_last 		: time := 0 ns;
+	signal ram_errors : natural := 0;
+
+	-- sd card
+	signal sclk 		: std_logic;
+	signal miso 		: std_logic;
+	signal sd_pos 		: natural := 0; -- byte in the stream
+	signal sd_bit 		: integer range 0 to 7 := 7;
+
+	function sd_byte(p : natural) return std_logic_vector is
+		variable s : natural := p mod SECTOR_LEN;
+	begin
+		if s < LEAD then
+			return X"FF";
+		elsif s = LEAD then
+			return X"FE";
+		elsif s <= LEAD + 512 then
+			return std_logic_vector(to_unsigned((p / SECTOR_LEN * 512 + s - LEAD - 1) mod 256, 8));
+		end if;
+		return X"00"; -- crc
+	end function;
+
+begin
+
+	clk_28 <= not clk_28 after CLK_PERIOD / 2 when not done;
+	cpu_clk <= not cpu_clk after CPU_PERIOD / 2 when not done;
+
+	U_DMA: entity work.sd_dma
+	port map (
+		CLK => clk_28,
+		RESET => '0',
+		A => a,
+		DI => d,
+		DO => open,
+		N_IORQ => iorq_n,
+		N_WR => wr_n,
+		N_M1 => '1',
+		N_WAIT => wait_n,
+		DMA_ACTIVE => open,
+		RAM_A => ram_a,
+		RAM_DO => ram_do,
+		RAM_WR => ram_wr,
+		RAM_BUSY => '0',
+		SCLK => sclk,
+		MISO => miso
+	);
+
+	-- data out, MSB first, changes on the falling sclk
+	process (sclk)
+	begin
+		if falling_edge(sclk) then
+			if sd_bit = 0 then
+				sd_bit <= 7;
+				sd_pos <= sd_pos + 1;
+			else
+				sd_bit <= sd_bit - 1;
+			end if;
+		end if;
+	end process;
+
+	miso <= sd_byte(sd_pos)(sd_bit);
+
+	-- ram, the write ends on the falling RAM_WR
+	process (ram_wr)
+		variable expect : std_logic_vector(7 downto 0);
+	begin
+		if falling_edge(ram_wr) then
+			expect := std_logic_vector(to_unsigned(written mod 256, 8));
+			if ram_do /= expect or to_integer(unsigned(ram_a)) /= BASE + written then
+				ram_errors <= ram_errors + 1;
+				report "write " & integer'image(written) & ": " & to_hstring(ram_do) & " at " & to_hstring(ram_a) &
+					", expected " & to_hstring(expect) severity error;
+			end if;
+			if written = 0 then
+				t_first <= now;
+			end if;
+			t_last <= now;
+			written <= written + 1;
+		end if;
+	end process;
+
+	process
+		variable waits 	: natural := 0;
+		variable errors 	: natural := 0;
+		variable t_start 	: time;
+		variable t_total 	: time;
+
+		procedure tstates(n : natural) is
+		begin
+			for i in 1 to n loop
+				wait until rising_edge(cpu_clk);
+			end loop;
+		end procedure;
+
+		-- OUT (C),r: T1, T2, TW (automatic), T3
+		procedure port_write(port_a : std_logic_vector(15 downto 0); value : std_logic_vector(7 downto 0)) is
+		begin
+			wait until rising_edge(cpu_clk); -- T1
+			a <= port_a;
+			d <= value;
+			wait until rising_edge(cpu_clk); -- T2
+			iorq_n <= '0';
+			wr_n <= '0';
+			wait until rising_edge(cpu_clk); -- TW
+			wait until falling_edge(cpu_clk);
+			while wait_n = '0' loop
+				waits := waits + 1;
+				wait until falling_edge(cpu_clk);
+			end loop;
+			wait until rising_edge(cpu_clk); -- T3
+			wait until falling_edge(cpu_clk);
+			iorq_n <= '1';
+			wr_n <= '1';
+		end procedure;
+
+		-- the next opcode fetch, WAIT is sampled on the falling edge of T2
+		procedure fetch is
+		begin
+			wait until rising_edge(cpu_clk); -- T1
+			wait until rising_edge(cpu_clk); -- T2
+			wait until falling_edge(cpu_clk);
+			while wait_n = '0' loop
+				waits := waits + 1;
+				wait until falling_edge(cpu_clk);
+			end loop;
+			tstates(2); -- T3, T4
+		end procedure;
+
+	begin
+		tstates(16);
+		port_write(X"00AB", X"00");
+		port_write(X"01AB", X"80");
+		port_write(X"02AB", X"00");
+
+		t_start := now;
+		tstates(4); -- OUT (C),r fetch
+		port_write(X"03AB", std_logic_vector(to_unsigned(SECTORS, 8)));
+		fetch;
+		t_total := now - t_start;
+
+		errors := ram_errors;
+		if written /= SECTORS * 512 then
+			errors := errors + 1;
+			report integer'image(written) & " bytes written, expected " & integer'image(SECTORS * 512) severity error;
+		end if;
+
+		report "RESULT device=dma engine=28mhz" &
+			" cpu_hz=" & integer'image(CPU_HZ) &
+			" bytes=" & integer'image(SECTORS * 512) &
+			" errors=" & integer'image(errors) &
+			" waits=" & integer'image(waits) &
+			" time_ns=" & integer'image(t_total / 1 ns) &
+			" kbyte_s=" & integer'image(SECTORS * 512 * 1000000 / (t_total / 1 ns)) &
+			" spi_ns_per_byte=" & integer'image((t_last - t_first) / 1 ns / (SECTORS * 512 - 1));
+
+		done <= true;
+		wait;
+	end process;
+
+end sim;
@@ -0,0 +1,211 @@
+-------------------------------------------------------------------------------
+-- SD read benchmark
+--
+-- A Z80 INIR loop (21 T-states per byte, the port read at T 10..13) reads
+-- BYTES bytes from the Z-Controller (#57) or DivMMC (#EB) data port at CPU_HZ.
+-- The SD card model returns a byte counter, every read must return the byte
+-- shifted in by the previous one.
+--
+-- ENGINE_CPU = true clocks the SPI engine from the CPU clock (the old
+-- Z-Controller wiring), false from the fixed 28 MHz clock.
+--
+-- Prints one line at the end:
+--   RESULT device=... engine=... cpu_hz=... bytes=... errors=... time_ns=... kbyte_s=... spi_ns_per_byte=...
+-------------------------------------------------------------------------------
+
+library IEEE;
+use IEEE.std_logic_1164.all;
+use IEEE.numeric_std.all;
+
+entity tb_sd_read is
+generic (
+	DIVMMC 		: boolean := false; -- false: Z-Controller, true: DivMMC
+	ENGINE_CPU 	: boolean := false; -- SPI engine clock: CPU clock or 28 MHz
+	CPU_HZ 		: integer := 3500000;
+	BYTES 		: integer := 512
+);
+end tb_sd_read;
+
+architecture sim of tb_sd_read is
+
+	constant CLK_PERIOD : time := 35714 ps; -- 28 MHz
+	constant CPU_PERIOD : time := 1 sec / CPU_HZ;
+
+	function engine_period return time is
+	begin
+		if ENGINE_CPU then
+			return CPU_PERIOD;
+		end if;
+		return CLK_PERIOD;
+	end function;
+
+	function name(b : boolean; yes, no : string) return string is
+	begin
+		if b then
+			return yes;
+		end if;
+		return no;
+	end function;
+
+	signal clk_28 		: std_logic := '0';
+	signal cpu_clk 	: std_logic := '0';
+	signal engine_clk : std_logic;
+	signal done 		: boolean := false;
+
+	-- cpu bus
+	signal a 			: std_logic_vector(15 downto 0) := (others => '1');
+	signal iorq_n 		: std_logic := '1';
+	signal rd_n 		: std_logic := '1';
+	signal do 			: std_logic_vector(7 downto 0);
+
+	-- sd card
+	signal sclk 		: std_logic;
+	signal miso 		: std_logic;
+	signal cs_n 		: std_logic;
+	signal sd_byte 	: unsigned(7 downto 0) := (others => '0');
+	signal sd_bit 		: integer range 0 to 7 := 7;
+
+begin
+
+	clk_28 <= not clk_28 after CLK_PERIOD / 2 when not done;
+	cpu_clk <= not cpu_clk after CPU_PERIOD / 2 when not done;
+	engine_clk <= cpu_clk when ENGINE_CPU else clk_28;
+
+	G_ZC: if not DIVMMC generate
+		signal zc_rd : std_logic;
+	begin
+		zc_rd <= '1' when iorq_n = '0' and rd_n = '0' and a(7 downto 6) = "01" and a(4 downto 0) = "10111" else '0';
+
+		U_ZC: entity work.zcontroller
+		port map (
+			RESET => '0',
+			CLK => engine_clk,
+			A => a(5),
+			DI => X"FF",
+			DO => do,
+			RD => zc_rd,
+			WR => '0',
+			SDDET => '0',
+			SDPROT => '0',
+			CS_n => cs_n,
+			SCLK => sclk,
+			MOSI => open,
+			MISO => miso
+		);
+	end generate;
+
+	G_DIVMMC: if DIVMMC generate
+		U_DIVMMC: entity work.divmmc
+		port map (
+			I_CLK => engine_clk,
+			I_CS => '1',
+			I_RESET => '0',
+			I_ADDR => a,
+			I_DATA => X"FF",
+			O_DATA => do,
+			O_WR => open,
+			I_WR_N => '1',
+			I_RD_N => rd_n,
+			I_IORQ_N => iorq_n,
+			I_MREQ_N => '1',
+			I_M1_N => '1',
+			O_DISABLE_ZXROM => open,
+			O_EEPROM_CS_N => open,
+			O_EEPROM_WE_N => open,
+			O_SRAM_CS_N => open,
+			O_SRAM_WE_N => open,
+			O_SRAM_HIADDR => open,
+			O_CS_N => cs_n,
+			O_SCLK => sclk,
+			O_MOSI => open,
+			I_MISO => miso
+		);
+	end generate;
+
+	-- sd card in data transfer: a byte counter, MSB first, changes on the falling sclk
+	process (sclk)
+	begin
+		if falling_edge(sclk) then
+			if sd_bit = 0 then
+				sd_bit <= 7;
+				sd_byte <= sd_byte + 1;
+			else
+				sd_bit <= sd_bit - 1;
+			end if;
+		end if;
+	end process;
+
+	miso <= sd_byte(sd_bit);
+
+	process
+		variable data 		: std_logic_vector(7 downto 0);
+		variable expect 	: unsigned(7 downto 0) := (others => '0');
+		variable errors 	: natural := 0;
+		variable t_start 	: time;
+		variable t_total 	: time;
+
+		procedure tstates(n : natural) is
+		begin
+			for i in 1 to n loop
+				wait until rising_edge(cpu_clk);
+			end loop;
+		end procedure;
+
+		-- IN r,(C): T1, T2, TW (automatic), T3
+		procedure port_read(port_a : std_logic_vector(15 downto 0); value : out std_logic_vector(7 downto 0)) is
+		begin
+			wait until rising_edge(cpu_clk); -- T1
+			a <= port_a;
+			wait until rising_edge(cpu_clk); -- T2
+			iorq_n <= '0';
+			rd_n <= '0';
+			wait until rising_edge(cpu_clk); -- TW
+			wait until rising_edge(cpu_clk); -- T3
+			wait until falling_edge(cpu_clk);
+			value := do;
+			iorq_n <= '1';
+			rd_n <= '1';
+		end procedure;
+
+		impure function port_addr return std_logic_vector is
+		begin
+			if DIVMMC then
+				return X"00EB";
+			else
+				return X"0057";
+			end if;
+		end function;
+
+	begin
+		tstates(16);
+		t_start := now;
+
+		for i in 0 to BYTES loop
+			tstates(9); -- ED B2 fetch
+			port_read(port_addr, data);
+			if i > 0 then
+				if unsigned(data) /= expect then
+					errors := errors + 1;
+					report "byte " & integer'image(i) & " is " & to_hstring(data) & ", expected " & to_hstring(expect) severity error;
+				end if;
+				expect := expect + 1;
+			end if;
+			tstates(8); -- memory write, repeat
+		end loop;
+
+		t_total := now - t_start;
+
+		report "RESULT device=" & name(DIVMMC, "divmmc", "zc") &
+			" engine=" & name(ENGINE_CPU, "cpu", "28mhz") &
+			" cpu_hz=" & integer'image(CPU_HZ) &
+			" bytes=" & integer'image(BYTES) &
+			" errors=" & integer'image(errors) &
+			" time_ns=" & integer'image(t_total / 1 ns) &
+			" kbyte_s=" & integer'image(BYTES * 1000000 / (t_total / 1 ns)) &
+			" spi_ns_per_byte=" & integer'image(8 * engine_period / 1 ns);
+
+		done <= true;
+		wait;
+	end process;
+
+end sim;
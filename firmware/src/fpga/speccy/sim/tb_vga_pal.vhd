@@ -0,0 +1,160 @@
+-------------------------------------------------------------------------------
+-- Scandoubler latency benchmark
+--
+-- Feeds vga_pal with a 896 x 320 frame at 14 MHz (Pentagon timing), black
+-- except for a white marker of MARK_LEN pixels on line MARK_LINE of frame 2,
+-- the first frames let the counters lock to the input syncs.
+-- Measures the time from the marker entering RGB_IN to its first pixel on
+-- RGB_O, counts the VGA lines showing it (a doubled line must show up twice)
+-- and reads the input-to-output vsync delay from the LATENCY port.
+--
+-- Prints one line at the end:
+--   RESULT line_lock=... errors=... lines=... pixel_latency_ns=... vsync_latency_ns=...
+-------------------------------------------------------------------------------
+
+library IEEE;
+use IEEE.std_logic_1164.all;
+use IEEE.numeric_std.all;
+
+entity tb_vga_pal is
+generic (
+	LINE_LOCK 	: boolean := true;
+	MARK_LINE 	: integer := 160;
+	MARK_POS 	: integer := 400; -- 14 MHz clocks from the line start
+	MARK_LEN 	: integer := 32
+);
+end tb_vga_pal;
+
+architecture sim of tb_vga_pal is
+
+	constant CLK2_PERIOD : time := 35714 ps; -- 28 MHz
+	constant H_TOTAL 	: integer := 896;
+	constant V_TOTAL 	: integer := 320;
+	constant MARK 		: std_logic_vector(5 downto 0) := "111111";
+
+	signal clk_28 		: std_logic := '0';
+	signal clk_14 		: std_logic := '0';
+	signal done 		: boolean := false;
+
+	-- input video
+	signal h 			: integer range 0 to H_TOTAL - 1 := 0;
+	signal v 			: integer range 0 to V_TOTAL - 1 := 0;
+	signal frame 		: natural := 0;
+	signal rgb_in 		: std_logic_vector(5 downto 0) := (others => '0');
+	signal hsync 		: std_logic := '1';
+	signal vsync 		: std_logic := '1';
+	signal t_in 		: time := 0 ns;
+
+	-- output video
+	signal rgb_o 		: std_logic_vector(5 downto 0);
+	signal vsync_vga 	: std_logic;
+	signal hsync_vga 	: std_logic;
+	signal latency 	: std_logic_vector(19 downto 0);
+
+	function name(b : boolean) return string is
+	begin
+		if b then
+			return "true";
+		end if;
+		return "false";
+	end function;
+
+begin
+
+	clk_28 <= not clk_28 after CLK2_PERIOD / 2 when not done;
+
+	process (clk_28)
+	begin
+		if rising_edge(clk_28) then
+			clk_14 <= not clk_14;
+		end if;
+	end process;
+
+	U_VGA: entity work.vga_pal
+	generic map (
+		line_lock => LINE_LOCK
+	)
+	port map (
+		RGB_IN => rgb_in,
+		DS80 => '0',
+		KSI_IN => vsync,
+		SSI_IN => hsync,
+		CLK => clk_14,
+		CLK2 => clk_28,
+		EN => '1',
+		RGB_O => rgb_o,
+		VSYNC_VGA => vsync_vga,
+		HSYNC_VGA => hsync_vga,
+		LATENCY => latency
+	);
+
+	-- input timing, the video changes on the rising CLK
+	process (clk_14)
+	begin
+		if rising_edge(clk_14) then
+			if h = H_TOTAL - 1 then
+				h <= 0;
+				if v = V_TOTAL - 1 then
+					v <= 0;
+					frame <= frame + 1;
+				else
+					v <= v + 1;
+				end if;
+			else
+				h <= h + 1;
+			end if;
+		end if;
+	end process;
+
+	hsync <= '0' when h < 64 else '1';
+	vsync <= '0' when v < 4 else '1';
+	rgb_in <= MARK when frame = 2 and v = MARK_LINE and h >= MARK_POS and h < MARK_POS + MARK_LEN else (others => '0');
+
+	process (rgb_in)
+	begin
+		if rgb_in = MARK and t_in = 0 ns then
+			t_in <= now;
+		end if;
+	end process;
+
+	process
+		variable t_out 	: time := 0 ns;
+		variable lines 	: natural := 0;
+		variable seen 		: boolean := false;
+		variable errors 	: natural := 0;
+	begin
+		while frame < 4 loop
+			wait until rising_edge(clk_28) or falling_edge(hsync_vga);
+			if falling_edge(hsync_vga) then
+				if seen then
+					lines := lines + 1;
+				end if;
+				seen := false;
+			elsif rgb_o = MARK and frame >= 2 then
+				if t_out = 0 ns then
+					t_out := now;
+				end if;
+				seen := true;
+			end if;
+		end loop;
+
+		if t_out = 0 ns then
+			errors := errors + 1;
+			report "marker not on the output" severity error;
+		end if;
+		if lines /= 2 then
+			errors := errors + 1;
+			report "marker on " & integer'image(lines) & " lines, expected 2" severity error;
+		end if;
+
+		report "RESULT line_lock=" & name(LINE_LOCK) &
+			" errors=" & integer'image(errors) &
+			" lines=" & integer'image(lines) &
+			" pixel_latency_ns=" & integer'image((t_out - t_in) / 1 ns) &
+			" vsync_latency_ns=" & integer'image(to_integer(unsigned(latency)) * 2 * CLK2_PERIOD / 1 ns);
+
+		done <= true;
+		wait;
+	end process;
+
+end sim;